@@ -1,4 +1,14 @@
 #include <string>
+#include <cstddef>
 
 std::string base64_encode(unsigned char const* , unsigned int len);
-std::string base64_decode(std::string const& s);
\ No newline at end of file
+std::string base64_decode(std::string const& s);
+
+// Upper bound on the number of bytes decoded from len base64 characters.
+inline size_t base64_decoded_size(size_t len) { return (len / 4) * 3 + 3; }
+
+// Decodes len base64 characters into out, which must hold at least
+// base64_decoded_size(len) bytes. Whitespace is skipped in place and
+// decoding stops at padding or the first invalid character. Returns the
+// number of bytes written.
+size_t base64_decode(const char* encoded, size_t len, unsigned char* out);
@@ -0,0 +1,26 @@
+if(DRAWSVG_BUILD_BENCHMARKS)
+
+  # Benchmarks link the drawsvg sources they measure directly
+  include_directories(${CMAKE_CURRENT_SOURCE_DIR})
+
+  # texel layout benchmark
+  add_executable( texture_layout
+      bench/texture_layout.cpp
+      texture.cpp
+  )
+  target_link_libraries( texture_layout CMU462 ${CMU462_LIBRARIES} )
+  if (UNIX)
+    target_link_libraries( texture_layout -fopenmp )
+  endif(UNIX)
+
+  # png decoder benchmark
+  add_executable( png_decode
+      bench/png_decode.cpp
+      png.cpp
+  )
+  target_link_libraries( png_decode CMU462 ${CMU462_LIBRARIES} )
+  if (UNIX)
+    target_link_libraries( png_decode -fopenmp )
+  endif(UNIX)
+
+endif(DRAWSVG_BUILD_BENCHMARKS)
@@ -0,0 +1,139 @@
+/*
+ * PNG decoder benchmark.
+ * Decodes the same images with picoPNG and with the table-driven decoder
+ * and reports the throughput of each in decoded megabytes per second,
+ * after checking both produce the same pixels. Without arguments it
+ * encodes a few synthetic images of the kinds svg files embed: a photo,
+ * flat artwork and noise, at the default compression level.
+ *
+ * usage: png_decode [png file]...
+ */
+
+#include "png.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace CMU462;
+
+struct Input {
+  string name;
+  vector<unsigned char> data;
+};
+
+// smooth gradients with a little grain, filters well and deflates poorly
+static PNG photo( int size ) {
+  PNG png; png.width = png.height = size;
+  png.pixels.resize(4 * size * size);
+  uint32_t seed = 1;
+  for (int y = 0; y < size; y++) {
+    for (int x = 0; x < size; x++) {
+      seed = seed * 1664525u + 1013904223u;
+      int grain = (seed >> 28) - 8;
+      unsigned char* p = &png.pixels[4 * (y * size + x)];
+      p[0] = (unsigned char) max(0, min(255, (int) (127 + 120 * sinf(x * 0.011f)) + grain));
+      p[1] = (unsigned char) max(0, min(255, (int) (127 + 120 * cosf(y * 0.007f)) + grain));
+      p[2] = (unsigned char) max(0, min(255, (x + y) * 255 / (2 * size) + grain));
+      p[3] = 255;
+    }
+  }
+  return png;
+}
+
+// few colors in large runs, long matches
+static PNG flat( int size ) {
+  PNG png; png.width = png.height = size;
+  png.pixels.resize(4 * size * size);
+  for (int y = 0; y < size; y++) {
+    for (int x = 0; x < size; x++) {
+      int band = ((x / 37) + (y / 53)) % 4;
+      unsigned char* p = &png.pixels[4 * (y * size + x)];
+      p[0] = band * 60; p[1] = 255 - band * 60; p[2] = 128; p[3] = band ? 255 : 0;
+    }
+  }
+  return png;
+}
+
+// incompressible, mostly literals
+static PNG noise( int size ) {
+  PNG png; png.width = png.height = size;
+  png.pixels.resize(4 * size * size);
+  uint32_t seed = 7;
+  for (size_t i = 0; i < png.pixels.size(); i++) {
+    seed = seed * 1664525u + 1013904223u;
+    png.pixels[i] = seed >> 24;
+  }
+  return png;
+}
+
+// seconds per decode, best of a few rounds
+static double time_decode( const Input& input, PNGDecoder decoder, PNG& png ) {
+  double best = 1e30;
+  for (int round = 0; round < 5; round++) {
+    chrono::high_resolution_clock::time_point t0 = chrono::high_resolution_clock::now();
+    png.pixels.clear();
+    if (PNGParser::load(&input.data[0], input.data.size(), png, decoder)) return -1;
+    chrono::high_resolution_clock::time_point t1 = chrono::high_resolution_clock::now();
+    best = min(best, chrono::duration<double>(t1 - t0).count());
+  }
+  return best;
+}
+
+int main( int argc, char** argv ) {
+
+  vector<Input> inputs;
+  for (int i = 1; i < argc; i++) {
+    ifstream file(argv[i], ios::binary);
+    Input input;
+    input.name = argv[i];
+    input.data.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+    if (input.data.empty()) {
+      fprintf(stderr, "Could not read %s\n", argv[i]);
+      return 1;
+    }
+    inputs.push_back(input);
+  }
+
+  if (inputs.empty()) {
+    const char* names[3] = { "photo", "flat", "noise" };
+    PNG images[3] = { photo(1024), flat(1024), noise(1024) };
+    for (int i = 0; i < 3; i++) {
+      Input input;
+      input.name = string(names[i]) + " 1024x1024";
+      PNGParser::save(input.data, images[i]);
+      inputs.push_back(input);
+    }
+  }
+
+  printf("image                       KB   pico MB/s   fast MB/s  speedup\n");
+  for (size_t i = 0; i < inputs.size(); i++) {
+
+    PNG pico, fast;
+    double t_pico = time_decode(inputs[i], PNG_DECODER_PICO, pico);
+    double t_fast = time_decode(inputs[i], PNG_DECODER_FAST, fast);
+    if (t_pico < 0 || t_fast < 0) {
+      printf("%-24s  failed to decode\n", inputs[i].name.c_str());
+      continue;
+    }
+    if (pico.width != fast.width || pico.height != fast.height ||
+        pico.pixels != fast.pixels) {
+      printf("%-24s  decoders disagree\n", inputs[i].name.c_str());
+      return 1;
+    }
+
+    double mb = pico.pixels.size() / 1e6;
+    printf("%-24s %6zu %11.1f %11.1f %7.2fx\n", inputs[i].name.c_str(),
+           inputs[i].data.size() / 1024, mb / t_pico, mb / t_fast, t_pico / t_fast);
+  }
+
+  return 0;
+}
@@ -0,0 +1,153 @@
+/*
+ * Texel layout benchmark.
+ * Draws a large texture rotated by a range of angles through
+ * Sampler2DImp::sample_span, once with linear and once with tiled texels,
+ * and reports throughput along with the miss rate of a simulated L1 cache
+ * (32KB, 8-way, 64 byte lines, LRU) fed with the bilinear texel fetches.
+ *
+ * usage: texture_layout [texture size] [target size]
+ */
+
+#include "texture.h"
+#include "color.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <chrono>
+#include <vector>
+
+using namespace std;
+using namespace CMU462;
+
+// set-associative LRU cache model
+class CacheModel {
+ public:
+
+  CacheModel( size_t size = 32 * 1024, size_t ways = 8, size_t line = 64 )
+    : ways ( ways ), line ( line ), sets ( size / (ways * line) ),
+      tags ( sets * ways, ~(uint64_t) 0 ), accesses ( 0 ), misses ( 0 ) { }
+
+  void access( uint64_t address ) {
+    uint64_t tag = address / line;
+    uint64_t* set = &tags[(tag % sets) * ways];
+    accesses++;
+    for (size_t i = 0; i < ways; i++) {
+      if (set[i] == tag) {
+        for (; i > 0; i--) set[i] = set[i - 1];
+        set[0] = tag;
+        return;
+      }
+    }
+    misses++;
+    for (size_t i = ways - 1; i > 0; i--) set[i] = set[i - 1];
+    set[0] = tag;
+  }
+
+  double miss_rate() const {
+    return accesses ? (double) misses / accesses : 0;
+  }
+
+ private:
+
+  size_t ways, line, sets;
+  vector<uint64_t> tags;
+  uint64_t accesses, misses;
+};
+
+// byte offset of a texel, mirrors the layouts described in texture.h
+static uint64_t texel_offset( TexelLayout layout, size_t w, int x, int y ) {
+  if (layout == LINEAR_LAYOUT) return 4 * ((uint64_t) y * w + x);
+  uint64_t blocks_w = (w + 3) >> 2;
+  return 4 * ((((y >> 2) * blocks_w + (x >> 2)) << 4) + ((y & 3) << 2) + (x & 3));
+}
+
+// uv of each target sample for the texture rotated by angle around its
+// center, one texel per sample so that level 0 is sampled
+static void rotated_span( float angle, size_t size, size_t target,
+                          size_t y, float* uv ) {
+  float c = cosf(angle), s = sinf(angle);
+  float py = ((float) y + 0.5f - target / 2.f) / size;
+  for (size_t x = 0; x < target; x++) {
+    float px = ((float) x + 0.5f - target / 2.f) / size;
+    uv[2 * x]     = 0.5f + c * px + s * py;
+    uv[2 * x + 1] = 0.5f - s * px + c * py;
+  }
+}
+
+static void run( Texture& tex, TexelLayout layout, float angle, size_t target,
+                 double& samples_per_second, double& miss_rate ) {
+
+  Sampler2DImp sampler( BILINEAR );
+  vector<float> uv(2 * target);
+  vector<Color> colors(target);
+
+  // throughput
+  float u_scale = 1.f / tex.width, v_scale = 1.f / tex.height;
+  float sink = 0;
+  chrono::high_resolution_clock::time_point t0 = chrono::high_resolution_clock::now();
+  for (size_t y = 0; y < target; y++) {
+    rotated_span(angle, tex.width, target, y, &uv[0]);
+    sampler.sample_span(tex, &uv[0], target, u_scale, v_scale, &colors[0]);
+    sink += colors[target / 2].r;
+  }
+  chrono::high_resolution_clock::time_point t1 = chrono::high_resolution_clock::now();
+  double seconds = chrono::duration<double>(t1 - t0).count();
+  samples_per_second = target * target / seconds + sink * 0;
+
+  // simulated misses of the bilinear fetches on level 0
+  const MipLevel& mip = tex.mipmap[0];
+  CacheModel cache;
+  for (size_t y = 0; y < target; y++) {
+    rotated_span(angle, tex.width, target, y, &uv[0]);
+    for (size_t x = 0; x < target; x++) {
+      int sx = (int) floorf(mip.width  * uv[2 * x]     - 0.5f);
+      int sy = (int) floorf(mip.height * uv[2 * x + 1] - 0.5f);
+      for (int j = 0; j < 2; j++) {
+        for (int i = 0; i < 2; i++) {
+          int tx = min(max(sx + i, 0), (int) mip.width  - 1);
+          int ty = min(max(sy + j, 0), (int) mip.height - 1);
+          cache.access(texel_offset(layout, mip.width, tx, ty));
+        }
+      }
+    }
+  }
+  miss_rate = cache.miss_rate();
+}
+
+int main( int argc, char** argv ) {
+
+  size_t size   = argc > 1 ? atoi(argv[1]) : 2048;
+  size_t target = argc > 2 ? atoi(argv[2]) : 1024;
+
+  Texture tex;
+  tex.width = tex.height = size;
+  tex.mipmap.resize(1);
+  tex.mipmap[0].width = tex.mipmap[0].height = size;
+  tex.mipmap[0].texels.resize(4 * size * size);
+  for (size_t i = 0; i < tex.mipmap[0].texels.size(); i++) {
+    tex.mipmap[0].texels[i] = (unsigned char) (i * 2654435761u >> 24);
+  }
+
+  printf("%zux%zu texture, %zux%zu target, bilinear\n", size, size, target, target);
+  printf("angle   linear Msamples/s  miss   tiled Msamples/s  miss\n");
+
+  float angles[] = { 0, 15, 30, 45, 60, 90 };
+  for (size_t a = 0; a < sizeof(angles) / sizeof(angles[0]); a++) {
+
+    float angle = angles[a] * (float) M_PI / 180;
+    double rate[2], miss[2];
+    TexelLayout layouts[2] = { LINEAR_LAYOUT, TILED_LAYOUT };
+    for (int l = 0; l < 2; l++) {
+      convert_texels(tex, layouts[l]);
+      run(tex, layouts[l], angle, target, rate[l], miss[l]);
+    }
+
+    printf("%5.0f   %17.1f  %4.1f%%  %16.1f  %4.1f%%\n", angles[a],
+           rate[0] / 1e6, 100 * miss[0], rate[1] / 1e6, 100 * miss[1]);
+  }
+
+  return 0;
+}
@@ -0,0 +1,76 @@
+# Core library: parser, software renderer, samplers and png i/o, with a
+# C interface (core/drawsvg_core.h) for embedding. It compiles the few
+# CMU462 sources it uses instead of linking the library, which pulls in
+# GLFW, GLEW and OpenGL.
+option(DRAWSVG_CORE_SHARED  "Also build drawsvg_core as a shared library"  OFF)
+
+set(CMU462_SOURCE_DIR ${PROJECT_SOURCE_DIR}/CMU462/src)
+include_directories(
+    ${CMAKE_CURRENT_SOURCE_DIR}
+    ${PROJECT_SOURCE_DIR}/CMU462/include
+    ${PROJECT_SOURCE_DIR}/CMU462/include/CMU462
+)
+
+set(DRAWSVG_CORE_SOURCE
+    core/drawsvg_core.cpp
+    svg.cpp
+    svg_cache.cpp
+    png.cpp
+    texture.cpp
+    texture_cache.cpp
+    texture_atlas.cpp
+    texture_manager.cpp
+    virtual_texture.cpp
+    viewport.cpp
+    triangulation.cpp
+    software_renderer.cpp
+    tiles.cpp
+    ${CMU462_SOURCE_DIR}/vector2D.cpp
+    ${CMU462_SOURCE_DIR}/vector3D.cpp
+    ${CMU462_SOURCE_DIR}/matrix3x3.cpp
+    ${CMU462_SOURCE_DIR}/color.cpp
+    ${CMU462_SOURCE_DIR}/base64.cpp
+    ${CMU462_SOURCE_DIR}/tinyxml2.cpp
+    ${CMU462_SOURCE_DIR}/lodepng.cpp
+)
+
+set(DRAWSVG_CORE_HEADER
+    core/drawsvg_core.h
+)
+
+# static library, for C and C++ programs including the tools in this tree
+add_library( drawsvg_core STATIC
+    ${DRAWSVG_CORE_SOURCE}
+    ${DRAWSVG_CORE_HEADER}
+)
+target_link_libraries( drawsvg_core ${CMAKE_THREAD_LIBS_INIT} )
+if (UNIX)
+  target_link_libraries( drawsvg_core -fopenmp )
+endif(UNIX)
+
+install(TARGETS drawsvg_core DESTINATION ${drawsvg_SOURCE_DIR}/lib)
+install(FILES ${DRAWSVG_CORE_HEADER} DESTINATION ${drawsvg_SOURCE_DIR}/include)
+
+# shared library exporting only the C interface
+if(DRAWSVG_CORE_SHARED)
+
+  add_library( drawsvg_core_shared SHARED
+      ${DRAWSVG_CORE_SOURCE}
+      ${DRAWSVG_CORE_HEADER}
+  )
+  set_target_properties( drawsvg_core_shared PROPERTIES
+      OUTPUT_NAME drawsvg_core
+      COMPILE_DEFINITIONS "DRAWSVG_CORE_SHARED;DRAWSVG_CORE_EXPORTS"
+      VERSION 1 SOVERSION 1
+  )
+  if (UNIX)
+    set_target_properties( drawsvg_core_shared PROPERTIES
+        COMPILE_FLAGS "-fvisibility=hidden -fvisibility-inlines-hidden"
+    )
+    target_link_libraries( drawsvg_core_shared -fopenmp )
+  endif(UNIX)
+  target_link_libraries( drawsvg_core_shared ${CMAKE_THREAD_LIBS_INIT} )
+
+  install(TARGETS drawsvg_core_shared DESTINATION ${drawsvg_SOURCE_DIR}/lib)
+
+endif(DRAWSVG_CORE_SHARED)
@@ -0,0 +1,164 @@
+#include "drawsvg_core.h"
+
+#include "svg.h"
+#include "svg_cache.h"
+#include "texture_manager.h"
+#include "software_renderer.h"
+#include "viewport.h"
+
+#include <new>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+using namespace CMU462;
+
+struct drawsvg_document {
+
+  drawsvg_document( SVG* svg ) : svg ( svg ), viewbox ( false ),
+                                 sample_rate ( 1 ) { }
+  ~drawsvg_document() { delete svg; }
+
+  SVG* svg;
+
+  // viewbox set by drawsvg_set_viewport, the viewer's default otherwise
+  bool viewbox;
+  float x, y, span;
+
+  size_t sample_rate;
+  Sampler2DImp sampler;
+  SoftwareRendererImp renderer;
+
+  // rows of targets with padding are rendered here and copied out
+  vector<unsigned char> scratch;
+};
+
+namespace {
+
+drawsvg_document* create( SVG* svg, int error ) {
+  if (error < 0) {
+    delete svg;
+    return NULL;
+  }
+  return new (nothrow) drawsvg_document(svg);
+}
+
+} // namespace
+
+extern "C" {
+
+int drawsvg_version( void ) {
+  return DRAWSVG_CORE_VERSION;
+}
+
+drawsvg_document* drawsvg_load( const char* filename ) {
+  if (!filename) return NULL;
+  try {
+    SVG* svg = new SVG();
+    if (SVGCache::load(filename, svg) == 0) return create(svg, 0);
+    return create(svg, SVGParser::load(filename, svg));
+  } catch (...) {
+    return NULL;
+  }
+}
+
+drawsvg_document* drawsvg_load_memory( const char* data, size_t size ) {
+  if (!data) return NULL;
+  try {
+    SVG* svg = new SVG();
+    return create(svg, SVGParser::load(data, size, svg));
+  } catch (...) {
+    return NULL;
+  }
+}
+
+void drawsvg_free( drawsvg_document* doc ) {
+  delete doc;
+}
+
+int drawsvg_get_size( const drawsvg_document* doc,
+                      float* width, float* height ) {
+  if (!doc) return -1;
+  if (width)  *width  = doc->svg->width;
+  if (height) *height = doc->svg->height;
+  return 0;
+}
+
+int drawsvg_set_viewport( drawsvg_document* doc,
+                          float x, float y, float span ) {
+  if (!doc) return -1;
+  doc->viewbox = span > 0;
+  doc->x = x; doc->y = y; doc->span = span;
+  return 0;
+}
+
+int drawsvg_set_sample_rate( drawsvg_document* doc, size_t sample_rate ) {
+  if (!doc || !sample_rate) return -1;
+  doc->sample_rate = sample_rate;
+  return 0;
+}
+
+int drawsvg_set_sample_method( drawsvg_document* doc,
+                               drawsvg_sample_method method ) {
+  if (!doc || method < DRAWSVG_NEAREST || method > DRAWSVG_SUMMED_AREA) {
+    return -1;
+  }
+  doc->sampler.set_sample_method((SampleMethod) method);
+  return 0;
+}
+
+int drawsvg_render( drawsvg_document* doc, unsigned char* rgba,
+                    size_t width, size_t height, size_t stride ) {
+
+  if (!doc || !rgba || !width || !height) return -1;
+  if (!stride) stride = 4 * width;
+  if (stride < 4 * width) return -1;
+
+  try {
+
+    // view as DrawSVG sets it up, see DrawSVG::auto_adjust and resize
+    SVG* svg = doc->svg;
+    ViewportImp viewport;
+    if (doc->viewbox) {
+      viewport.set_viewbox(doc->x, doc->y, doc->span);
+    } else {
+      viewport.set_viewbox(svg->width / 2, svg->height / 2,
+                           1.2 * max(svg->width, svg->height) / 2);
+    }
+    Matrix3x3 norm_to_screen = Matrix3x3::identity();
+    float scale = min(width, height);
+    norm_to_screen(0,0) = scale; norm_to_screen(0,2) = (width  - scale) / 2;
+    norm_to_screen(1,1) = scale; norm_to_screen(1,2) = (height - scale) / 2;
+    Matrix3x3 canvas_to_screen = norm_to_screen * viewport.get_canvas_to_norm();
+
+    TextureManager::update(svg, &doc->sampler, canvas_to_screen,
+                           doc->sample_rate);
+
+    // the renderer writes tightly packed rows
+    bool packed = stride == 4 * width;
+    if (!packed) doc->scratch.resize(4 * width * height);
+    unsigned char* target = packed ? rgba : &doc->scratch[0];
+
+    SoftwareRendererImp& renderer = doc->renderer;
+    renderer.set_tex_sampler(&doc->sampler);
+    renderer.set_render_target(target, width, height);
+    renderer.set_sample_rate(doc->sample_rate);
+    renderer.set_canvas_to_screen(canvas_to_screen);
+    renderer.clear_target();
+    renderer.draw_svg(*svg);
+
+    if (!packed) {
+      for (size_t y = 0; y < height; y++) {
+        memcpy(rgba + y * stride, target + y * 4 * width, 4 * width);
+      }
+    }
+
+  } catch (...) {
+    return -1;
+  }
+
+  return 0;
+}
+
+} // extern "C"
@@ -0,0 +1,90 @@
+#ifndef DRAWSVG_CORE_H
+#define DRAWSVG_CORE_H
+
+#include <stddef.h>
+
+/**
+ * C interface of libdrawsvg_core, the svg parser, software renderer and
+ * texture samplers without any windowing or OpenGL dependency, for
+ * embedding the rasterizer in other programs.
+ *
+ * Only this interface is exported by the shared library, and it only
+ * ever grows: functions keep their signatures and enums their values.
+ * Functions returning int return 0 on success and -1 on failure.
+ *
+ * A document may be used from any thread, but from one at a time.
+ * Different documents may be loaded and rendered concurrently, also
+ * documents of the same file: the images they have in common share
+ * textures that are never changed once shared.
+ */
+
+#if defined(_WIN32) && defined(DRAWSVG_CORE_SHARED)
+#  ifdef DRAWSVG_CORE_EXPORTS
+#    define DRAWSVG_API __declspec(dllexport)
+#  else
+#    define DRAWSVG_API __declspec(dllimport)
+#  endif
+#elif defined(__GNUC__)
+#  define DRAWSVG_API __attribute__((visibility("default")))
+#else
+#  define DRAWSVG_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DRAWSVG_CORE_VERSION 1
+
+typedef struct drawsvg_document drawsvg_document;
+
+/* texture filtering of images, see SampleMethod */
+typedef enum drawsvg_sample_method {
+  DRAWSVG_NEAREST     = 0,
+  DRAWSVG_BILINEAR    = 1,
+  DRAWSVG_TRILINEAR   = 2,
+  DRAWSVG_SUMMED_AREA = 3
+} drawsvg_sample_method;
+
+/* DRAWSVG_CORE_VERSION of the library, which may be newer than the header */
+DRAWSVG_API int drawsvg_version( void );
+
+/* Loads an svg file, from its compiled scene when that is up to date.
+ * Returns NULL if the file can not be read or is not a valid svg. */
+DRAWSVG_API drawsvg_document* drawsvg_load( const char* filename );
+
+/* Loads an svg document of size bytes at data, which is not kept. */
+DRAWSVG_API drawsvg_document* drawsvg_load_memory( const char* data,
+                                                   size_t size );
+
+DRAWSVG_API void drawsvg_free( drawsvg_document* doc );
+
+/* canvas size of the document, from the width and height of its svg */
+DRAWSVG_API int drawsvg_get_size( const drawsvg_document* doc,
+                                  float* width, float* height );
+
+/* Views the square of the canvas centered at (x, y) with half size span,
+ * fit to the shorter side of the target. A span of 0 or less restores
+ * the default view, the whole canvas with a 10% margin as in the viewer. */
+DRAWSVG_API int drawsvg_set_viewport( drawsvg_document* doc,
+                                      float x, float y, float span );
+
+/* supersamples per pixel side, 1 by default */
+DRAWSVG_API int drawsvg_set_sample_rate( drawsvg_document* doc,
+                                         size_t sample_rate );
+
+/* DRAWSVG_TRILINEAR by default */
+DRAWSVG_API int drawsvg_set_sample_method( drawsvg_document* doc,
+                                           drawsvg_sample_method method );
+
+/* Renders the document into width by height RGBA pixels at rgba, rows
+ * stride bytes apart (0 for 4 * width), cleared to white first. The
+ * buffer is owned by the caller and only written during the call. */
+DRAWSVG_API int drawsvg_render( drawsvg_document* doc, unsigned char* rgba,
+                                size_t width, size_t height, size_t stride );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DRAWSVG_CORE_H */
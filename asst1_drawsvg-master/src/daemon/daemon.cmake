@@ -0,0 +1,11 @@
+option(DRAWSVG_BUILD_DAEMON  "Build rasterization daemon"  ON)
+
+# The daemon serves renders over sockets, for POSIX systems only
+if(DRAWSVG_BUILD_DAEMON AND UNIX)
+
+  add_executable( drawsvg_daemon daemon/daemon.cpp )
+  target_link_libraries( drawsvg_daemon drawsvg_core ${CMAKE_THREAD_LIBS_INIT} )
+
+  install(TARGETS drawsvg_daemon DESTINATION ${drawsvg_SOURCE_DIR})
+
+endif(DRAWSVG_BUILD_DAEMON AND UNIX)
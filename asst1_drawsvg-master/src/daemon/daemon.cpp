@@ -0,0 +1,815 @@
+#include "svg.h"
+#include "png.h"
+#include "texture_cache.h"
+#include "texture_manager.h"
+#include "software_renderer.h"
+#include "viewport.h"
+#include "tiles.h"
+#include "virtual_texture.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <errno.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace std;
+using namespace CMU462;
+
+#define msg(s) cerr << "[DrawSVG] " << s << endl;
+
+/* NOTE:
+ * Long running renderer for services, so they need not start a process
+ * per image. It speaks a small subset of HTTP/1.1 on a localhost port or
+ * a unix socket (curl --unix-socket works):
+ *
+ *   POST /render?width=800&height=600&rate=1&method=trilinear&format=png
+ *        [&x=..&y=..&span=..]
+ *   POST /tile?z=..&x=..&y=..&size=256&rate=1&method=trilinear
+ *
+ * with the svg as the body. The reply is the png, or with format=rgba
+ * the raw pixels with X-Width and X-Height headers. Tiles are map tiles
+ * (see TileSet), served from a tile cache directory when one is given
+ * without even parsing the svg. One request is served per connection.
+ *
+ * Connections wait in a bounded queue for a fixed set of workers, each
+ * owning a renderer and a render target that are reused across requests,
+ * unless a request grew them past kPooledBytes. When the queue is full,
+ * new connections are answered 503 right away rather than piling up.
+ * Images whose pixels and supersamples exceed the memory budget are
+ * answered 413, and requests that run out of memory anyway 503. Parsed
+ * documents are kept in an LRU cache keyed by a hash of their source,
+ * each with its own sampler so mip chains built for one request serve
+ * the next.
+ */
+
+struct Options {
+
+  Options() : socket_path ( NULL ), port ( 8462 ), workers ( 0 ),
+              queue ( 64 ), documents ( 64 ), max_body ( 64 << 20 ),
+              max_size ( 8192 ), tile_cache ( NULL ),
+              layout ( LINEAR_LAYOUT ), stream_texels ( 0 ),
+              tile_memory ( 0 ), memory ( 1024 ) { }
+
+  // unix socket path, or localhost port when NULL
+  const char* socket_path;
+  int port;
+
+  // worker threads, one per core when 0
+  size_t workers;
+
+  // connections waiting for a worker before new ones are turned away
+  size_t queue;
+
+  // parsed documents kept
+  size_t documents;
+
+  // largest svg accepted in bytes, largest image on a side
+  size_t max_body;
+  size_t max_size;
+
+  // directory of rendered tiles, see TileStore
+  const char* tile_cache;
+
+  // layout of the mip levels documents build, see TexelLayout
+  TexelLayout layout;
+
+  // megatexels above which images are streamed and megabytes of their
+  // resident tiles, see VirtualTexture, its defaults when 0
+  size_t stream_texels;
+  size_t tile_memory;
+
+  // megabytes the pixels and supersamples of one image or tile may take
+  size_t memory;
+};
+
+static void usage() {
+  cerr << "Usage: drawsvg_daemon [options]\n"
+          "  -u <path>           listen on a unix socket\n"
+          "  -p <port>           listen on localhost:port (default: 8462)\n"
+          "  -t <threads>        workers (default: one per core)\n"
+          "  -q <connections>    queued connections before 503 (default: 64)\n"
+          "  -d <documents>      parsed documents cached (default: 64)\n"
+          "  -b <bytes>          largest svg accepted (default: 64MB)\n"
+          "  -z <pixels>         largest image side (default: 8192)\n"
+          "  -c <directory>      tile cache\n"
+          "  -l <layout>         texel layout of mip levels, linear or tiled\n"
+          "                      (default: linear)\n"
+          "  -S <megatexels>     images larger than this are streamed from\n"
+          "                      disk in tiles (default: 64)\n"
+          "  -R <megabytes>      memory for resident tiles of streamed images\n"
+          "                      (default: 256)\n"
+          "  -M <megabytes>      memory for drawing one image or tile, larger\n"
+          "                      ones are refused (default: 1024)\n";
+}
+
+// Document cache //
+
+// a parsed svg with the sampler its mip chains were built by, rendered
+// by one worker at a time
+struct Document {
+
+  Document( SVG* svg, size_t size ) : svg ( svg ), size ( size ) { }
+  ~Document() { delete svg; }
+
+  SVG* svg;
+  size_t size;
+  Sampler2DImp sampler;
+  mutex lock;
+
+  // flattened scene for tiles, made by the first tile request
+  unique_ptr<TileSet> tiles;
+};
+
+class DocumentCache {
+ public:
+
+  DocumentCache( size_t capacity ) : capacity ( capacity ),
+                                     hits ( 0 ), misses ( 0 ) { }
+
+  // the document of source, whose hash is key (see TextureCache::key),
+  // parsed unless it is cached, NULL if it is not a valid svg
+  shared_ptr<Document> get( const string& source, uint64_t key ) {
+    {
+      lock_guard<mutex> guard(lock);
+      map<uint64_t, Entry>::iterator it = entries.find(key);
+      if (it != entries.end() && it->second.first->size == source.size()) {
+        lru.splice(lru.begin(), lru, it->second.second);
+        hits++;
+        return it->second.first;
+      }
+      misses++;
+    }
+
+    // parsed outside the lock, a document parsed twice by concurrent
+    // misses is cached once
+    SVG* svg = new SVG();
+    if (SVGParser::load(source.data(), source.size(), svg) < 0) {
+      delete svg;
+      return shared_ptr<Document>();
+    }
+    shared_ptr<Document> document(new Document(svg, source.size()));
+
+    lock_guard<mutex> guard(lock);
+    map<uint64_t, Entry>::iterator it = entries.find(key);
+    if (it != entries.end()) {
+      lru.erase(it->second.second);
+      entries.erase(it);
+    }
+    lru.push_front(key);
+    entries[key] = Entry(document, lru.begin());
+    while (entries.size() > capacity) {
+      entries.erase(lru.back());
+      lru.pop_back();
+    }
+    return document;
+  }
+
+  void stats( size_t& hits, size_t& misses ) {
+    lock_guard<mutex> guard(lock);
+    hits = this->hits; misses = this->misses;
+  }
+
+ private:
+
+  typedef pair<shared_ptr<Document>, list<uint64_t>::iterator> Entry;
+
+  size_t capacity;
+  mutex lock;
+  map<uint64_t, Entry> entries;
+
+  // keys, most recently used first
+  list<uint64_t> lru;
+
+  size_t hits, misses;
+};
+
+// Connection queue //
+
+class ConnectionQueue {
+ public:
+
+  ConnectionQueue( size_t capacity ) : capacity ( capacity ),
+                                       closed ( false ) { }
+
+  // false if the queue is full and the connection has to be turned away
+  bool push( int fd ) {
+    lock_guard<mutex> guard(lock);
+    if (fds.size() >= capacity) return false;
+    fds.push_back(fd);
+    ready.notify_one();
+    return true;
+  }
+
+  // next connection, -1 once the queue is closed and drained
+  int pop() {
+    unique_lock<mutex> guard(lock);
+    while (fds.empty() && !closed) ready.wait(guard);
+    if (fds.empty()) return -1;
+    int fd = fds.front();
+    fds.pop_front();
+    return fd;
+  }
+
+  void close() {
+    lock_guard<mutex> guard(lock);
+    closed = true;
+    ready.notify_all();
+  }
+
+ private:
+
+  size_t capacity;
+  bool closed;
+  mutex lock;
+  condition_variable ready;
+  deque<int> fds;
+};
+
+// HTTP //
+
+struct Request {
+  string method, path;
+  map<string, string> query;
+  string body;
+};
+
+static int write_all( int fd, const char* data, size_t size ) {
+  while (size) {
+    ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    data += n; size -= n;
+  }
+  return 0;
+}
+
+static int respond( int fd, int status, const char* reason,
+                    const char* content_type, const char* body, size_t size,
+                    const string& headers = string() ) {
+  char head[512];
+  int n = snprintf(head, sizeof(head),
+                   "HTTP/1.1 %d %s\r\n"
+                   "Content-Type: %s\r\n"
+                   "Content-Length: %zu\r\n"
+                   "Connection: close\r\n",
+                   status, reason, content_type, size);
+  string header = string(head, n) + headers + "\r\n";
+  if (write_all(fd, header.data(), header.size()) < 0) return -1;
+  return write_all(fd, body, size);
+}
+
+static int respond_error( int fd, int status, const char* reason,
+                          const string& message,
+                          const string& headers = string() ) {
+  string body = message + "\n";
+  return respond(fd, status, reason, "text/plain", body.data(), body.size(),
+                 headers);
+}
+
+// Reads a request with its body. Returns 0, or the status to fail with.
+static int read_request( int fd, Request& request, size_t max_body ) {
+
+  // headers, up to the blank line
+  string data;
+  size_t end;
+  char buffer[4096];
+  while ((end = data.find("\r\n\r\n")) == string::npos) {
+    if (data.size() > 16384) return 431;
+    ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return 400;
+    data.append(buffer, n);
+  }
+
+  // request line
+  size_t line = data.find("\r\n");
+  string first = data.substr(0, line);
+  size_t a = first.find(' '), b = first.find(' ', a + 1);
+  if (a == string::npos || b == string::npos) return 400;
+  request.method = first.substr(0, a);
+  string target = first.substr(a + 1, b - a - 1);
+  size_t q = target.find('?');
+  request.path = target.substr(0, q);
+  while (q != string::npos) {
+    size_t next = target.find('&', q + 1);
+    string pair = target.substr(q + 1, next == string::npos ? string::npos
+                                                            : next - q - 1);
+    size_t eq = pair.find('=');
+    if (eq != string::npos) request.query[pair.substr(0, eq)] = pair.substr(eq + 1);
+    q = next;
+  }
+
+  // the body has to come with its length
+  long long length = -1;
+  for (size_t pos = line + 2; pos < end; ) {
+    size_t next = data.find("\r\n", pos);
+    string header = data.substr(pos, next - pos);
+    size_t colon = header.find(':');
+    if (colon != string::npos) {
+      string name = header.substr(0, colon);
+      transform(name.begin(), name.end(), name.begin(), ::tolower);
+      if (name == "content-length") length = atoll(header.c_str() + colon + 1);
+      if (name == "transfer-encoding") return 411;
+    }
+    pos = next + 2;
+  }
+  if (request.method != "POST") return 0;
+  if (length < 0) return 411;
+  if ((size_t) length > max_body) return 413;
+
+  request.body = data.substr(end + 4);
+  request.body.reserve(length);
+  while (request.body.size() < (size_t) length) {
+    size_t want = min(sizeof(buffer), (size_t) length - request.body.size());
+    ssize_t n = recv(fd, buffer, want, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return 400;
+    request.body.append(buffer, n);
+  }
+  request.body.resize(length);
+  return 0;
+}
+
+static const char* reason( int status ) {
+  switch (status) {
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 411: return "Length Required";
+    case 413: return "Payload Too Large";
+    case 431: return "Request Header Fields Too Large";
+    case 503: return "Service Unavailable";
+    default:  return "Internal Server Error";
+  }
+}
+
+// Workers //
+
+// renderer and render target of a worker, kept across requests so their
+// buffers are only reallocated when a request needs more
+struct PooledRenderer {
+  SoftwareRendererImp renderer;
+  PNG target;
+};
+
+// buffers of a pooled renderer larger than this are freed after the
+// request that needed them, so one large image does not pin its memory
+static const size_t kPooledBytes = 64 << 20;
+
+// points renderer at the pixels of target at rate, without the size of
+// one request meeting the rate of the previous one in between
+static void set_target( SoftwareRendererImp& renderer, PNG& target,
+                        size_t rate ) {
+  renderer.set_sample_rate(1);
+  renderer.set_render_target(&target.pixels[0], target.width, target.height);
+  renderer.set_sample_rate(rate);
+}
+
+class Server {
+ public:
+
+  Server( const Options& options ) : options ( options ),
+                                     documents ( options.documents ),
+                                     queue ( options.queue ) { }
+
+  void start() {
+    size_t n = options.workers;
+    for (size_t i = 0; i < n; i++) {
+      workers.push_back(thread(&Server::work, this));
+    }
+  }
+
+  // hands a connection to the workers, or turns it away if they are
+  // too far behind
+  void accept( int fd ) {
+    if (!queue.push(fd)) {
+      respond_error(fd, 503, reason(503), "Too many requests",
+                    "Retry-After: 1\r\n");
+      ::close(fd);
+    }
+  }
+
+  void stop() {
+    queue.close();
+    for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+    size_t hits, misses;
+    documents.stats(hits, misses);
+    msg("Served " << served << " requests, documents cached " << hits
+        << " times and parsed " << misses << " times");
+  }
+
+ private:
+
+  void work() {
+
+    // the png encoder and mip generation use OpenMP, shared out between
+    // the workers rather than each of them taking every core
+#ifdef _OPENMP
+    omp_set_num_threads(max(1, omp_get_num_procs() / (int) options.workers));
+#endif
+
+    PooledRenderer r;
+    r.target.width  = 800;
+    r.target.height = 600;
+    r.target.pixels.resize(4 * 800 * 600);
+    r.renderer.set_render_target(&r.target.pixels[0], 800, 600);
+
+    int fd;
+    while ((fd = queue.pop()) >= 0) {
+      serve(fd, r);
+      ::close(fd);
+      served++;
+      r.renderer.trim_supersample_target(kPooledBytes);
+      if (r.target.pixels.capacity() > kPooledBytes) {
+        vector<unsigned char>().swap(r.target.pixels);
+      }
+    }
+  }
+
+  // whether the pixels and supersamples of a width by height image at
+  // rate fit the memory budget
+  bool fits( size_t width, size_t height, size_t rate ) const {
+    double bytes = 4.0 * width * height * (rate * rate + 1);
+    return bytes <= options.memory * 1048576.0;
+  }
+
+  void serve( int fd, PooledRenderer& r ) {
+
+    Request request;
+    int status = read_request(fd, request, options.max_body);
+    if (status) {
+      respond_error(fd, status, reason(status), "Could not read request");
+      return;
+    }
+    if (request.path != "/render" && request.path != "/tile") {
+      respond_error(fd, 404, reason(404), "Only /render and /tile are served");
+      return;
+    }
+    if (request.method != "POST") {
+      respond_error(fd, 405, reason(405), "Post the svg to " + request.path,
+                    "Allow: POST\r\n");
+      return;
+    }
+
+    // what the budget lets through may still not fit next to the other
+    // workers, the buffers are given back for the next request
+    try {
+      if (request.path == "/tile") {
+        serve_tile(fd, request, r);
+      } else {
+        serve_render(fd, request, r);
+      }
+    } catch (const bad_alloc&) {
+      r.renderer.trim_supersample_target(0);
+      vector<unsigned char>().swap(r.target.pixels);
+      respond_error(fd, 503, reason(503), "Out of memory",
+                    "Retry-After: 1\r\n");
+    }
+  }
+
+  void serve_render( int fd, Request& request, PooledRenderer& r ) {
+
+    // parameters
+    map<string, string>& q = request.query;
+    size_t width  = q.count("width")  ? atoi(q["width"].c_str())  : 800;
+    size_t height = q.count("height") ? atoi(q["height"].c_str()) : 600;
+    size_t rate   = q.count("rate")   ? atoi(q["rate"].c_str())   : 1;
+    string format = q.count("format") ? q["format"] : "png";
+    SampleMethod method;
+    if (parse_method(q, method) < 0) {
+      respond_error(fd, 400, reason(400), "Unknown method " + q["method"]);
+      return;
+    }
+    bool viewbox = q.count("x") || q.count("y") || q.count("span");
+    if (viewbox && !(q.count("x") && q.count("y") && q.count("span"))) {
+      respond_error(fd, 400, reason(400), "A viewbox needs x, y and span");
+      return;
+    }
+    if (!width || !height || width > options.max_size ||
+        height > options.max_size || !rate || rate > 16 ||
+        (format != "png" && format != "rgba")) {
+      respond_error(fd, 400, reason(400), "Bad size, rate or format");
+      return;
+    }
+    if (!fits(width, height, rate)) {
+      respond_error(fd, 413, reason(413), "Image too large for the memory budget");
+      return;
+    }
+
+    const string& source = request.body;
+    shared_ptr<Document> document =
+      documents.get(source, TextureCache::key(source.data(), source.size()));
+    if (!document) {
+      respond_error(fd, 400, reason(400), "Not a valid svg");
+      return;
+    }
+
+    // view as DrawSVG sets it up, see DrawSVG::auto_adjust and resize
+    SVG* svg = document->svg;
+    ViewportImp viewport;
+    if (viewbox) {
+      viewport.set_viewbox(atof(q["x"].c_str()), atof(q["y"].c_str()),
+                           atof(q["span"].c_str()));
+    } else {
+      viewport.set_viewbox(svg->width / 2, svg->height / 2,
+                           1.2 * max(svg->width, svg->height) / 2);
+    }
+    Matrix3x3 norm_to_screen = Matrix3x3::identity();
+    float scale = min(width, height);
+    norm_to_screen(0,0) = scale; norm_to_screen(0,2) = (width  - scale) / 2;
+    norm_to_screen(1,1) = scale; norm_to_screen(1,2) = (height - scale) / 2;
+    Matrix3x3 canvas_to_screen = norm_to_screen * viewport.get_canvas_to_norm();
+
+    // resize keeps the capacity of the target
+    PNG& png = r.target;
+    png.width  = width;
+    png.height = height;
+    png.pixels.resize(4 * width * height);
+
+    {
+      lock_guard<mutex> guard(document->lock);
+      document->sampler.set_sample_method(method);
+      document->sampler.set_texel_layout(options.layout);
+      TextureManager::update(svg, &document->sampler, canvas_to_screen, rate);
+
+      SoftwareRendererImp& renderer = r.renderer;
+      renderer.set_tex_sampler(&document->sampler);
+      set_target(renderer, png, rate);
+      renderer.set_canvas_to_screen(canvas_to_screen);
+      renderer.clear_target();
+      renderer.draw_svg(*svg);
+    }
+
+    if (format == "rgba") {
+      char headers[64];
+      snprintf(headers, sizeof(headers), "X-Width: %zu\r\nX-Height: %zu\r\n",
+               width, height);
+      respond(fd, 200, "OK", "application/octet-stream",
+              (const char*) &png.pixels[0], png.pixels.size(), headers);
+      return;
+    }
+
+    vector<unsigned char> encoded;
+    if (PNGParser::save(encoded, png) < 0) {
+      respond_error(fd, 500, reason(500), "Could not encode png");
+      return;
+    }
+    respond(fd, 200, "OK", "image/png", (const char*) &encoded[0],
+            encoded.size());
+  }
+
+  void serve_tile( int fd, Request& request, PooledRenderer& r ) {
+
+    // parameters
+    map<string, string>& q = request.query;
+    int z = q.count("z") ? atoi(q["z"].c_str()) : -1;
+    long x = q.count("x") ? atol(q["x"].c_str()) : -1;
+    long y = q.count("y") ? atol(q["y"].c_str()) : -1;
+    size_t size = q.count("size") ? atoi(q["size"].c_str()) : 256;
+    size_t rate = q.count("rate") ? atoi(q["rate"].c_str()) : 1;
+    SampleMethod method;
+    if (parse_method(q, method) < 0) {
+      respond_error(fd, 400, reason(400), "Unknown method " + q["method"]);
+      return;
+    }
+    if (z < 0 || z > 24 || x < 0 || y < 0 || x >= (1L << z) || y >= (1L << z) ||
+        !size || size > options.max_size || !rate || rate > 16) {
+      respond_error(fd, 400, reason(400), "Bad tile, size or rate");
+      return;
+    }
+    if (!fits(size, size, rate)) {
+      respond_error(fd, 413, reason(413), "Tile too large for the memory budget");
+      return;
+    }
+
+    // stored tiles are served without parsing the svg
+    const string& source = request.body;
+    uint64_t key = TextureCache::key(source.data(), source.size());
+    vector<unsigned char> encoded;
+    unique_ptr<TileStore> store;
+    if (options.tile_cache) {
+      store.reset(new TileStore(options.tile_cache, key, size, rate, method));
+      if (store->load(z, x, y, encoded) == 0) {
+        respond(fd, 200, "OK", "image/png", (const char*) &encoded[0],
+                encoded.size());
+        return;
+      }
+    }
+
+    shared_ptr<Document> document = documents.get(source, key);
+    if (!document) {
+      respond_error(fd, 400, reason(400), "Not a valid svg");
+      return;
+    }
+
+    PNG& png = r.target;
+    png.width = png.height = size;
+    png.pixels.resize(4 * size * size);
+
+    {
+      lock_guard<mutex> guard(document->lock);
+      if (!document->tiles) document->tiles.reset(new TileSet(document->svg));
+      document->sampler.set_sample_method(method);
+      document->sampler.set_texel_layout(options.layout);
+      document->tiles->prepare(&document->sampler, z, size, rate);
+
+      SoftwareRendererImp& renderer = r.renderer;
+      renderer.set_tex_sampler(&document->sampler);
+      set_target(renderer, png, rate);
+      document->tiles->draw(z, x, y, size, renderer);
+    }
+
+    if (PNGParser::save(encoded, png) < 0) {
+      respond_error(fd, 500, reason(500), "Could not encode png");
+      return;
+    }
+    if (store) store->save(z, x, y, encoded);
+    respond(fd, 200, "OK", "image/png", (const char*) &encoded[0],
+            encoded.size());
+  }
+
+  static int parse_method( map<string, string>& q, SampleMethod& method ) {
+    string m = q.count("method") ? q["method"] : "trilinear";
+    if      (m == "nearest")     method = NEAREST;
+    else if (m == "bilinear")    method = BILINEAR;
+    else if (m == "trilinear")   method = TRILINEAR;
+    else if (m == "summed-area") method = SUMMED_AREA;
+    else return -1;
+    return 0;
+  }
+
+  Options options;
+  DocumentCache documents;
+  ConnectionQueue queue;
+  vector<thread> workers;
+  atomic<size_t> served { 0 };
+};
+
+// Listening //
+
+static volatile sig_atomic_t stopping = 0;
+
+static void on_signal( int ) {
+  stopping = 1;
+}
+
+static int listen_unix( const char* path ) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+  strcpy(addr.sun_path, path);
+  unlink(path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+  if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 ||
+      listen(fd, SOMAXCONN) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static int listen_local( int port ) {
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 ||
+      listen(fd, SOMAXCONN) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int main( int argc, char** argv ) {
+
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "-u" && has_value) {
+      options.socket_path = argv[++i];
+    } else if (arg == "-p" && has_value) {
+      options.port = atoi(argv[++i]);
+    } else if (arg == "-t" && has_value) {
+      options.workers = atoi(argv[++i]);
+    } else if (arg == "-q" && has_value) {
+      options.queue = atoi(argv[++i]);
+    } else if (arg == "-d" && has_value) {
+      options.documents = atoi(argv[++i]);
+    } else if (arg == "-b" && has_value) {
+      options.max_body = atoll(argv[++i]);
+    } else if (arg == "-z" && has_value) {
+      options.max_size = atoi(argv[++i]);
+    } else if (arg == "-c" && has_value) {
+      options.tile_cache = argv[++i];
+    } else if (arg == "-l" && has_value) {
+      string l = argv[++i];
+      if      (l == "linear") options.layout = LINEAR_LAYOUT;
+      else if (l == "tiled")  options.layout = TILED_LAYOUT;
+      else { usage(); return 1; }
+    } else if (arg == "-S" && has_value) {
+      options.stream_texels = atoi(argv[++i]);
+    } else if (arg == "-R" && has_value) {
+      options.tile_memory = atoi(argv[++i]);
+    } else if (arg == "-M" && has_value) {
+      options.memory = atoi(argv[++i]);
+    } else {
+      usage(); return 1;
+    }
+  }
+  if (!options.workers) options.workers = max(1u, thread::hardware_concurrency());
+  if (!options.queue || !options.documents || !options.memory ||
+      options.port <= 0) {
+    usage(); return 1;
+  }
+  if (options.stream_texels) {
+    VirtualTexture::set_threshold(options.stream_texels << 20);
+  }
+  if (options.tile_memory) {
+    VirtualTexture::set_cache_limit(options.tile_memory << 20);
+  }
+
+  string address = options.socket_path ? options.socket_path
+                      : "localhost:" + to_string(options.port);
+  int fd = options.socket_path ? listen_unix(options.socket_path)
+                               : listen_local(options.port);
+  if (fd < 0) {
+    msg("Could not listen on " << address << ": " << strerror(errno));
+    return 1;
+  }
+
+  // stop accepting on SIGINT and SIGTERM, and finish the queued requests.
+  // Workers block the signals so they interrupt accept.
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = on_signal;
+  sigaction(SIGINT,  &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  sigset_t signals, previous;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, &previous);
+  Server server(options);
+  server.start();
+  pthread_sigmask(SIG_SETMASK, &previous, NULL);
+
+  msg("Listening on " << address << " with " << options.workers << " workers");
+
+  while (!stopping) {
+    int client = accept(fd, NULL, NULL);
+    if (client < 0) {
+      if (errno == EINTR) continue;
+      msg("accept: " << strerror(errno));
+      continue;
+    }
+
+    // clients that stall do not hold a worker for long
+    struct timeval timeout = { 10, 0 };
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    server.accept(client);
+  }
+
+  close(fd);
+  if (options.socket_path) unlink(options.socket_path);
+  server.stop();
+  return 0;
+}
@@ -1,4 +1,6 @@
 #include "drawsvg.h"
+#include "texture_manager.h"
+#include "svg_cache.h"
 
 #include <sstream>
 #include <iostream>
@@ -8,8 +10,24 @@ using namespace std;
 
 namespace CMU462 {
 
+// the compiled scene while it is up to date, otherwise the source, which
+// is compiled for the next time
+static int load_svg( const char* path, SVG* svg ) {
+
+  if( SVGCache::load( path, svg ) == 0 ) return 0;
+
+  if( SVGParser::load( path, svg ) < 0) return -1;
+
+  static Sampler2DImp sampler;
+  SVGCache::compile( svg, &sampler );
+  SVGCache::save( path, svg );
+  return 0;
+}
+
 DrawSVG::~DrawSVG() {
 
+  stop_prerender();
+
   tabs.clear();
   viewport_imp.clear();
   viewport_ref.clear();
@@ -19,6 +37,8 @@ DrawSVG::~DrawSVG() {
   delete software_renderer_imp;
   delete software_renderer_ref;
 
+  delete shared_framebuffer;
+
 }
 
 string DrawSVG::name() {
@@ -64,7 +84,7 @@ void DrawSVG::init() {
   software_renderer_imp->set_tex_sampler(sampler_imp);
   software_renderer_ref->set_tex_sampler(sampler_ref);
 
-  // generate mipmaps & set initial viewports
+  // set initial viewports, mipmaps are built as views need them
   for (size_t i = 0; i < tabs.size(); ++i) {
 
     viewport_imp.push_back(new ViewportImp());
@@ -75,9 +95,6 @@ void DrawSVG::init() {
 
     // set initial canvas_to_norm for imp using ref
     viewport_imp[i]->set_canvas_to_norm(viewport_ref[i]->get_canvas_to_norm());
-
-    // generate mipmaps
-    regenerate_mipmap(i);
   }
 
   // set tab and transformation if tabs loaded
@@ -95,7 +112,7 @@ void DrawSVG::render() {
   }
 
   if( method == Software ) {
-    display_pixels( &framebuffer[0] );
+    display_pixels( render_target );
   }
 
   if (show_zoom) {
@@ -109,10 +126,23 @@ void DrawSVG::resize( size_t width, size_t height ) {
   this->width  = width;
   this->height = height;
 
-  // resize render target
+  // resize render target, frames of the old size are of no more use
   framebuffer.resize( 4 * width * height);
-  software_renderer_imp->set_render_target(&framebuffer[0], width, height);
-  software_renderer_ref->set_render_target(&framebuffer[0], width, height);
+  frame_cache.clear();
+  set_render_target( &framebuffer[0] );
+
+  // the shared framebuffer is replaced, consumers open the new one
+  if (!shared_name.empty()) {
+    if (!shared_framebuffer) shared_framebuffer = new SharedFramebuffer();
+    if (shared_framebuffer->create(shared_name.c_str(), width, height,
+                                   shared_buffers) < 0) {
+      cerr << "[DrawSVG] Could not share the framebuffer as "
+           << shared_name << endl;
+      delete shared_framebuffer;
+      shared_framebuffer = NULL;
+      shared_name.clear();
+    }
+  }
 
   // update hardware renderer
   hardware_renderer->resize(width, height);
@@ -154,12 +184,10 @@ void DrawSVG::char_event( unsigned int key ) {
 
     // switch between iml and ref sampler
     case ';':
-      sampler = sampler_imp;
-      regenerate_mipmap(current_tab); redraw();
+      sampler = sampler_imp; redraw();
       break;
     case '\'':
-      sampler = sampler_ref;
-      regenerate_mipmap(current_tab); redraw();
+      sampler = sampler_ref; redraw();
       break;
 
     // change render method
@@ -183,7 +211,13 @@ void DrawSVG::char_event( unsigned int key ) {
       show_zoom = !show_zoom;
       break;
 
-    // tab selection
+    // tab selection, the first ten by number
+    case '[':
+      if (!tabs.empty()) setTab( (current_tab + tabs.size() - 1) % tabs.size() );
+      break;
+    case ']':
+      if (!tabs.empty()) setTab( (current_tab + 1) % tabs.size() );
+      break;
     case '0':
       setTab( 9 );
       break;
@@ -283,16 +317,30 @@ void DrawSVG::clear( void ) {
 }
 
 void DrawSVG::newTab( SVG* svg ) {
-  if (tabs.size() < 9) {
-    tabs.push_back(svg);
-  } else {
-    fprintf(stderr, "DrawSVG can only hold up to 9 tabs");
+  add_tab( svg, "" );
+}
+
+int DrawSVG::newTab( const char* path ) {
+
+  SVG* svg = new SVG();
+  if (load_svg( path, svg ) < 0) {
+    delete svg;
+    return -1;
   }
+
+  add_tab( svg, path );
+  unload_tabs();
+  return 0;
 }
 
 void DrawSVG::delTab( size_t tab_index ) {
   if (tab_index < tabs.size()) {
+    stop_prerender();
+    frame_cache.erase(tabs[tab_index]);
+    if (tabs[tab_index]) resident_bytes -= tab_sources[tab_index].bytes;
     tabs.erase(tabs.begin() + tab_index);
+    tab_locks.erase(tab_locks.begin() + tab_index);
+    tab_sources.erase(tab_sources.begin() + tab_index);
   }
 }
 
@@ -300,14 +348,95 @@ void DrawSVG::setTab( size_t tab_index ) {
 
   if ( tab_index < tabs.size() ) {
 
+    // an unloaded tab is loaded again, which may unload others
+    if (!tabs[tab_index] && load_tab(tab_index) < 0) {
+      cerr << "[DrawSVG] Could not load " << tab_sources[tab_index].path << endl;
+      return;
+    }
+
     // switch tab and update transformation
     current_tab = tab_index;
+    tab_sources[tab_index].used = ++tab_clock;
+    unload_tabs();
 
     // update output
     redraw();
   }
 }
 
+void DrawSVG::setTabBudget( size_t bytes ) {
+  tab_budget = bytes;
+  unload_tabs();
+}
+
+void DrawSVG::add_tab( SVG* svg, const string& path ) {
+
+  TabSource source;
+  source.path   = path;
+  source.width  = svg->width;
+  source.height = svg->height;
+  source.bytes  = svg->bytes();
+  source.used   = ++tab_clock;
+
+  tabs.push_back(svg);
+  tab_locks.push_back(unique_ptr<mutex>(new mutex()));
+  tab_sources.push_back(source);
+  resident_bytes += source.bytes;
+}
+
+int DrawSVG::load_tab( size_t tab_index ) {
+
+  TabSource& source = tab_sources[tab_index];
+  SVG* svg = new SVG();
+  if (load_svg( source.path.c_str(), svg ) < 0) {
+    delete svg;
+    return -1;
+  }
+
+  tabs[tab_index] = svg;
+  source.bytes = svg->bytes();
+  resident_bytes += source.bytes;
+  return 0;
+}
+
+void DrawSVG::unload_tabs() {
+
+  // mip chains grow as views need them, so loaded tabs are measured
+  // again, all but one being drawn ahead, which keeps its last size
+  resident_bytes = 0;
+  for (size_t i = 0; i < tabs.size(); i++) {
+    if (!tabs[i]) continue;
+    unique_lock<mutex> guard( *tab_locks[i], try_to_lock );
+    if (guard.owns_lock()) tab_sources[i].bytes = tabs[i]->bytes();
+    resident_bytes += tab_sources[i].bytes;
+  }
+
+  bool stopped = false;
+  while (resident_bytes > tab_budget) {
+
+    // least recently viewed tab that can be loaded again
+    size_t lru = tabs.size();
+    for (size_t i = 0; i < tabs.size(); i++) {
+      if (!tabs[i] || tab_sources[i].path.empty() || i == current_tab) continue;
+      if (lru == tabs.size() || tab_sources[i].used < tab_sources[lru].used) {
+        lru = i;
+      }
+    }
+    if (lru == tabs.size()) break;
+
+    // the worker may be drawing it ahead
+    if (!stopped) {
+      stop_prerender();
+      stopped = true;
+    }
+
+    frame_cache.erase(tabs[lru]);
+    delete tabs[lru];
+    tabs[lru] = NULL;
+    resident_bytes -= tab_sources[lru].bytes;
+  }
+}
+
 void DrawSVG::draw_diff() {
 
   // get reference output
@@ -315,8 +444,8 @@ void DrawSVG::draw_diff() {
   
   // save reference output
   vector<unsigned char> reference ( 4 * width * height );
-  memcpy(&reference[0], &framebuffer[0], 4 * width * height );
-  memset(&framebuffer[0], 255, 4 * width * height);
+  memcpy(&reference[0], render_target, 4 * width * height );
+  memset(render_target, 255, 4 * width * height);
 
   // get implementation output
   software_renderer_imp->draw_svg(*tabs[current_tab]);
@@ -325,13 +454,13 @@ void DrawSVG::draw_diff() {
   int errorCount = 0;
   for( size_t i = 0; i < width * height; i++ ) {
 
-    framebuffer[i*4 + 0] = abs(reference[i*4 + 0] - framebuffer[i*4 + 0]);
-    framebuffer[i*4 + 1] = abs(reference[i*4 + 1] - framebuffer[i*4 + 1]);
-    framebuffer[i*4 + 2] = abs(reference[i*4 + 2] - framebuffer[i*4 + 2]);
-    framebuffer[i*4 + 3] = 255;
+    render_target[i*4 + 0] = abs(reference[i*4 + 0] - render_target[i*4 + 0]);
+    render_target[i*4 + 1] = abs(reference[i*4 + 1] - render_target[i*4 + 1]);
+    render_target[i*4 + 2] = abs(reference[i*4 + 2] - render_target[i*4 + 2]);
+    render_target[i*4 + 3] = 255;
 
     for( int k = 0; k < 3; k++ ) {
-      if( framebuffer[i*4+k] ) {
+      if( render_target[i*4+k] ) {
         errorCount++;
         break;
       }
@@ -434,7 +563,16 @@ void DrawSVG::dec_sample_rate() {
 
 void DrawSVG::redraw() {
 
-  clear();
+  // software frames are drawn straight into the next shared buffer,
+  // leaving the last finished one to consumers
+  bool shared = shared_framebuffer && method == Software;
+  if (shared) {
+    unsigned char* buffer = shared_framebuffer->begin_frame();
+    set_render_target( buffer ? buffer : &framebuffer[0] );
+  }
+
+  // the tab may be being drawn ahead in the background
+  unique_lock<mutex> tab_guard( *tab_locks[current_tab] );
 
   // set canvas_to_screen transformation
   Matrix3x3 m_imp = norm_to_screen * viewport_imp[current_tab]->get_canvas_to_norm();
@@ -443,6 +581,24 @@ void DrawSVG::redraw() {
   software_renderer_ref->set_canvas_to_screen( m_ref ); 
   hardware_renderer->set_canvas_to_screen( m_ref );
 
+  // views drawn before are copied back
+  FrameCache::Key key = frame_key( current_tab,
+    software_renderer == software_renderer_imp ? m_imp : m_ref,
+    software_renderer );
+  bool cached = method == Software && !show_diff &&
+                frame_cache.lookup( key, render_target );
+
+  if (!cached) {
+
+    clear();
+
+    // levels down to what this view samples, all of them for the
+    // reference renderer, which the diff runs too
+    bool lazy = method != Software ||
+                (software_renderer == software_renderer_imp && !show_diff);
+    TextureManager::update(tabs[current_tab], sampler, m_imp, sample_rate, lazy);
+  }
+
   switch (method) {
 
     case Hardware:  
@@ -451,38 +607,147 @@ void DrawSVG::redraw() {
       
     case Software: 
 
-      if (show_diff) { draw_diff(); return; }
-      software_renderer->draw_svg(*tabs[current_tab]);
-      display_pixels( &framebuffer[0] );
+      if (show_diff) {
+        draw_diff();
+      } else {
+        if (!cached) {
+          software_renderer->draw_svg(*tabs[current_tab]);
+          frame_cache.insert( key, render_target );
+        }
+        display_pixels( render_target );
+      }
+      if (shared) shared_framebuffer->end_frame();
       break;
 
   }
+
+  tab_guard.unlock();
+  prerender();
 }
 
-void DrawSVG::regenerate_mipmap(size_t tab_index) {
-  if (tab_index < tabs.size()) {
-    SVG* svg = tabs[tab_index];
-    for ( size_t i = 0; i < svg->elements.size(); ++i ) {
-  
-      SVGElement* element = svg->elements[i];
-      if (element->type == IMAGE) {
-          Texture& tex = static_cast<Image*>(element)->tex;
-          sampler->generate_mips(tex, 0);
-      }
+FrameCache::Key DrawSVG::frame_key( size_t tab_index,
+                                    const Matrix3x3& canvas_to_screen,
+                                    const SoftwareRenderer* renderer ) const {
+
+  // mip levels are those of the sampler that built them
+  FrameCache::Key key;
+  key.document = tabs[tab_index];
+  key.canvas_to_screen = canvas_to_screen;
+  key.width = width;
+  key.height = height;
+  key.sample_rate = sample_rate;
+  key.renderer = renderer;
+  key.sampler = sampler;
+  return key;
+}
+
+void DrawSVG::setFrameCacheBudget( size_t bytes ) {
+  frame_cache.set_budget( bytes );
+}
+
+void DrawSVG::prerender() {
+
+  // only the implementation is drawn ahead, the reference renderer and
+  // sampler are not known to be thread safe
+  if (method != Software || show_diff || tabs.size() < 2 ||
+      software_renderer != software_renderer_imp || sampler != sampler_imp) {
+    return;
+  }
+
+  // the other tabs at their views as they are now
+  vector<PrerenderJob> jobs;
+  for (size_t i = 1; i < tabs.size(); i++) {
+    size_t tab = (current_tab + i) % tabs.size();
+    if (!tabs[tab] || tab >= viewport_imp.size()) continue;
+    PrerenderJob job;
+    job.svg  = tabs[tab];
+    job.lock = tab_locks[tab].get();
+    job.key  = frame_key( tab,
+      norm_to_screen * viewport_imp[tab]->get_canvas_to_norm(),
+      software_renderer_imp );
+    jobs.push_back(job);
+  }
+
+  lock_guard<mutex> guard( prerender_lock );
+  prerender_jobs.swap(jobs);
+  prerender_wake.notify_one();
+  if (!prerender_worker.joinable()) {
+    prerender_quit = false;
+    prerender_worker = thread( &DrawSVG::prerender_loop, this );
+  }
+}
+
+void DrawSVG::prerender_loop() {
+
+  SoftwareRendererImp renderer;
+  renderer.set_tex_sampler( sampler_imp );
+  vector<unsigned char> pixels;
+
+  unique_lock<mutex> guard( prerender_lock );
+  for (;;) {
+    while (prerender_jobs.empty() && !prerender_quit) prerender_wake.wait(guard);
+    if (prerender_quit) return;
+
+    // newer jobs replace the rest of these
+    PrerenderJob job = prerender_jobs.front();
+    prerender_jobs.erase(prerender_jobs.begin());
+    guard.unlock();
+
+    lock_guard<mutex> tab_guard( *job.lock );
+    const FrameCache::Key& key = job.key;
+    if (!frame_cache.contains( key )) {
+      pixels.resize( 4 * key.width * key.height );
+      renderer.set_render_target( &pixels[0], key.width, key.height );
+      renderer.set_sample_rate( key.sample_rate );
+      renderer.set_canvas_to_screen( key.canvas_to_screen );
+
+      // textures shared with tabs the main thread loads meanwhile are
+      // replaced when extended, never changed (see TextureCache), so
+      // loads need not stop the worker
+      TextureManager::update( job.svg, sampler_imp, key.canvas_to_screen,
+                              key.sample_rate );
+      renderer.clear_target();
+      renderer.draw_svg( *job.svg );
+      frame_cache.insert( key, &pixels[0] );
     }
+
+    guard.lock();
+  }
+}
+
+void DrawSVG::stop_prerender() {
+
+  if (!prerender_worker.joinable()) return;
+  {
+    lock_guard<mutex> guard( prerender_lock );
+    prerender_quit = true;
+    prerender_jobs.clear();
+    prerender_wake.notify_one();
   }
+  prerender_worker.join();
 }
 
 void DrawSVG::auto_adjust(size_t tab_index) {
   
-  float w = tabs[tab_index]->width;
-  float h = tabs[tab_index]->height;
+  float w = tab_sources[tab_index].width;
+  float h = tab_sources[tab_index].height;
   float span = 1.2 * max(w,h) / 2;
   viewport_imp[tab_index]->set_viewbox( w / 2, h / 2, span);
   viewport_ref[tab_index]->set_viewbox( w / 2, h / 2, span);
 }
 
 
+void DrawSVG::set_render_target( unsigned char* target ) {
+  render_target = target;
+  software_renderer_imp->set_render_target(target, width, height);
+  software_renderer_ref->set_render_target(target, width, height);
+}
+
+void DrawSVG::shareFramebuffer( const string& name, size_t buffers ) {
+  shared_name = name;
+  shared_buffers = buffers;
+}
+
 void DrawSVG::display_pixels( const unsigned char* pixels ) const {
 
   // copy pixels to the screen
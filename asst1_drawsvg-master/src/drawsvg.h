@@ -2,12 +2,18 @@
 #define CMU462_DRAWSVG_H
 
 #include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 
 #include "CMU462.h"
 #include "renderer.h"
 #include "svg.h"
 #include "hardware_renderer.h"
 #include "software_renderer.h"
+#include "shared_framebuffer.h"
+#include "frame_cache.h"
 
 namespace CMU462 {
 
@@ -37,11 +43,18 @@ class DrawSVG : public Renderer {
   DrawSVG() : 
     leftDown (false),
     method (Software),
-    sample_rate (1),
     current_tab (0),
+    tab_budget (512 << 20),
+    resident_bytes (0),
+    tab_clock (0),
     show_diff (false),
     show_zoom (false),
-    norm_to_screen ( Matrix3x3::identity() )  { }
+    sample_rate (1),
+    norm_to_screen ( Matrix3x3::identity() ),
+    render_target (NULL),
+    shared_framebuffer (NULL),
+    shared_buffers (3),
+    prerender_quit (false) { }
 
   /**
    * Destructor.
@@ -98,10 +111,18 @@ class DrawSVG : public Renderer {
   void drawIllustration( SVG& svg );
 
   /**
-   * Load a svg into a new tab if there is one available.
+   * Load a svg into a new tab. The tab stays loaded.
    */
   void newTab( SVG* svg );
 
+  /**
+   * Load a svg file, or its compiled scene, into a new tab. The tab may
+   * be unloaded while it is not in view, and is loaded again from the
+   * file when it is switched to. Returns -1 if the file can not be
+   * loaded.
+   */
+  int newTab( const char* path );
+
   /**
    * Delete a tab and in the renderer.
    */
@@ -117,6 +138,26 @@ class DrawSVG : public Renderer {
    */
   int getErrorCount( void ) const;
 
+  /**
+   * Draw software frames into a POSIX shared-memory segment of the given
+   * name and number of buffers (2 or 3), for other processes to present
+   * (see SharedFramebuffer). Call before the viewer is initialized.
+   */
+  void shareFramebuffer( const std::string& name, size_t buffers );
+
+  /**
+   * Set the memory for frames kept to redraw repeated views with, 0
+   * to disable the frame cache.
+   */
+  void setFrameCacheBudget( size_t bytes );
+
+  /**
+   * Set the memory loaded tabs are kept within, by unloading the tabs
+   * loaded from files that were least recently in view. The tab in view
+   * stays loaded regardless.
+   */
+  void setTabBudget( size_t bytes );
+
  private:
 
   /* window size */
@@ -151,6 +192,20 @@ class DrawSVG : public Renderer {
   std::vector<SVG*> tabs; size_t current_tab;
   std::vector<Viewport*> viewport_imp;
   std::vector<Viewport*> viewport_ref;
+
+  /* tab residency; tabs of files are NULL in tabs while unloaded */
+  struct TabSource {
+    std::string path;       // empty for tabs that stay loaded
+    float width, height;    // of the svg, for views of unloaded tabs
+    size_t bytes;           // while loaded
+    uint64_t used;          // last switched to
+  };
+  std::vector<TabSource> tab_sources;
+  size_t tab_budget, resident_bytes;
+  uint64_t tab_clock;
+  void add_tab( SVG* svg, const std::string& path );
+  int load_tab( size_t tab_index );
+  void unload_tabs();
   
   /* diff */
   bool show_diff;
@@ -165,9 +220,6 @@ class DrawSVG : public Renderer {
   void inc_sample_rate();
   void dec_sample_rate();
 
-  /* regenerate mipmap */
-  void regenerate_mipmap(size_t tab_index);
-
   /* audo-adjust canvas_to_norm */
   void auto_adjust(size_t tab_index);
 
@@ -181,6 +233,37 @@ class DrawSVG : public Renderer {
   /* framebuffer for software renderer */
   std::vector<unsigned char> framebuffer;
 
+  /* render target, the framebuffer or the shared framebuffer buffer
+     being drawn */
+  unsigned char* render_target;
+  void set_render_target( unsigned char* target );
+
+  /* shared framebuffer */
+  SharedFramebuffer* shared_framebuffer;
+  std::string shared_name;
+  size_t shared_buffers;
+
+  /* frames of views drawn before, and of the other tabs drawn ahead in
+     the background; a tab is drawn by one thread at a time */
+  FrameCache frame_cache;
+  std::vector<std::unique_ptr<std::mutex> > tab_locks;
+  FrameCache::Key frame_key( size_t tab_index, const Matrix3x3& canvas_to_screen,
+                             const SoftwareRenderer* renderer ) const;
+
+  struct PrerenderJob {
+    SVG* svg;
+    std::mutex* lock;
+    FrameCache::Key key;
+  };
+  std::thread prerender_worker;
+  std::mutex prerender_lock;
+  std::condition_variable prerender_wake;
+  std::vector<PrerenderJob> prerender_jobs;
+  bool prerender_quit;
+  void prerender();
+  void prerender_loop();
+  void stop_prerender();
+
   // update framebuffer
   void redraw();
 
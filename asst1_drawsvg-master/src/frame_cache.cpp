@@ -0,0 +1,119 @@
+#include "frame_cache.h"
+
+#include <string.h>
+
+#include "texture_cache.h"
+
+using namespace std;
+
+namespace CMU462 {
+
+uint64_t FrameCache::hash( const Key& key ) {
+
+  // the fields packed, hashed as TextureCache hashes payloads
+  double values[9];
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) values[3 * i + j] = key.canvas_to_screen(i, j);
+  }
+  uint64_t fields[6] = {
+    (uint64_t) (uintptr_t) key.document, key.width, key.height,
+    key.sample_rate, (uint64_t) (uintptr_t) key.renderer,
+    (uint64_t) (uintptr_t) key.sampler
+  };
+  char data[sizeof(values) + sizeof(fields)];
+  memcpy(data, values, sizeof(values));
+  memcpy(data + sizeof(values), fields, sizeof(fields));
+  return TextureCache::key(data, sizeof(data));
+}
+
+bool FrameCache::equal( const Key& a, const Key& b ) {
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      if (a.canvas_to_screen(i, j) != b.canvas_to_screen(i, j)) return false;
+    }
+  }
+  return a.document == b.document && a.width == b.width &&
+         a.height == b.height && a.sample_rate == b.sample_rate &&
+         a.renderer == b.renderer && a.sampler == b.sampler;
+}
+
+bool FrameCache::lookup( const Key& key, unsigned char* pixels ) {
+
+  lock_guard<mutex> guard(lock);
+  map<uint64_t, list<Entry>::iterator>::iterator it = index.find(hash(key));
+  if (it == index.end() || !equal(it->second->key, key)) return false;
+
+  frames.splice(frames.begin(), frames, it->second);
+  memcpy(pixels, it->second->pixels.data(), it->second->pixels.size());
+  return true;
+}
+
+bool FrameCache::contains( const Key& key ) {
+
+  lock_guard<mutex> guard(lock);
+  map<uint64_t, list<Entry>::iterator>::iterator it = index.find(hash(key));
+  return it != index.end() && equal(it->second->key, key);
+}
+
+void FrameCache::insert( const Key& key, const unsigned char* pixels ) {
+
+  size_t size = 4 * key.width * key.height;
+  lock_guard<mutex> guard(lock);
+  if (size > budget) return;
+
+  // a colliding frame of another key is replaced
+  uint64_t h = hash(key);
+  map<uint64_t, list<Entry>::iterator>::iterator it = index.find(h);
+  if (it != index.end()) {
+    bytes -= it->second->pixels.size();
+    frames.erase(it->second);
+    index.erase(it);
+  }
+
+  frames.push_front(Entry());
+  Entry& entry = frames.front();
+  entry.hash = h;
+  entry.key = key;
+  entry.pixels.assign(pixels, pixels + size);
+  index[h] = frames.begin();
+  bytes += size;
+  evict();
+}
+
+void FrameCache::erase( const void* document ) {
+
+  lock_guard<mutex> guard(lock);
+  for (list<Entry>::iterator it = frames.begin(); it != frames.end(); ) {
+    if (it->key.document == document) {
+      bytes -= it->pixels.size();
+      index.erase(it->hash);
+      it = frames.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void FrameCache::clear() {
+  lock_guard<mutex> guard(lock);
+  frames.clear();
+  index.clear();
+  bytes = 0;
+}
+
+void FrameCache::set_budget( size_t budget ) {
+  lock_guard<mutex> guard(lock);
+  this->budget = budget;
+  evict();
+}
+
+void FrameCache::evict() {
+  while (bytes > budget && !frames.empty()) {
+    Entry& oldest = frames.back();
+    bytes -= oldest.pixels.size();
+    index.erase(oldest.hash);
+    frames.pop_back();
+  }
+}
+
+} // namespace CMU462
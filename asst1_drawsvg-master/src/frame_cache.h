@@ -0,0 +1,78 @@
+#ifndef CMU462_FRAME_CACHE_H
+#define CMU462_FRAME_CACHE_H
+
+#include <list>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <stdint.h>
+
+#include "matrix3x3.h"
+
+namespace CMU462 {
+
+/**
+ * Resolved frames of the software renderers, by everything that goes into
+ * drawing them: the document, its canvas to screen transform, the target
+ * size, the sample rate, and the renderer and sampler. A view drawn
+ * before comes back as a copy instead of a redraw. Frames are evicted
+ * least recently used first to stay within a byte budget. Thread safe,
+ * so frames can be drawn ahead in the background.
+ */
+class FrameCache {
+ public:
+
+  struct Key {
+    const void* document;
+    Matrix3x3 canvas_to_screen;
+    size_t width, height;
+    size_t sample_rate;
+    const void* renderer;
+    const void* sampler;
+  };
+
+  FrameCache( size_t budget = 256 << 20 ) : budget ( budget ), bytes ( 0 ) { }
+
+  // copies the frame of key to pixels, false if it is not cached
+  bool lookup( const Key& key, unsigned char* pixels );
+
+  // true if the frame of key is cached, without touching its age
+  bool contains( const Key& key );
+
+  // caches the width by height rgba frame of key
+  void insert( const Key& key, const unsigned char* pixels );
+
+  // drops the frames of document
+  void erase( const void* document );
+
+  void clear();
+
+  // a budget of 0 caches nothing
+  void set_budget( size_t budget );
+
+ private:
+
+  struct Entry {
+    uint64_t hash;
+    Key key;
+    std::vector<unsigned char> pixels;
+  };
+
+  static uint64_t hash( const Key& key );
+  static bool equal( const Key& a, const Key& b );
+
+  // evicts the oldest frames until bytes fits the budget, lock held
+  void evict();
+
+  size_t budget, bytes;
+  std::mutex lock;
+
+  // most recently used first
+  std::list<Entry> frames;
+  std::map<uint64_t, std::list<Entry>::iterator> index;
+
+}; // class FrameCache
+
+} // namespace CMU462
+
+#endif // CMU462_FRAME_CACHE_H
@@ -7,6 +7,7 @@
 #include <algorithm>
 
 #include "triangulation.h"
+#include "texture_atlas.h"
 
 using namespace std;
 
@@ -226,7 +227,15 @@ void HardwareRenderer::draw_image( Image& image ) {
   Vector2D p0 = transform(image.position);
   Vector2D p1 = transform(image.position + image.dimension);
 
-  rasterize_image( p0.x, p0.y, p1.x, p1.y, image.tex );
+  // packed images are uploaded from their rectangle of the page
+  if (image.atlas) {
+    Texture tex;
+    TextureAtlas::extract(image, tex);
+    rasterize_image( p0.x, p0.y, p1.x, p1.y, tex );
+    return;
+  }
+
+  rasterize_image( p0.x, p0.y, p1.x, p1.y, image.sampled() );
 }
 
 void HardwareRenderer::draw_group( Group& group ) {
@@ -301,9 +310,18 @@ void HardwareRenderer::rasterize_image(float x0, float y0,
                                        Texture& tex) {
   glColor4f(1, 1, 1, 1);
   
-  size_t w = tex.mipmap[0].width;
-  size_t h = tex.mipmap[0].height;
-  unsigned char* texels = &tex.mipmap[0].texels[0];
+  // GL wants row-major texels
+  Texture linear;
+  if (tex.layout != LINEAR_LAYOUT) {
+    linear.layout = tex.layout;
+    linear.mipmap.push_back(tex.mipmap[0]);
+    convert_texels(linear, LINEAR_LAYOUT);
+  }
+  MipLevel& base = linear.mipmap.empty() ? tex.mipmap[0] : linear.mipmap[0];
+
+  size_t w = base.width;
+  size_t h = base.height;
+  unsigned char* texels = &base.texels[0];
 
   GLuint texid;
   glGenTextures(1, &texid);
@@ -0,0 +1,17 @@
+option(DRAWSVG_BUILD_HEADLESS  "Build headless batch renderer"  ON)
+
+if(DRAWSVG_BUILD_HEADLESS)
+
+  # The headless renderer links the core library only, so it needs no
+  # display libraries
+  set(DRAWSVG_HEADLESS_SOURCE headless/headless.cpp)
+  if (WIN32)
+    list(APPEND DRAWSVG_HEADLESS_SOURCE dirent/dirent.c)
+  endif(WIN32)
+
+  add_executable( drawsvg_headless ${DRAWSVG_HEADLESS_SOURCE} )
+  target_link_libraries( drawsvg_headless drawsvg_core ${CMAKE_THREAD_LIBS_INIT} )
+
+  install(TARGETS drawsvg_headless DESTINATION ${drawsvg_SOURCE_DIR})
+
+endif(DRAWSVG_BUILD_HEADLESS)
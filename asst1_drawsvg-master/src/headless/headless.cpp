@@ -0,0 +1,1185 @@
+#include "svg.h"
+#include "png.h"
+#include "svg_cache.h"
+#include "texture_manager.h"
+#include "software_renderer.h"
+#include "texture_cache.h"
+#include "texture_atlas.h"
+#include "virtual_texture.h"
+#include "viewport.h"
+#include "tiles.h"
+
+#include <omp.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+using namespace CMU462;
+
+#define msg(s) cerr << "[DrawSVG] " << s << endl;
+
+/* NOTE:
+ * Renders svgs to images without a window, so nothing here may pull in
+ * GLFW or OpenGL: only the parser, the software renderer, the samplers
+ * and PNG I/O are linked. Views match the viewer's, the svg centered
+ * with its canvas outline and a 10% margin unless a viewbox is given.
+ */
+struct Options {
+
+  Options() : width ( 800 ), height ( 600 ), sample_rate ( 1 ),
+              method ( TRILINEAR ), layout ( LINEAR_LAYOUT ),
+              viewbox ( false ), compile ( false ), atlas ( false ),
+              format ( NULL ), output ( NULL ), tiles ( false ),
+              min_zoom ( 0 ), max_zoom ( 0 ), tile_size ( 256 ),
+              tile_cache ( NULL ), memory ( 512 ), keyframes ( NULL ),
+              pipeline ( false ), stream_texels ( 0 ), tile_memory ( 0 ) { }
+
+  size_t width, height;
+  size_t sample_rate;
+  SampleMethod method;
+
+  // layout of the mip levels our sampler builds, see TexelLayout
+  TexelLayout layout;
+
+  // viewbox center and half size in canvas coordinates
+  bool viewbox;
+  float x, y, span;
+
+  // write compiled scenes next to the sources for the next run
+  bool compile;
+
+  // pack small images into atlas pages, see TextureAtlas
+  bool atlas;
+
+  // "png" or "ppm", from the output name when not given, or "rgba" or
+  // "yuv" for frames
+  const char* format;
+
+  // output file for one svg, or directory for several
+  const char* output;
+
+  // map tiles of levels min_zoom to max_zoom instead of one image, into
+  // output/z/x/y.png, reusing tiles from the tile cache directory
+  bool tiles;
+  int min_zoom, max_zoom;
+  size_t tile_size;
+  const char* tile_cache;
+
+  // megabytes an image may take while drawn, larger ones are drawn and
+  // written a strip of rows at a time
+  size_t memory;
+
+  // file of viewbox keyframes, the frames between them are streamed raw
+  // to the output, stdout by default
+  const char* keyframes;
+
+  // batches through concurrent stages within the memory budget
+  bool pipeline;
+
+  // megatexels above which images are streamed and megabytes of their
+  // resident tiles, see VirtualTexture, its defaults when 0
+  size_t stream_texels;
+  size_t tile_memory;
+};
+
+static void usage() {
+  cerr << "Usage: drawsvg_headless [options] <svg file or directory>...\n"
+          "  -o <path>           output file, or directory for several svgs\n"
+          "                      (default: next to each svg)\n"
+          "  -f <format>         png or ppm (default: png), rgba or yuv\n"
+          "                      (i420) for frames (default: rgba)\n"
+          "  -w <width>          image width  (default: 800)\n"
+          "  -h <height>         image height (default: 600)\n"
+          "  -s <rate>           supersamples per pixel side (default: 1)\n"
+          "  -m <method>         nearest, bilinear, trilinear or summed-area\n"
+          "  -l <layout>         texel layout of mip levels, linear or tiled\n"
+          "                      (default: linear)\n"
+          "  -v <x> <y> <span>   viewbox center and half size in canvas units\n"
+          "  -c                  compile svgs to the scene cache\n"
+          "  -a                  pack small images into atlas pages\n"
+          "  -t <zmin>[-<zmax>]  render map tiles of zoom levels zmin to zmax\n"
+          "                      into <output>/z/x/y.png (default output:\n"
+          "                      the svg path with the extension .tiles)\n"
+          "  -T <pixels>         tile size (default: 256)\n"
+          "  -C <directory>      tile cache, tiles found there are not drawn\n"
+          "  -M <megabytes>      memory for drawing an image, larger images\n"
+          "                      are streamed to disk in strips, or with -p\n"
+          "                      for everything in flight (default: 512)\n"
+          "  -p                  render batches through concurrent parse,\n"
+          "                      mipmap, render and encode stages\n"
+          "  -k <keyframes>      render the frames of a flythrough of one svg\n"
+          "                      to <output> or stdout as raw video, from a\n"
+          "                      file of lines <frame> <x> <y> <span>\n"
+          "  -S <megatexels>     images larger than this are streamed from\n"
+          "                      disk in tiles (default: 64)\n"
+          "  -R <megabytes>      memory for resident tiles of streamed images\n"
+          "                      (default: 256)\n";
+}
+
+static bool is_directory( const char* path ) {
+  struct stat st;
+  return stat(path, &st) == 0 && (st.st_mode & S_IFDIR);
+}
+
+static string replace_extension( const string& path, const string& ext ) {
+  size_t slash = path.find_last_of("/\\");
+  size_t dot = path.find_last_of('.');
+  if (dot == string::npos || (slash != string::npos && dot < slash)) {
+    return path + "." + ext;
+  }
+  return path.substr(0, dot + 1) + ext;
+}
+
+static string base_name( const string& path ) {
+  size_t slash = path.find_last_of("/\\");
+  return slash == string::npos ? path : path.substr(slash + 1);
+}
+
+static int write_ppm( const char* filename, const PNG& png ) {
+  FILE* file = fopen(filename, "wb");
+  if (!file) return -1;
+  fprintf(file, "P6\n%d %d\n255\n", png.width, png.height);
+  vector<unsigned char> row(3 * png.width);
+  for (int y = 0; y < png.height; y++) {
+    const unsigned char* src = &png.pixels[4 * (size_t) png.width * y];
+    for (int x = 0; x < png.width; x++) {
+      memcpy(&row[3 * x], &src[4 * x], 3);
+    }
+    fwrite(row.data(), 1, row.size(), file);
+  }
+  return fclose(file) == 0 ? 0 : -1;
+}
+
+static int load( const char* path, SVG* svg, const Options& options ) {
+
+  // compiled scenes are used while they are up to date, and are saved
+  // before packing, see SVGCache::save
+  if (SVGCache::load(path, svg) < 0) {
+    if (SVGParser::load(path, svg) < 0) return -1;
+    if (options.compile) {
+      static Sampler2DImp sampler;
+      SVGCache::compile(svg, &sampler);
+      SVGCache::save(path, svg);
+    }
+  }
+  if (options.atlas) {
+    Sampler2DImp sampler(options.method);
+    sampler.set_texel_layout(options.layout);
+    TextureAtlas::pack(svg, &sampler);
+  }
+  return 0;
+}
+
+// "png" or "ppm", as given or from the output name
+static string output_format( const string& output, const Options& options ) {
+  if (options.format) return options.format;
+  return output.substr(output.find_last_of('.') + 1) == "ppm" ? "ppm" : "png";
+}
+
+// canvas to screen transform of a viewbox, see DrawSVG::resize
+static Matrix3x3 view( float x, float y, float span, const Options& options ) {
+  ViewportImp viewport;
+  viewport.set_viewbox(x, y, span);
+  Matrix3x3 norm_to_screen = Matrix3x3::identity();
+  float scale = min(options.width, options.height);
+  norm_to_screen(0,0) = scale; norm_to_screen(0,2) = (options.width  - scale) / 2;
+  norm_to_screen(1,1) = scale; norm_to_screen(1,2) = (options.height - scale) / 2;
+  return norm_to_screen * viewport.get_canvas_to_norm();
+}
+
+// the viewbox option, or the view DrawSVG sets up, see DrawSVG::auto_adjust
+static Matrix3x3 document_view( const SVG* svg, const Options& options ) {
+  if (options.viewbox) return view(options.x, options.y, options.span, options);
+  return view(svg->width / 2, svg->height / 2,
+              1.2 * max(svg->width, svg->height) / 2, options);
+}
+
+// writes an image to a png or ppm file as its rows come in
+class RowWriter {
+ public:
+
+  RowWriter() : ppm ( NULL ) { }
+  ~RowWriter() { if (ppm) fclose(ppm); }
+
+  int open( const string& filename, const string& format,
+            size_t width, size_t height ) {
+    if (format == "png") return png.open(filename.c_str(), width, height);
+    ppm = fopen(filename.c_str(), "wb");
+    if (!ppm) return -1;
+    fprintf(ppm, "P6\n%zu %zu\n255\n", width, height);
+    row.resize(3 * width);
+    return 0;
+  }
+
+  int write( const unsigned char* rgba, size_t rows ) {
+    if (!ppm) return png.write_rows(rgba, rows);
+    size_t width = row.size() / 3;
+    for (size_t y = 0; y < rows; y++) {
+      const unsigned char* src = rgba + 4 * width * y;
+      for (size_t x = 0; x < width; x++) {
+        memcpy(&row[3 * x], &src[4 * x], 3);
+      }
+      if (fwrite(row.data(), 1, row.size(), ppm) != row.size()) return -1;
+    }
+    return 0;
+  }
+
+  int close() {
+    if (!ppm) return png.close();
+    int error = fclose(ppm) == 0 ? 0 : -1;
+    ppm = NULL;
+    return error;
+  }
+
+ private:
+  PNGRowWriter png;
+  FILE* ppm;
+  vector<unsigned char> row;
+};
+
+// Draws the image a strip of rows at a time, each strip culled to the
+// elements over it and split between threads, and streams the strips to
+// the output, so only a strip is ever held. Each part is drawn in the
+// coordinates of the whole view at its target origin, so the image is
+// the one a single render gives, whatever the strip and thread count.
+static int render_strips( SVG* svg, const Matrix3x3& canvas_to_screen,
+                          Sampler2DImp* sampler, const string& output,
+                          const string& format, const Options& options ) {
+
+  size_t w = options.width, h = options.height;
+  size_t rate = options.sample_rate;
+
+  // the supersample buffer, the rows and their encoding
+  size_t row_bytes = 4 * w * (rate * rate + 2);
+  size_t strip = (options.memory << 20) / row_bytes;
+  strip = max((size_t) 1, min(strip, h));
+
+  RowWriter writer;
+  if (writer.open(output, format, w, h) < 0) return -1;
+
+  TileSet scene(svg);
+  scene.prepare(sampler, canvas_to_screen, rate);
+
+  int threads = omp_get_max_threads();
+  vector<SoftwareRendererImp> renderers(threads);
+  for (int t = 0; t < threads; t++) {
+    renderers[t].set_tex_sampler(sampler);
+    renderers[t].set_sample_rate(rate);
+  }
+
+  vector<unsigned char> pixels(4 * w * strip);
+  for (size_t y = 0; y < h; y += strip) {
+
+    size_t rows  = min(strip, h - y);
+    size_t chunk = (rows + threads - 1) / threads;
+    #pragma omp parallel for schedule(static, 1)
+    for (int t = 0; t < threads; t++) {
+      size_t y0 = t * chunk;
+      if (y0 >= rows) continue;
+      size_t n = min(chunk, rows - y0);
+
+      SoftwareRendererImp& renderer = renderers[t];
+      renderer.set_render_target(&pixels[4 * w * y0], w, n);
+      renderer.set_target_origin(0, y + y0);
+      scene.draw(canvas_to_screen, w, n, renderer, true);
+    }
+
+    if (writer.write(pixels.data(), rows) < 0) {
+      writer.close();
+      return -1;
+    }
+  }
+
+  return writer.close();
+}
+
+static int render( const char* path, const string& output,
+                   const Options& options ) {
+
+  SVG* svg = new SVG();
+  if (load(path, svg, options) < 0) {
+    msg("Could not load " << path);
+    delete svg;
+    return -1;
+  }
+
+  Matrix3x3 canvas_to_screen = document_view(svg, options);
+
+  Sampler2DImp sampler(options.method);
+  sampler.set_texel_layout(options.layout);
+  string format = output_format(output, options);
+
+  // frames over the memory budget, the render target and the supersample
+  // buffer, are drawn in strips
+  int error;
+  size_t rate = options.sample_rate;
+  size_t frame = 4 * options.width * options.height * (1 + rate * rate);
+  if (frame > options.memory << 20) {
+    error = render_strips(svg, canvas_to_screen, &sampler, output, format,
+                          options);
+  } else {
+    TextureManager::update(svg, &sampler, canvas_to_screen, rate);
+
+    PNG png;
+    png.width  = options.width;
+    png.height = options.height;
+    png.pixels.resize(4 * options.width * options.height);
+
+    SoftwareRendererImp renderer;
+    renderer.set_tex_sampler(&sampler);
+    renderer.set_render_target(&png.pixels[0], options.width, options.height);
+    renderer.set_sample_rate(rate);
+    renderer.set_canvas_to_screen(canvas_to_screen);
+    renderer.clear_target();
+    renderer.draw_svg(*svg);
+
+    error = format == "ppm" ? write_ppm(output.c_str(), png)
+                            : PNGParser::save(output.c_str(), png);
+  }
+  delete svg;
+
+  if (error) {
+    msg("Could not write " << output);
+    return -1;
+  }
+  msg("Rendered " << path << " to " << output);
+  return 0;
+}
+
+static int write_file( const string& filename,
+                       const vector<unsigned char>& data ) {
+  FILE* file = fopen(filename.c_str(), "wb");
+  if (!file) return -1;
+  bool written = fwrite(data.data(), 1, data.size(), file) == data.size();
+  return fclose(file) == 0 && written ? 0 : -1;
+}
+
+static int render_tiles( const char* path, const string& output,
+                         const Options& options ) {
+
+  // tiles are cached by the hash of the source
+  ifstream in(path, ios::binary);
+  if (!in) {
+    msg("Could not load " << path);
+    return -1;
+  }
+  stringstream source;
+  source << in.rdbuf();
+  string text = source.str();
+
+  SVG* svg = new SVG();
+  if (load(path, svg, options) < 0) {
+    msg("Could not load " << path);
+    delete svg;
+    return -1;
+  }
+
+  size_t size = options.tile_size;
+  size_t rate = options.sample_rate;
+  Sampler2DImp sampler(options.method);
+  sampler.set_texel_layout(options.layout);
+  TileSet tiles(svg);
+  TileStore* store = options.tile_cache
+    ? new TileStore(options.tile_cache, TextureCache::key(text.data(), text.size()),
+                    size, rate, options.method)
+    : NULL;
+
+  long drawn = 0, cached = 0, failed = 0;
+  for (int z = options.min_zoom; z <= options.max_zoom; z++) {
+
+    long n = 1L << z;
+    char level[64];
+    for (long x = 0; x < n; x++) {
+      snprintf(level, sizeof(level), "/%d/%ld", z, x);
+      if (make_directories(output + level) < 0) {
+        msg("Could not create " << output << level);
+        delete store; delete svg;
+        return -1;
+      }
+    }
+
+    // the tiles of a level share the scene, each thread draws its own
+    tiles.prepare(&sampler, z, size, rate);
+    #pragma omp parallel reduction(+:drawn, cached, failed)
+    {
+      PNG png;
+      png.width = png.height = size;
+      png.pixels.resize(4 * size * size);
+      SoftwareRendererImp renderer;
+      renderer.set_tex_sampler(&sampler);
+      renderer.set_render_target(&png.pixels[0], size, size);
+      renderer.set_sample_rate(rate);
+      vector<unsigned char> encoded;
+      char name[64];
+
+      #pragma omp for schedule(dynamic)
+      for (long i = 0; i < n * n; i++) {
+        int x = i % n, y = i / n;
+        if (store && store->load(z, x, y, encoded) == 0) {
+          cached++;
+        } else {
+          tiles.draw(z, x, y, size, renderer);
+          if (PNGParser::save(encoded, png) < 0) {
+            failed++;
+            continue;
+          }
+          if (store) store->save(z, x, y, encoded);
+          drawn++;
+        }
+        snprintf(name, sizeof(name), "/%d/%d/%d.png", z, x, y);
+        if (write_file(output + name, encoded) < 0) failed++;
+      }
+    }
+  }
+
+  delete store;
+  delete svg;
+  if (failed) {
+    msg("Could not write " << failed << " tiles of " << path);
+    return -1;
+  }
+  msg("Rendered " << path << " to " << output << ", " << drawn
+      << " tiles drawn and " << cached << " from the cache");
+  return 0;
+}
+
+// Frames //
+
+struct Keyframe {
+  double frame;
+  float x, y, span;
+};
+
+// reads lines of <frame> <x> <y> <span>, in increasing frame order
+static int load_keyframes( const char* path, vector<Keyframe>& keys ) {
+
+  ifstream in(path);
+  if (!in) return -1;
+
+  string line;
+  while (getline(in, line)) {
+    if (line.empty() || line[0] == '#') continue;
+    Keyframe key;
+    if (sscanf(line.c_str(), "%lf %f %f %f",
+               &key.frame, &key.x, &key.y, &key.span) != 4) continue;
+    if (key.frame < 0 || key.span <= 0) return -1;
+    if (!keys.empty() && key.frame <= keys.back().frame) return -1;
+    keys.push_back(key);
+  }
+  return keys.empty() ? -1 : 0;
+}
+
+// The viewbox at frame, linear in the center and geometric in the span
+// between keyframes, so zooms run at a steady rate.
+static Keyframe interpolate( const vector<Keyframe>& keys, double frame ) {
+
+  if (frame <= keys.front().frame) return keys.front();
+  if (frame >= keys.back().frame) return keys.back();
+
+  size_t i = 1;
+  while (keys[i].frame < frame) i++;
+  const Keyframe& a = keys[i - 1];
+  const Keyframe& b = keys[i];
+  double t = (frame - a.frame) / (b.frame - a.frame);
+
+  Keyframe key;
+  key.frame = frame;
+  key.x = a.x + t * (b.x - a.x);
+  key.y = a.y + t * (b.y - a.y);
+  key.span = a.span * pow(b.span / a.span, t);
+  return key;
+}
+
+// Framebuffers passed from the thread drawing frames to the one writing
+// them, so drawing frame n + 1 overlaps writing frame n. Buffers are
+// filled and written in turn, each side waiting on the other when it
+// gets a whole ring ahead.
+class FrameRing {
+ public:
+
+  FrameRing( size_t count, size_t size )
+    : buffers ( count, vector<unsigned char>(size) ),
+      head ( 0 ), tail ( 0 ), filled ( 0 ), closed ( false ) { }
+
+  // the next buffer to draw into, waits for the writer
+  unsigned char* acquire() {
+    unique_lock<mutex> guard(lock);
+    while (filled == buffers.size()) changed.wait(guard);
+    return buffers[head].data();
+  }
+
+  // hands the acquired buffer to the writer
+  void submit() {
+    lock_guard<mutex> guard(lock);
+    head = (head + 1) % buffers.size();
+    filled++;
+    changed.notify_all();
+  }
+
+  // the next buffer to write, NULL once closed and drained
+  const unsigned char* next() {
+    unique_lock<mutex> guard(lock);
+    while (!filled && !closed) changed.wait(guard);
+    return filled ? buffers[tail].data() : NULL;
+  }
+
+  // returns the written buffer to the drawing side
+  void release() {
+    lock_guard<mutex> guard(lock);
+    tail = (tail + 1) % buffers.size();
+    filled--;
+    changed.notify_all();
+  }
+
+  // no frames follow
+  void close() {
+    lock_guard<mutex> guard(lock);
+    closed = true;
+    changed.notify_all();
+  }
+
+ private:
+
+  vector<vector<unsigned char> > buffers;
+  size_t head, tail, filled;
+  bool closed;
+  mutex lock;
+  condition_variable changed;
+};
+
+// frames drawn ahead of the one being written
+static const size_t kFrameBuffers = 3;
+
+// I420 as encoders take it, BT.601 studio swing, chroma averaged over
+// 2 by 2 pixels
+static void rgba_to_yuv( const unsigned char* rgba, size_t w, size_t h,
+                         unsigned char* yuv ) {
+
+  size_t cw = (w + 1) / 2, ch = (h + 1) / 2;
+  unsigned char* py = yuv;
+  unsigned char* pu = py + w * h;
+  unsigned char* pv = pu + cw * ch;
+
+  for (size_t y = 0; y < h; y++) {
+    const unsigned char* src = rgba + 4 * w * y;
+    for (size_t x = 0; x < w; x++) {
+      int r = src[4 * x], g = src[4 * x + 1], b = src[4 * x + 2];
+      py[w * y + x] = (unsigned char) (((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+    }
+  }
+
+  for (size_t y = 0; y < ch; y++) {
+    for (size_t x = 0; x < cw; x++) {
+      int r = 0, g = 0, b = 0, n = 0;
+      for (size_t j = 2 * y; j < min(2 * y + 2, h); j++) {
+        for (size_t i = 2 * x; i < min(2 * x + 2, w); i++) {
+          const unsigned char* p = rgba + 4 * (w * j + i);
+          r += p[0]; g += p[1]; b += p[2]; n++;
+        }
+      }
+      r /= n; g /= n; b /= n;
+
+      // offset so the shifts only ever see non-negative values
+      pu[cw * y + x] = (unsigned char) ((-38 * r -  74 * g + 112 * b + 128 + 32768) >> 8);
+      pv[cw * y + x] = (unsigned char) ((112 * r -  94 * g -  18 * b + 128 + 32768) >> 8);
+    }
+  }
+}
+
+static int render_frames( const char* path, const string& output,
+                          const Options& options ) {
+
+  vector<Keyframe> keys;
+  if (load_keyframes(options.keyframes, keys) < 0) {
+    msg("Could not load keyframes from " << options.keyframes);
+    return -1;
+  }
+
+  SVG* svg = new SVG();
+  if (load(path, svg, options) < 0) {
+    msg("Could not load " << path);
+    delete svg;
+    return -1;
+  }
+
+  FILE* out = output == "-" ? stdout : fopen(output.c_str(), "wb");
+  if (!out) {
+    msg("Could not open " << output);
+    delete svg;
+    return -1;
+  }
+
+  size_t w = options.width, h = options.height;
+  bool yuv = options.format && !strcmp(options.format, "yuv");
+  FrameRing ring(kFrameBuffers, 4 * w * h);
+
+  // frames are converted and written off the drawing thread; after a
+  // failed write the rest are only drained, and drawing stops
+  atomic<bool> failed(false);
+  thread writer([&]() {
+    vector<unsigned char> frame(yuv ? w * h + 2 * ((w + 1) / 2) * ((h + 1) / 2)
+                                    : 0);
+    const unsigned char* rgba;
+    while ((rgba = ring.next()) != NULL) {
+      if (!failed) {
+        if (yuv) rgba_to_yuv(rgba, w, h, frame.data());
+        const unsigned char* data = yuv ? frame.data() : rgba;
+        size_t size = yuv ? frame.size() : 4 * w * h;
+        failed = fwrite(data, 1, size, out) != size || fflush(out) != 0;
+      }
+      ring.release();
+    }
+  });
+
+  Sampler2DImp sampler(options.method);
+  sampler.set_texel_layout(options.layout);
+  SoftwareRendererImp renderer;
+  renderer.set_tex_sampler(&sampler);
+  renderer.set_sample_rate(options.sample_rate);
+
+  long frames = (long) ceil(keys.back().frame) + 1;
+  long drawn = 0;
+  for (; drawn < frames && !failed; drawn++) {
+    Keyframe key = interpolate(keys, drawn);
+    Matrix3x3 canvas_to_screen = view(key.x, key.y, key.span, options);
+    TextureManager::update(svg, &sampler, canvas_to_screen,
+                           options.sample_rate);
+
+    renderer.set_render_target(ring.acquire(), w, h);
+    renderer.set_canvas_to_screen(canvas_to_screen);
+    renderer.clear_target();
+    renderer.draw_svg(*svg);
+    ring.submit();
+  }
+
+  ring.close();
+  writer.join();
+  delete svg;
+  if (out != stdout && fclose(out) != 0) failed = true;
+
+  if (failed) {
+    msg("Could not write frames of " << path << " to " << output);
+    return -1;
+  }
+  msg("Rendered " << drawn << " frames of " << path << " to "
+      << (output == "-" ? "stdout" : output));
+  return 0;
+}
+
+// output for the svg at path, into the directory dir when not empty
+static string output_path( const string& path, const string& dir,
+                           const Options& options ) {
+  string ext = options.tiles ? "tiles" : options.format ? options.format : "png";
+  string name = replace_extension(dir.empty() ? path : base_name(path), ext);
+  if (dir.empty()) return name;
+  return dir + (dir.back() == '/' ? "" : "/") + name;
+}
+
+// svgs of a directory, sorted so batches come out in the same order
+// everywhere
+static int list_directory( const char* path, vector<string>& files ) {
+
+  DIR* d = opendir(path);
+  if (!d) {
+    msg("Could not open directory " << path);
+    return -1;
+  }
+
+  struct dirent* ent;
+  string pathname = path;
+  if (pathname.back() != '/') pathname.push_back('/');
+  size_t first = files.size();
+  while ((ent = readdir(d)) != NULL) {
+    string filename = ent->d_name;
+    if (filename.size() > 4 &&
+        filename.compare(filename.size() - 4, 4, ".svg") == 0) {
+      files.push_back(pathname + filename);
+    }
+  }
+  closedir(d);
+  sort(files.begin() + first, files.end());
+  return 0;
+}
+
+static int render_directory( const char* path, const string& dir,
+                             const Options& options ) {
+
+  vector<string> files;
+  if (list_directory(path, files) < 0) return -1;
+
+  int failed = 0;
+  for (size_t i = 0; i < files.size(); i++) {
+    const string& file = files[i];
+    string output = output_path(file, dir, options);
+    int error = options.tiles ? render_tiles(file.c_str(), output, options)
+                              : render(file.c_str(), output, options);
+    if (error < 0) failed++;
+  }
+  return failed ? -1 : 0;
+}
+
+// Pipeline //
+
+/* NOTE:
+ * Batches rendered with -p go through concurrent stages, each its own
+ * threads, connected by bounded queues:
+ *
+ *   parse   reads the svg and decodes its images, which the parser does
+ *           inline so images shared between documents decode once
+ *   mipmap  builds the mip levels the view samples
+ *   render  draws, and frees the document
+ *   encode  compresses and writes the image
+ *
+ * Documents are charged to a memory budget from parsing until they are
+ * drawn, and images until they are written, as are the render target and
+ * supersample buffers of the renderers. Parsing waits while the budget is
+ * spent, so a batch of any size runs in bounded memory. Stages run their
+ * OpenMP loops on one thread, the stages being the parallelism.
+ */
+
+// bytes in flight, waited on while spent unless no document is in
+// flight, so that any single document gets through
+class Budget {
+ public:
+
+  Budget( size_t limit ) : limit ( limit ), reserved ( 0 ), used ( 0 ),
+                           peak ( 0 ) { }
+
+  // held throughout, and not in flight
+  void reserve( size_t bytes ) {
+    lock_guard<mutex> guard(lock);
+    reserved += bytes;
+    used += bytes;
+    peak = max(peak, used);
+  }
+
+  void take( size_t bytes ) {
+    unique_lock<mutex> guard(lock);
+    while (used > reserved && used + bytes > limit) changed.wait(guard);
+    used += bytes;
+    peak = max(peak, used);
+  }
+
+  // for growth only known once it happened
+  void force( size_t bytes ) {
+    lock_guard<mutex> guard(lock);
+    used += bytes;
+    peak = max(peak, used);
+  }
+
+  void give( size_t bytes ) {
+    lock_guard<mutex> guard(lock);
+    used -= min(bytes, used - reserved);
+    changed.notify_all();
+  }
+
+  size_t high_water() {
+    lock_guard<mutex> guard(lock);
+    return peak;
+  }
+
+ private:
+  size_t limit, reserved, used, peak;
+  mutex lock;
+  condition_variable changed;
+};
+
+template <class T>
+class BoundedQueue {
+ public:
+
+  BoundedQueue( size_t capacity ) : capacity ( capacity ), producers ( 0 ) { }
+
+  // the queue closes once every producer is done
+  void add_producer() {
+    lock_guard<mutex> guard(lock);
+    producers++;
+  }
+
+  void producer_done() {
+    lock_guard<mutex> guard(lock);
+    producers--;
+    changed.notify_all();
+  }
+
+  void push( const T& item ) {
+    unique_lock<mutex> guard(lock);
+    while (items.size() >= capacity) changed.wait(guard);
+    items.push_back(item);
+    changed.notify_all();
+  }
+
+  // false once closed and drained
+  bool pop( T& item ) {
+    unique_lock<mutex> guard(lock);
+    while (items.empty() && producers) changed.wait(guard);
+    if (items.empty()) return false;
+    item = items.front();
+    items.pop_front();
+    changed.notify_all();
+    return true;
+  }
+
+ private:
+  size_t capacity;
+  int producers;
+  mutex lock;
+  condition_variable changed;
+  deque<T> items;
+};
+
+struct Job {
+  string path, output;
+  SVG* svg;
+  Sampler2DImp sampler;
+  Matrix3x3 canvas_to_screen;
+  size_t bytes;  // charged to the budget
+  PNG png;
+};
+
+// time a stage spent working and waiting, summed over its threads
+struct StageStats {
+
+  StageStats() : items ( 0 ), failed ( 0 ), busy ( 0 ), idle ( 0 ),
+                 blocked ( 0 ) { }
+
+  atomic<long> items, failed;
+  atomic<long long> busy, idle, blocked; // microseconds
+};
+
+static long long micros_since( chrono::steady_clock::time_point start ) {
+  return chrono::duration_cast<chrono::microseconds>(
+    chrono::steady_clock::now() - start).count();
+}
+
+// charges the change in the bytes of a job
+static void recharge( Job* job, size_t bytes, Budget& budget ) {
+  if (bytes > job->bytes) budget.force(bytes - job->bytes);
+  else budget.give(job->bytes - bytes);
+  job->bytes = bytes;
+}
+
+static size_t file_size( const char* path ) {
+  struct stat st;
+  return stat(path, &st) == 0 ? st.st_size : 0;
+}
+
+static int render_pipeline( const vector<string>& paths,
+                            const vector<string>& outputs,
+                            const Options& options ) {
+
+  size_t w = options.width, h = options.height;
+  size_t rate = options.sample_rate;
+  size_t frame = 4 * w * h;
+
+  // stage threads, rendering the heaviest
+  int procs = omp_get_num_procs();
+  int parsers  = max(1, procs / 4);
+  int mippers  = max(1, procs / 4);
+  int renderers = max(1, procs / 2);
+  int encoders = max(1, procs / 4);
+
+  // renderers hold their supersample buffers throughout
+  Budget budget(options.memory << 20);
+  budget.reserve(renderers * frame * rate * rate);
+
+  size_t depth = 2 * max(renderers, encoders);
+  BoundedQueue<Job*> parsed(depth), mipmapped(depth), drawn(depth);
+  StageStats stats[4];
+  const char* names[4] = { "parse", "mipmap", "render", "encode" };
+  atomic<size_t> next(0);
+  auto start = chrono::steady_clock::now();
+
+  vector<thread> threads;
+  for (int i = 0; i < parsers; i++) parsed.add_producer();
+  for (int i = 0; i < mippers; i++) mipmapped.add_producer();
+  for (int i = 0; i < renderers; i++) drawn.add_producer();
+
+  for (int i = 0; i < parsers; i++) threads.push_back(thread([&]() {
+    omp_set_num_threads(1);
+    StageStats& s = stats[0];
+    size_t n;
+    while ((n = next++) < paths.size()) {
+
+      // the source is a lower bound of the document until it is parsed
+      auto t = chrono::steady_clock::now();
+      Job* job = new Job();
+      job->path = paths[n];
+      job->output = outputs[n];
+      job->bytes = file_size(paths[n].c_str());
+      budget.take(job->bytes);
+      s.blocked += micros_since(t);
+
+      t = chrono::steady_clock::now();
+      job->svg = new SVG();
+      if (load(job->path.c_str(), job->svg, options) < 0) {
+        msg("Could not load " << job->path);
+        delete job->svg;
+        budget.give(job->bytes);
+        delete job;
+        s.failed++;
+        continue;
+      }
+      recharge(job, job->svg->bytes(), budget);
+      s.busy += micros_since(t);
+      s.items++;
+
+      t = chrono::steady_clock::now();
+      parsed.push(job);
+      s.blocked += micros_since(t);
+    }
+    parsed.producer_done();
+  }));
+
+  for (int i = 0; i < mippers; i++) threads.push_back(thread([&]() {
+    omp_set_num_threads(1);
+    StageStats& s = stats[1];
+    Job* job;
+    for (;;) {
+      auto t = chrono::steady_clock::now();
+      if (!parsed.pop(job)) break;
+      s.idle += micros_since(t);
+
+      t = chrono::steady_clock::now();
+      job->sampler.set_sample_method(options.method);
+      job->sampler.set_texel_layout(options.layout);
+      job->canvas_to_screen = document_view(job->svg, options);
+      TextureManager::update(job->svg, &job->sampler, job->canvas_to_screen, rate);
+      recharge(job, job->svg->bytes(), budget);
+      s.busy += micros_since(t);
+      s.items++;
+
+      t = chrono::steady_clock::now();
+      mipmapped.push(job);
+      s.blocked += micros_since(t);
+    }
+    mipmapped.producer_done();
+  }));
+
+  for (int i = 0; i < renderers; i++) threads.push_back(thread([&]() {
+    omp_set_num_threads(1);
+    StageStats& s = stats[2];
+    SoftwareRendererImp renderer;
+    renderer.set_sample_rate(rate);
+    Job* job;
+    for (;;) {
+      auto t = chrono::steady_clock::now();
+      if (!mipmapped.pop(job)) break;
+      s.idle += micros_since(t);
+
+      // the document gives way to its image
+      t = chrono::steady_clock::now();
+      job->png.width  = w;
+      job->png.height = h;
+      job->png.pixels.resize(frame);
+      renderer.set_tex_sampler(&job->sampler);
+      renderer.set_render_target(&job->png.pixels[0], w, h);
+      renderer.set_canvas_to_screen(job->canvas_to_screen);
+      renderer.clear_target();
+      renderer.draw_svg(*job->svg);
+      delete job->svg;
+      recharge(job, frame, budget);
+      s.busy += micros_since(t);
+      s.items++;
+
+      t = chrono::steady_clock::now();
+      drawn.push(job);
+      s.blocked += micros_since(t);
+    }
+    drawn.producer_done();
+  }));
+
+  for (int i = 0; i < encoders; i++) threads.push_back(thread([&]() {
+    omp_set_num_threads(1);
+    StageStats& s = stats[3];
+    Job* job;
+    for (;;) {
+      auto t = chrono::steady_clock::now();
+      if (!drawn.pop(job)) break;
+      s.idle += micros_since(t);
+
+      t = chrono::steady_clock::now();
+      int error = output_format(job->output, options) == "ppm"
+                ? write_ppm(job->output.c_str(), job->png)
+                : PNGParser::save(job->output.c_str(), job->png);
+      if (error) {
+        msg("Could not write " << job->output);
+        s.failed++;
+      } else {
+        s.items++;
+      }
+      budget.give(job->bytes);
+      delete job;
+      s.busy += micros_since(t);
+    }
+  }));
+
+  for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+  double seconds = micros_since(start) / 1e6;
+
+  // per stage: documents, throughput of one thread while busy, and time
+  // spent waiting for the previous stage and on the next one or memory
+  int counts[4] = { parsers, mippers, renderers, encoders };
+  char line[160];
+  msg("Rendered " << stats[3].items << " of " << paths.size() << " svgs in "
+      << seconds << "s, peak memory in flight " << (budget.high_water() >> 20)
+      << " MB");
+  for (int i = 0; i < 4; i++) {
+    StageStats& s = stats[i];
+    double busy = s.busy / 1e6;
+    snprintf(line, sizeof(line),
+             "%-7s %2d threads %7ld done %6.1f/s per thread, "
+             "waited %.2fs for input, %.2fs for output or memory",
+             names[i], counts[i], (long) s.items,
+             busy > 0 ? s.items / busy : 0.0, s.idle / 1e6, s.blocked / 1e6);
+    msg(line);
+  }
+
+  return stats[0].failed || stats[3].failed ? -1 : 0;
+}
+
+int main( int argc, char** argv ) {
+
+  Options options;
+  vector<const char*> inputs;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "-o" && has_value) {
+      options.output = argv[++i];
+    } else if (arg == "-f" && has_value) {
+      options.format = argv[++i];
+    } else if (arg == "-w" && has_value) {
+      options.width = atoi(argv[++i]);
+    } else if (arg == "-h" && has_value) {
+      options.height = atoi(argv[++i]);
+    } else if (arg == "-s" && has_value) {
+      options.sample_rate = atoi(argv[++i]);
+    } else if (arg == "-m" && has_value) {
+      string m = argv[++i];
+      if      (m == "nearest")     options.method = NEAREST;
+      else if (m == "bilinear")    options.method = BILINEAR;
+      else if (m == "trilinear")   options.method = TRILINEAR;
+      else if (m == "summed-area") options.method = SUMMED_AREA;
+      else { usage(); return 1; }
+    } else if (arg == "-l" && has_value) {
+      string l = argv[++i];
+      if      (l == "linear") options.layout = LINEAR_LAYOUT;
+      else if (l == "tiled")  options.layout = TILED_LAYOUT;
+      else { usage(); return 1; }
+    } else if (arg == "-v" && i + 3 < argc) {
+      options.viewbox = true;
+      options.x    = atof(argv[++i]);
+      options.y    = atof(argv[++i]);
+      options.span = atof(argv[++i]);
+    } else if (arg == "-c") {
+      options.compile = true;
+    } else if (arg == "-a") {
+      options.atlas = true;
+    } else if (arg == "-t" && has_value) {
+      options.tiles = true;
+      const char* levels = argv[++i];
+      const char* dash = strchr(levels, '-');
+      options.min_zoom = atoi(levels);
+      options.max_zoom = dash ? atoi(dash + 1) : options.min_zoom;
+    } else if (arg == "-T" && has_value) {
+      options.tile_size = atoi(argv[++i]);
+    } else if (arg == "-C" && has_value) {
+      options.tile_cache = argv[++i];
+    } else if (arg == "-M" && has_value) {
+      options.memory = atoi(argv[++i]);
+    } else if (arg == "-k" && has_value) {
+      options.keyframes = argv[++i];
+    } else if (arg == "-p") {
+      options.pipeline = true;
+    } else if (arg == "-S" && has_value) {
+      options.stream_texels = atoi(argv[++i]);
+    } else if (arg == "-R" && has_value) {
+      options.tile_memory = atoi(argv[++i]);
+    } else if (arg[0] == '-') {
+      usage(); return 1;
+    } else {
+      inputs.push_back(argv[i]);
+    }
+  }
+
+  if (inputs.empty() || !options.width || !options.height ||
+      !options.sample_rate || !options.tile_size || !options.memory ||
+      options.min_zoom < 0 || options.max_zoom < options.min_zoom ||
+      options.max_zoom > 20 ||
+      (!options.keyframes && options.format && strcmp(options.format, "png") &&
+                                                strcmp(options.format, "ppm"))) {
+    usage(); return 1;
+  }
+  if (options.stream_texels) {
+    VirtualTexture::set_threshold(options.stream_texels << 20);
+  }
+  if (options.tile_memory) {
+    VirtualTexture::set_cache_limit(options.tile_memory << 20);
+  }
+
+  // a flythrough is one stream of frames of one svg
+  if (options.keyframes) {
+    if (inputs.size() > 1 || is_directory(inputs[0]) || options.tiles ||
+        (options.format && strcmp(options.format, "rgba") &&
+                           strcmp(options.format, "yuv"))) {
+      usage(); return 1;
+    }
+    return render_frames(inputs[0], options.output ? options.output : "-",
+                         options) < 0 ? 1 : 0;
+  }
+
+  // several svgs go into an output directory
+  bool batch = inputs.size() > 1 || is_directory(inputs[0]);
+  string dir = batch && options.output ? options.output : "";
+  if (batch && options.output && !is_directory(options.output)) {
+    msg("Output directory does not exist: " << options.output);
+    return 1;
+  }
+
+  // the whole batch goes through the pipeline at once
+  if (options.pipeline && !options.tiles) {
+    vector<string> paths, outputs;
+    for (size_t i = 0; i < inputs.size(); i++) {
+      if (!is_directory(inputs[i])) {
+        paths.push_back(inputs[i]);
+      } else if (list_directory(inputs[i], paths) < 0) {
+        return 1;
+      }
+    }
+    for (size_t i = 0; i < paths.size(); i++) {
+      outputs.push_back(!batch && options.output ? options.output
+                                                 : output_path(paths[i], dir, options));
+    }
+    return render_pipeline(paths, outputs, options) < 0 ? 1 : 0;
+  }
+
+  int failed = 0;
+  for (size_t i = 0; i < inputs.size(); i++) {
+    if (is_directory(inputs[i])) {
+      failed += render_directory(inputs[i], dir, options) < 0;
+    } else {
+      string output = !batch && options.output ? options.output
+                                               : output_path(inputs[i], dir, options);
+      int error = options.tiles ? render_tiles(inputs[i], output, options)
+                                : render(inputs[i], output, options);
+      failed += error < 0;
+    }
+  }
+
+  return failed ? 1 : 0;
+}
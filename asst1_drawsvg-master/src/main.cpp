@@ -1,6 +1,7 @@
 #include "CMU462.h"
 #include "viewer.h"
 #include "drawsvg.h"
+#include "virtual_texture.h"
 
 #include <sys/stat.h>
 #include <dirent.h>
@@ -13,15 +14,9 @@ using namespace CMU462;
 
 int loadFile( DrawSVG* drawsvg, const char* path ) {
 
-  SVG* svg = new SVG();
-
-  if( SVGParser::load( path, svg ) < 0) {
-    delete svg;
-    return -1;
-  }
-  
-  drawsvg->newTab( svg );
-  return 0;
+  // tabs of files are unloaded while out of view, and loaded again from
+  // the compiled scene written on the first load
+  return drawsvg->newTab( path );
 }
 
 int loadDirectory( DrawSVG* drawsvg, const char* path ) {
@@ -34,7 +29,7 @@ int loadDirectory( DrawSVG* drawsvg, const char* path ) {
     // load files
     string pathname = path; 
     if (pathname[pathname.back()] != '/') pathname.push_back('/');
-    while (((ent = readdir (dir)) != NULL) && (n < 9)) {
+    while ((ent = readdir (dir)) != NULL) {
 
       string filename = ent->d_name;
       string filesufx = filename.substr(filename.find_last_of(".") + 1);
@@ -99,11 +94,30 @@ int main( int argc, char** argv ) {
   // set drawsvg as renderer
   viewer.set_renderer(drawsvg);
 
+  // options, then the path
+  string shared; size_t buffers = 3;
+  int i = 1;
+  for (; i + 1 < argc; i += 2) {
+    string arg = argv[i];
+    if      (arg == "-m") shared  = argv[i + 1];
+    else if (arg == "-b") buffers = atoi(argv[i + 1]);
+    else if (arg == "-f") drawsvg->setFrameCacheBudget((size_t) atol(argv[i + 1]) << 20);
+    else if (arg == "-t") drawsvg->setTabBudget((size_t) atol(argv[i + 1]) << 20);
+    else if (arg == "-S") VirtualTexture::set_threshold((size_t) atol(argv[i + 1]) << 20);
+    else if (arg == "-R") VirtualTexture::set_cache_limit((size_t) atol(argv[i + 1]) << 20);
+    else break;
+  }
+  if (!shared.empty()) drawsvg->shareFramebuffer(shared, buffers);
+
   // load tests
-  if( argc == 2 ) {
-    if (loadPath(drawsvg, argv[1]) < 0) exit(0);
+  if( argc == i + 1 && argv[i][0] != '-' ) {
+    if (loadPath(drawsvg, argv[i]) < 0) exit(0);
   } else {
-    msg("Usage: drawsvg <path to test file or directory>"); exit(0);
+    msg("Usage: drawsvg [-m <shared framebuffer> [-b <buffers>]] "
+        "[-f <frame cache megabytes>] [-t <loaded tabs megabytes>] "
+        "[-S <streamed image megatexels>] [-R <resident tiles megabytes>] "
+        "<path to test file or directory>");
+    exit(0);
   }
 
   // init viewer
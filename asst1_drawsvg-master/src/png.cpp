@@ -1,5 +1,12 @@
 #include "png.h"
 
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+#include <algorithm>
 #include <fstream>
 #include <sstream>
 #include <iostream>
@@ -29,7 +36,7 @@ namespace CMU462 {
  *    misrepresented as being the original software.
  * 3. This notice may not be removed or altered from any source distribution.
  */
-int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
+static int decode_picopng(const unsigned char *buffer, size_t size, PNG& png) {
     
   static const unsigned long LENBASE[29] =  {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
   static const unsigned long LENEXTRA[29] = {0,0,0,0,0,0,0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4,  4,  5,  5,  5,  5,  0};
@@ -230,6 +237,7 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
   {
     struct Info
     {
+      Info() : width(0), height(0), colorType(0), bitDepth(0), compressionMethod(0), filterMethod(0), interlaceMethod(0), key_r(0), key_g(0), key_b(0), key_defined(false) {}
       unsigned long width, height, colorType, bitDepth, compressionMethod, filterMethod, interlaceMethod, key_r, key_g, key_b;
       bool key_defined; //is a transparent color key given?
       std::vector<unsigned char> palette;
@@ -242,7 +250,7 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
       readPngHeader(&in[0], size); if(error) return;
       size_t pos = 33; //first byte of the first chunk after the header
       std::vector<unsigned char> idat; //the data from idat chunks
-      bool IEND = false, known_type = true;
+      bool IEND = false;
       info.key_defined = false;
       while(!IEND) //loop through the chunks, ignoring unknown chunks and stopping at IEND chunk. IDAT data is put at the start of the in buffer
       {
@@ -294,7 +302,6 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
         {
           if(!(in[pos + 0] & 32)) { error = 69; return; } //error: unknown critical chunk (5th bit of first byte of chunk type is 0)
           pos += (chunkLength + 4); //skip 4 letters and uninterpreted data of unimplemented chunk
-          known_type = false;
         }
         pos += 4; //step over CRC (which is ignored)
       }
@@ -518,20 +525,742 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
   decoder.decode(png.pixels, buffer, size, convert_to_rgba32);
   png.width = decoder.info.width; 
   png.height = decoder.info.height;
-  
-  // premultiply by alpha
-  for (size_t i = 0; i < png.pixels.size(); i+= 4) {
-    if( ! png.pixels[i + 3] ) {
-      png.pixels[  i  ] = 0; 
-      png.pixels[i + 1] = 0; 
-      png.pixels[i + 2] = 0; 
+
+  return decoder.error;
+}
+
+/* NOTE:
+ * The fast decoder handles the common case of non-interlaced images with
+ * 8 bits per channel. Inflate keeps a 64-bit bit buffer that is refilled
+ * a word at a time and decodes Huffman codes of up to kFastBits bits with
+ * a single table lookup (longer codes fall back to a canonical search).
+ * The Up and Sub filters are undone a word at a time. Anything else
+ * (Adam7, sub-byte and 16-bit depths) is handed to picoPNG above.
+ */
+namespace {
+
+// returned by decode_fast for images it does not handle
+const int kFallback = -1;
+
+// returned by the streaming inflater when its output window is full
+const int kSuspend = -2;
+
+const int kFastBits = 10;
+const int kFastMask = (1 << kFastBits) - 1;
+
+const unsigned short kLengthBase[29] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+const unsigned char kLengthExtra[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+const unsigned short kDistBase[30] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+const unsigned char kDistExtra[30] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+  7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+const unsigned char kCodeLengthOrder[19] = {
+  16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+inline uint32_t read32(const unsigned char* p) {
+  return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+         ((uint32_t) p[2] <<  8) |  (uint32_t) p[3];
+}
+
+inline uint64_t load64le(const unsigned char* p) {
+  return  (uint64_t) p[0]        | ((uint64_t) p[1] <<  8) |
+         ((uint64_t) p[2] << 16) | ((uint64_t) p[3] << 24) |
+         ((uint64_t) p[4] << 32) | ((uint64_t) p[5] << 40) |
+         ((uint64_t) p[6] << 48) | ((uint64_t) p[7] << 56);
+}
+
+inline unsigned bit_reverse16(unsigned v) {
+  v = ((v & 0xAAAA) >> 1) | ((v & 0x5555) << 1);
+  v = ((v & 0xCCCC) >> 2) | ((v & 0x3333) << 2);
+  v = ((v & 0xF0F0) >> 4) | ((v & 0x0F0F) << 4);
+  v = ((v & 0xFF00) >> 8) | ((v & 0x00FF) << 8);
+  return v;
+}
+
+// canonical Huffman decoding table
+struct Huffman {
+
+  // (length << 9) | symbol for codes of at most kFastBits bits, 0 if longer
+  unsigned short fast[1 << kFastBits];
+
+  // canonical code ranges per length, used for codes longer than kFastBits
+  unsigned short firstcode[16];
+  unsigned short firstsymbol[16];
+  int maxcode[17];
+  unsigned char  size[288];
+  unsigned short value[288];
+
+  bool build(const unsigned char* lengths, int num) {
+
+    int count[17] = { 0 };
+    int next_code[16];
+
+    memset(fast, 0, sizeof(fast));
+    for (int i = 0; i < num; i++) count[lengths[i]]++;
+    count[0] = 0;
+
+    int code = 0, k = 0;
+    for (int i = 1; i < 16; i++) {
+      next_code[i]   = code;
+      firstcode[i]   = (unsigned short) code;
+      firstsymbol[i] = (unsigned short) k;
+      code += count[i];
+      if (count[i] && code - 1 >= (1 << i)) return false; // over-subscribed
+      maxcode[i] = code << (16 - i);
+      code <<= 1;
+      k += count[i];
     }
+    maxcode[16] = 0x10000;
+
+    for (int i = 0; i < num; i++) {
+      int s = lengths[i];
+      if (!s) continue;
+      int c = next_code[s] - firstcode[s] + firstsymbol[s];
+      size[c]  = (unsigned char) s;
+      value[c] = (unsigned short) i;
+      if (s <= kFastBits) {
+        unsigned short entry = (unsigned short) ((s << 9) | i);
+        int j = bit_reverse16(next_code[s]) >> (16 - s);
+        for (; j < (1 << kFastBits); j += (1 << s)) fast[j] = entry;
+      }
+      next_code[s]++;
+    }
+
+    return true;
   }
+};
 
-  return decoder.error;
+struct Inflater {
+
+  const unsigned char* in;
+  const unsigned char* in_end;
+  uint64_t bits;    // bit buffer, least significant bit is next
+  int count;        // number of valid bits in the buffer
+  size_t overread;  // zero bytes fed past the end of the input
+
+  unsigned char* out;
+  unsigned char* out_begin;
+  unsigned char* out_end;
+
+  Huffman lit, dist;
+
+  // streaming state, see begin() and resume()
+  int block;         // 0 between blocks, 1 in a huffman block, 2 stored
+  unsigned stored;   // bytes left in the current stored block
+  bool last;         // the current block is the final one
+  bool done;         // the final block has ended
+
+  // Tops the bit buffer up to at least 56 bits. Away from the end of the
+  // input this is a single unaligned word load.
+  inline void refill() {
+    if (in_end - in >= 8) {
+      bits |= load64le(in) << count;
+      in += (63 - count) >> 3;
+      count |= 56;
+    } else {
+      while (count <= 56) {
+        uint64_t b = 0;
+        if (in < in_end) b = *in++; else overread++;
+        bits |= b << count;
+        count += 8;
+      }
+    }
+  }
+
+  inline unsigned getbits(int n) {
+    if (count < n) refill();
+    unsigned v = (unsigned) (bits & ((1u << n) - 1));
+    bits >>= n; count -= n;
+    return v;
+  }
+
+  inline int decode(const Huffman& h) {
+    if (count < 16) refill();
+    int b = h.fast[bits & kFastMask];
+    if (b) {
+      int s = b >> 9;
+      bits >>= s; count -= s;
+      return b & 511;
+    }
+    int k = bit_reverse16((unsigned) (bits & 0xffff));
+    int s = kFastBits + 1;
+    while (k >= h.maxcode[s]) s++;
+    if (s >= 16) return -1;
+    int c = (k >> (16 - s)) - h.firstcode[s] + h.firstsymbol[s];
+    if (c >= 288 || h.size[c] != s) return -1;
+    bits >>= s; count -= s;
+    return h.value[c];
+  }
+
+  int inflate_stored() {
+
+    // skip to the byte boundary
+    int drop = count & 7;
+    bits >>= drop; count -= drop;
+
+    unsigned len  = getbits(16);
+    unsigned nlen = getbits(16);
+    if ((len ^ 0xffff) != nlen) return 21;
+    if (len > (size_t) (out_end - out)) return 91;
+
+    // drain whole bytes still in the bit buffer
+    while (len && count >= 8) {
+      *out++ = (unsigned char) bits;
+      bits >>= 8; count -= 8; len--;
+    }
+
+    if (len) {
+      if (len > (size_t) (in_end - in)) return 23;
+      memcpy(out, in, len);
+      out += len; in += len;
+      bits = 0;
+    }
+
+    return 0;
+  }
+
+  // Streaming stops between symbols while a longest match still fits
+  // into the window, and resumes there.
+  template <bool kStream>
+  int inflate_huffman() {
+    for (;;) {
+
+      if (kStream && out_end - out < 258) return kSuspend;
+
+      int sym = decode(lit);
+      if (sym < 256) {
+        if (sym < 0) return 16;
+        if (out == out_end) return 91;
+        *out++ = (unsigned char) sym;
+        continue;
+      }
+      if (sym == 256) return 0;
+
+      sym -= 257;
+      if (sym >= 29) return 16;
+      if (count < 32) refill();
+      size_t len = kLengthBase[sym] + getbits(kLengthExtra[sym]);
+
+      int ds = decode(dist);
+      if (ds < 0 || ds >= 30) return 18;
+      size_t d = kDistBase[ds] + getbits(kDistExtra[ds]);
+
+      if (d > (size_t) (out - out_begin)) return 52;
+      if (len > (size_t) (out_end - out)) return 91;
+
+      // the output buffer has 8 bytes of slack past out_end, so long
+      // copies may overshoot by up to a word
+      const unsigned char* src = out - d;
+      if (d >= 8) {
+        for (size_t i = 0; i < len; i += 8) memcpy(out + i, src + i, 8);
+      } else if (d == 1) {
+        memset(out, *src, len);
+      } else {
+        for (size_t i = 0; i < len; i++) out[i] = src[i];
+      }
+      out += len;
+    }
+  }
+
+  int build_dynamic() {
+
+    unsigned hlit  = getbits(5) + 257;
+    unsigned hdist = getbits(5) + 1;
+    unsigned hclen = getbits(4) + 4;
+
+    unsigned char cl_lengths[19] = { 0 };
+    for (unsigned i = 0; i < hclen; i++) {
+      cl_lengths[kCodeLengthOrder[i]] = (unsigned char) getbits(3);
+    }
+
+    Huffman cl;
+    if (!cl.build(cl_lengths, 19)) return 16;
+
+    unsigned char lengths[288 + 32];
+    unsigned n = 0;
+    while (n < hlit + hdist) {
+      int c = decode(cl);
+      if (c < 0 || c >= 19) return 16;
+      if (c < 16) { lengths[n++] = (unsigned char) c; continue; }
+
+      unsigned char fill = 0; unsigned rep;
+      if (c == 16) {
+        if (n == 0) return 54;
+        fill = lengths[n - 1];
+        rep = getbits(2) + 3;
+      } else if (c == 17) {
+        rep = getbits(3) + 3;
+      } else {
+        rep = getbits(7) + 11;
+      }
+      if (n + rep > hlit + hdist) return 13;
+      memset(lengths + n, fill, rep);
+      n += rep;
+    }
+
+    if (lengths[256] == 0) return 64;
+    if (!lit.build(lengths, hlit))          return 16;
+    if (!dist.build(lengths + hlit, hdist)) return 16;
+    return 0;
+  }
+
+  void build_fixed() {
+    unsigned char lengths[288 + 32];
+    memset(lengths +   0, 8, 144);
+    memset(lengths + 144, 9, 112);
+    memset(lengths + 256, 7,  24);
+    memset(lengths + 280, 8,   8);
+    memset(lengths + 288, 5,  32);
+    lit.build(lengths, 288);
+    dist.build(lengths + 288, 32);
+  }
+
+  // inflates a zlib stream into [dst, dst + size), which must be followed
+  // by 8 bytes of slack. The decompressed size must match exactly.
+  int inflate(const unsigned char* src, size_t src_size,
+              unsigned char* dst, size_t size) {
+
+    if (src_size < 2) return 53;
+    if ((src[0] * 256 + src[1]) % 31 != 0) return 24;
+    if ((src[0] & 15) != 8 || (src[0] >> 4) > 7) return 25;
+    if (src[1] & 32) return 26;
+
+    in = src + 2; in_end = src + src_size;
+    bits = 0; count = 0; overread = 0;
+    out = out_begin = dst; out_end = dst + size;
+
+    unsigned final = 0;
+    while (!final) {
+      final = getbits(1);
+      int error = 0;
+      switch (getbits(2)) {
+        case 0: error = inflate_stored(); break;
+        case 1: build_fixed(); error = inflate_huffman<false>(); break;
+        case 2:
+          error = build_dynamic();
+          if (!error) error = inflate_huffman<false>();
+          break;
+        default: return 20;
+      }
+      if (error) return error;
+      if (overread * 8 > (size_t) count) return 10; // ran past the input
+    }
+
+    // note: the adler32 checksum is skipped, as in picoPNG
+    return out == out_end ? 0 : 91;
+  }
+
+  // Starts inflating a zlib stream a window at a time. The caller sets
+  // out, out_begin and out_end before each resume(), keeping at least
+  // the last 32KB of output before out, and 8 bytes of slack past out_end.
+  int begin(const unsigned char* src, size_t src_size) {
+
+    if (src_size < 2) return 53;
+    if ((src[0] * 256 + src[1]) % 31 != 0) return 24;
+    if ((src[0] & 15) != 8 || (src[0] >> 4) > 7) return 25;
+    if (src[1] & 32) return 26;
+
+    in = src + 2; in_end = src + src_size;
+    bits = 0; count = 0; overread = 0;
+    block = 0; stored = 0; last = false; done = false;
+    return 0;
+  }
+
+  // Inflates until the window is full (kSuspend) or the stream ends (0).
+  int resume() {
+    for (;;) {
+
+      if (block == 0) {
+        if (done) return 0;
+        last = getbits(1) != 0;
+        switch (getbits(2)) {
+          case 0: {
+            int drop = count & 7;
+            bits >>= drop; count -= drop;
+            unsigned len  = getbits(16);
+            unsigned nlen = getbits(16);
+            if ((len ^ 0xffff) != nlen) return 21;
+            stored = len; block = 2;
+            break;
+          }
+          case 1: build_fixed(); block = 1; break;
+          case 2: {
+            int error = build_dynamic();
+            if (error) return error;
+            block = 1;
+            break;
+          }
+          default: return 20;
+        }
+      }
+
+      if (block == 1) {
+        int error = inflate_huffman<true>();
+        if (error) return error;
+      } else {
+        while (stored && count >= 8 && out < out_end) {
+          *out++ = (unsigned char) bits;
+          bits >>= 8; count -= 8; stored--;
+        }
+        size_t n = min((size_t) stored, (size_t) (out_end - out));
+        if (n && count < 8) {
+          if (n > (size_t) (in_end - in)) return 23;
+          memcpy(out, in, n);
+          out += n; in += n; stored -= n;
+          bits = 0; count = 0;
+        }
+        if (stored) return kSuspend;
+      }
+
+      if (overread * 8 > (size_t) count) return 10;
+      block = 0;
+      done = last;
+    }
+  }
+};
+
+// byte-wise addition of packed words without carries between lanes
+inline uint32_t add_bytes(uint32_t a, uint32_t b) {
+  return ((a & 0x7f7f7f7fu) + (b & 0x7f7f7f7fu)) ^ ((a ^ b) & 0x80808080u);
+}
+
+inline uint64_t add_bytes(uint64_t a, uint64_t b) {
+  const uint64_t lo = 0x7f7f7f7f7f7f7f7full, hi = 0x8080808080808080ull;
+  return ((a & lo) + (b & lo)) ^ ((a ^ b) & hi);
+}
+
+// branch-free form of the Paeth predictor, filtered images are noisy
+// enough that the textbook version mispredicts constantly
+inline unsigned char paeth(int a, int b, int c) {
+  int pa = abs(b - c), pb = abs(a - c), pc = abs(a + b - 2 * c);
+  int p  = pb < pa ? b : a;
+  int pm = pb < pa ? pb : pa;
+  return (unsigned char) (pc < pm ? c : p);
+}
+
+// Average and Paeth depend on the previous pixel; a compile-time pixel
+// size lets the channels of one pixel be computed independently.
+template <size_t bpp>
+void unfilter_average(unsigned char* dst, const unsigned char* src,
+                      const unsigned char* prev, size_t length) {
+  size_t i = 0;
+  for (; i < bpp; i++) dst[i] = src[i] + (prev[i] >> 1);
+  for (; i < length; i += bpp) {
+    for (size_t c = 0; c < bpp; c++) {
+      dst[i + c] = src[i + c] + ((dst[i + c - bpp] + prev[i + c]) >> 1);
+    }
+  }
+}
+
+template <size_t bpp>
+void unfilter_paeth(unsigned char* dst, const unsigned char* src,
+                    const unsigned char* prev, size_t length) {
+  size_t i = 0;
+  for (; i < bpp; i++) dst[i] = src[i] + prev[i];
+  for (; i < length; i += bpp) {
+    for (size_t c = 0; c < bpp; c++) {
+      dst[i + c] = src[i + c] + paeth(dst[i + c - bpp], prev[i + c],
+                                      prev[i + c - bpp]);
+    }
+  }
+}
+
+// undoes one scanline filter, prev is a zero row for the first line
+int unfilter(unsigned char* dst, const unsigned char* src,
+             const unsigned char* prev, size_t bpp, size_t length,
+             unsigned char type) {
+
+  size_t i = 0;
+  switch (type) {
+    case 0:
+      memcpy(dst, src, length);
+      break;
+    case 1:
+      memcpy(dst, src, bpp);
+      if (bpp == 4) {
+        uint32_t left; memcpy(&left, dst, 4);
+        for (i = 4; i < length; i += 4) {
+          uint32_t cur; memcpy(&cur, src + i, 4);
+          left = add_bytes(cur, left);
+          memcpy(dst + i, &left, 4);
+        }
+      } else {
+        for (i = bpp; i < length; i++) dst[i] = src[i] + dst[i - bpp];
+      }
+      break;
+    case 2:
+      for (; i + 8 <= length; i += 8) {
+        uint64_t a, b;
+        memcpy(&a, src + i, 8); memcpy(&b, prev + i, 8);
+        a = add_bytes(a, b);
+        memcpy(dst + i, &a, 8);
+      }
+      for (; i < length; i++) dst[i] = src[i] + prev[i];
+      break;
+    case 3:
+      switch (bpp) {
+        case 1: unfilter_average<1>(dst, src, prev, length); break;
+        case 2: unfilter_average<2>(dst, src, prev, length); break;
+        case 3: unfilter_average<3>(dst, src, prev, length); break;
+        case 4: unfilter_average<4>(dst, src, prev, length); break;
+      }
+      break;
+    case 4:
+      switch (bpp) {
+        case 1: unfilter_paeth<1>(dst, src, prev, length); break;
+        case 2: unfilter_paeth<2>(dst, src, prev, length); break;
+        case 3: unfilter_paeth<3>(dst, src, prev, length); break;
+        case 4: unfilter_paeth<4>(dst, src, prev, length); break;
+      }
+      break;
+    default:
+      return 36;
+  }
+  return 0;
 }
 
-int PNGParser::load(const char* filename, PNG& png) {
+// header, palette and image data of a png, see parse_png
+struct PNGInfo {
+  uint32_t width, height;
+  unsigned type;
+  size_t channels;
+  unsigned char palette[4 * 256];
+  size_t palette_size;
+  bool key_defined;
+  unsigned key[3];
+  std::vector<const unsigned char*> idat_ptr;
+  std::vector<size_t> idat_len;
+};
+
+// Reads the chunks of a png the fast path handles, kFallback otherwise.
+int parse_png(const unsigned char* in, size_t size, PNGInfo& info) {
+
+  static const unsigned char signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+
+  if (size == 0 || in == 0) return 48;
+  if (size < 33) return 27;
+  if (memcmp(in, signature, 8)) return 28;
+  if (memcmp(in + 12, "IHDR", 4)) return 29;
+
+  uint32_t w = read32(in + 16), h = read32(in + 20);
+  unsigned depth = in[24], type = in[25];
+  if (in[26] != 0) return 32;
+  if (in[27] != 0) return 33;
+  if (in[28] > 1)  return 34;
+
+  // only non-interlaced 8-bit images take the fast path
+  if (in[28] != 0 || depth != 8) return kFallback;
+
+  size_t channels;
+  switch (type) {
+    case 0: channels = 1; break;
+    case 2: channels = 3; break;
+    case 3: channels = 1; break;
+    case 4: channels = 2; break;
+    case 6: channels = 4; break;
+    default: return 31;
+  }
+
+  info.width = w; info.height = h;
+  info.type = type; info.channels = channels;
+  info.palette_size = 0;
+  info.key_defined = false;
+  info.key[0] = info.key[1] = info.key[2] = 0;
+  info.idat_ptr.clear();
+  info.idat_len.clear();
+
+  // walk the chunks, collecting idat
+  unsigned char* palette = info.palette;
+  size_t& palette_size = info.palette_size;
+  unsigned* key = info.key;
+
+  size_t pos = 33;
+  for (;;) {
+    if (pos + 8 >= size) return 30;
+    size_t length = read32(in + pos); pos += 4;
+    if (length > 2147483647) return 63;
+    if (pos + length >= size) return 35;
+    const unsigned char* name = in + pos;
+    const unsigned char* data = in + pos + 4;
+
+    if (!memcmp(name, "IDAT", 4)) {
+      info.idat_ptr.push_back(data);
+      info.idat_len.push_back(length);
+    } else if (!memcmp(name, "IEND", 4)) {
+      break;
+    } else if (!memcmp(name, "PLTE", 4)) {
+      palette_size = length / 3;
+      if (palette_size > 256) return 38;
+      for (size_t i = 0; i < palette_size; i++) {
+        palette[4 * i + 0] = data[3 * i + 0];
+        palette[4 * i + 1] = data[3 * i + 1];
+        palette[4 * i + 2] = data[3 * i + 2];
+        palette[4 * i + 3] = 255;
+      }
+    } else if (!memcmp(name, "tRNS", 4)) {
+      if (type == 3) {
+        if (length > palette_size) return 39;
+        for (size_t i = 0; i < length; i++) palette[4 * i + 3] = data[i];
+      } else if (type == 0) {
+        if (length != 2) return 40;
+        info.key_defined = true;
+        key[0] = key[1] = key[2] = 256 * data[0] + data[1];
+      } else if (type == 2) {
+        if (length != 6) return 41;
+        info.key_defined = true;
+        key[0] = 256 * data[0] + data[1];
+        key[1] = 256 * data[2] + data[3];
+        key[2] = 256 * data[4] + data[5];
+      } else {
+        return 42;
+      }
+    } else if (!(name[0] & 32)) {
+      return 69; // unknown critical chunk
+    }
+    pos += 4 + length + 4; // name, data and crc (which is ignored)
+  }
+
+  return 0;
+}
+
+// concatenates the idat chunks unless there is just one
+void zlib_stream(const PNGInfo& info, std::vector<unsigned char>& idat,
+                 const unsigned char*& zdata, size_t& zsize) {
+  zdata = info.idat_ptr.empty() ? 0 : info.idat_ptr[0];
+  zsize = info.idat_ptr.empty() ? 0 : info.idat_len[0];
+  if (info.idat_ptr.size() > 1) {
+    for (size_t i = 0; i < info.idat_ptr.size(); i++) {
+      idat.insert(idat.end(), info.idat_ptr[i], info.idat_ptr[i] + info.idat_len[i]);
+    }
+    zdata = idat.data(); zsize = idat.size();
+  }
+}
+
+// converts n unfiltered pixels to rgba, rgba images are converted in place
+int to_rgba(const PNGInfo& info, const unsigned char* image,
+            unsigned char* out, size_t n) {
+
+  const unsigned* key = info.key;
+  switch (info.type) {
+    case 0:
+      for (size_t i = 0; i < n; i++) {
+        out[4 * i + 0] = out[4 * i + 1] = out[4 * i + 2] = image[i];
+        out[4 * i + 3] = (info.key_defined && image[i] == key[0]) ? 0 : 255;
+      }
+      break;
+    case 2:
+      for (size_t i = 0; i < n; i++) {
+        const unsigned char* p = image + 3 * i;
+        out[4 * i + 0] = p[0];
+        out[4 * i + 1] = p[1];
+        out[4 * i + 2] = p[2];
+        out[4 * i + 3] = (info.key_defined && p[0] == key[0] &&
+                          p[1] == key[1] && p[2] == key[2]) ? 0 : 255;
+      }
+      break;
+    case 3:
+      for (size_t i = 0; i < n; i++) {
+        if (image[i] >= info.palette_size) return 46;
+        memcpy(out + 4 * i, info.palette + 4 * image[i], 4);
+      }
+      break;
+    case 4:
+      for (size_t i = 0; i < n; i++) {
+        out[4 * i + 0] = out[4 * i + 1] = out[4 * i + 2] = image[2 * i];
+        out[4 * i + 3] = image[2 * i + 1];
+      }
+      break;
+    default:
+      break;
+  }
+  return 0;
+}
+
+// premultiplying by binary alpha clears transparent pixels
+inline void clear_transparent(unsigned char* pixels, size_t n) {
+  for (size_t i = 0; i < 4 * n; i += 4) {
+    if (!pixels[i + 3]) pixels[i] = pixels[i + 1] = pixels[i + 2] = 0;
+  }
+}
+
+int decode_fast(const unsigned char* in, size_t size, PNG& png) {
+
+  PNGInfo info;
+  int error = parse_png(in, size, info);
+  if (error) return error;
+
+  uint32_t w = info.width, h = info.height;
+  size_t channels = info.channels;
+
+  // a single idat chunk is inflated in place
+  std::vector<unsigned char> idat;
+  const unsigned char* zdata; size_t zsize;
+  zlib_stream(info, idat, zdata, zsize);
+
+  size_t stride = (size_t) w * channels;
+  std::vector<unsigned char> scanlines((stride + 1) * h + 8);
+  Inflater* inflater = new Inflater();
+  error = inflater->inflate(zdata, zsize, scanlines.data(), (stride + 1) * h);
+  delete inflater;
+  if (error) return error;
+
+  // unfilter, straight into the output for rgba images
+  png.width  = w;
+  png.height = h;
+  png.pixels.resize(4 * (size_t) w * h);
+
+  std::vector<unsigned char> raw;
+  unsigned char* image = png.pixels.data();
+  if (info.type != 6) {
+    raw.resize(stride * h);
+    image = raw.data();
+  }
+
+  std::vector<unsigned char> zero(stride, 0);
+  const unsigned char* prev = zero.data();
+  for (size_t y = 0; y < h; y++) {
+    const unsigned char* line = &scanlines[y * (stride + 1)];
+    unsigned char* dst = image + y * stride;
+    error = unfilter(dst, line + 1, prev, channels, stride, line[0]);
+    if (error) return error;
+    prev = dst;
+  }
+
+  // convert to rgba
+  return to_rgba(info, image, png.pixels.data(), (size_t) w * h);
+}
+
+} // namespace
+
+int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png,
+                    PNGDecoder decoder) {
+
+  int error = kFallback;
+  if (decoder == PNG_DECODER_FAST) {
+    error = decode_fast(buffer, size, png);
+  }
+  if (error == kFallback) {
+    error = decode_picopng(buffer, size, png);
+  }
+
+  // premultiply by alpha
+  clear_transparent(png.pixels.data(), png.pixels.size() / 4);
+
+  return error;
+}
+
+int PNGParser::load(const char* filename, PNG& png, PNGDecoder decoder) {
 
   std::ifstream file(filename, std::ios::in|std::ios::binary|std::ios::ate);
 
@@ -550,14 +1279,825 @@ int PNGParser::load(const char* filename, PNG& png) {
   }
 
   // parse to png
-  return load(&buffer[0], size, png);
+  return load(&buffer[0], size, png, decoder);
+
+}
 
+struct PNGRowReader::State {
+  PNGInfo info;
+  std::vector<unsigned char> idat;
+  Inflater inflater;
+  size_t stride;
+  uint32_t row;                        // next row
+  std::vector<unsigned char> window;   // inflated scanlines and history
+  size_t consumed;                     // start of the next scanline
+  std::vector<unsigned char> prev, cur;
+};
+
+PNGRowReader::PNGRowReader() : state ( NULL ) { }
+
+PNGRowReader::~PNGRowReader() {
+  delete state;
 }
 
-int PNGParser::save(const char *filename, const PNG& png) {
+int PNGRowReader::open(const unsigned char* buffer, size_t size) {
+
+  delete state;
+  state = new State();
+
+  int error = parse_png(buffer, size, state->info);
+  if (!error) {
+    const unsigned char* zdata; size_t zsize;
+    zlib_stream(state->info, state->idat, zdata, zsize);
+    error = state->inflater.begin(zdata, zsize);
+  }
+  if (error) {
+    delete state; state = NULL;
+    return error;
+  }
+
+  // room for the 32KB history, a few scanlines and the inflate slack
+  State& st = *state;
+  st.stride = (size_t) st.info.width * st.info.channels;
+  st.row = 0;
+  st.window.resize(32768 + 4 * (st.stride + 1) + 65536 + 8);
+  st.consumed = 0;
+  st.prev.assign(st.stride, 0);
+  st.cur.resize(st.stride);
+
+  Inflater& z = st.inflater;
+  z.out = z.out_begin = st.window.data();
+  z.out_end = st.window.data() + st.window.size() - 8;
   return 0;
 }
 
+int PNGRowReader::width() const {
+  return state ? state->info.width : 0;
+}
+
+int PNGRowReader::height() const {
+  return state ? state->info.height : 0;
+}
 
-} // namespace CMU462
+int PNGRowReader::read_row(unsigned char* rgba) {
+
+  if (!state || state->row >= state->info.height) return -1;
+  State& st = *state;
+  Inflater& z = st.inflater;
+  unsigned char* window = st.window.data();
+
+  // inflate until the window holds a whole scanline
+  while ((size_t) (z.out - window) < st.consumed + st.stride + 1) {
+
+    // slide the history and the partial scanline to the front
+    if (z.out_end - z.out < 258 + (ptrdiff_t) st.stride) {
+      size_t keep = min(st.consumed, (size_t) max((ptrdiff_t) 0, (z.out - window) - 32768));
+      memmove(window, window + keep, (z.out - window) - keep);
+      z.out -= keep;
+      st.consumed -= keep;
+    }
+
+    int error = z.resume();
+    if (error == 0 && (size_t) (z.out - window) < st.consumed + st.stride + 1) {
+      return 91; // stream ended early
+    }
+    if (error && error != kSuspend) return error;
+  }
+
+  const unsigned char* line = window + st.consumed;
+  int error = unfilter(st.cur.data(), line + 1, st.prev.data(),
+                       st.info.channels, st.stride, line[0]);
+  if (error) return error;
+  st.consumed += st.stride + 1;
+  st.row++;
+  st.prev.swap(st.cur);
+
+  if (st.info.type == 6) {
+    memcpy(rgba, st.prev.data(), st.stride);
+  } else {
+    error = to_rgba(st.info, st.prev.data(), rgba, st.info.width);
+    if (error) return error;
+  }
+  clear_transparent(rgba, st.info.width);
+  return 0;
+}
+
+/* NOTE:
+ * The encoder always writes 8-bit RGBA. Each scanline picks the filter
+ * with the smallest sum of absolute (signed) residuals, and the filtered
+ * image is deflated in independent bands of rows in parallel. A band may
+ * still reference the 32K of data before it, since the decoder has that
+ * output by then. Every band but the last ends with an empty stored
+ * block, which byte-aligns it so the bands can simply be concatenated
+ * into one zlib stream.
+ */
+namespace {
+
+// rows are grouped into bands of roughly this many filtered bytes
+const size_t kBandBytes = 256 * 1024;
+
+// tokens per deflate block within a band
+const size_t kBlockTokens = 1 << 16;
+
+const size_t kWindowSize = 32768;
+const int kHashBits = 15;
+
+struct LevelParams {
+  int max_chain; // hash chain entries searched per position
+  int nice;      // stop searching at a match this long
+  bool lazy;     // try a match at the next position before committing
+};
+
+const LevelParams kLevels[10] = {
+  {    0,   0, false }, // stored
+  {    4,   8, false },
+  {    8,  16, false },
+  {   16,  32, false },
+  {   16,  32, true  },
+  {   32,  64, true  },
+  {  128, 128, true  },
+  {  256, 128, true  },
+  { 1024, 258, true  },
+  { 4096, 258, true  }
+};
+
+// length and distance symbol lookup
+struct DeflateTables {
+
+  unsigned char length_sym[259];
+  unsigned char dist_sym[kWindowSize + 1];
+
+  DeflateTables() {
+    for (int s = 0; s < 29; s++) {
+      int end = s == 28 ? 259 : kLengthBase[s] + (1 << kLengthExtra[s]);
+      for (int l = kLengthBase[s]; l < end && l < 259; l++) {
+        length_sym[l] = (unsigned char) s;
+      }
+    }
+    length_sym[258] = 28;
+    for (int s = 0; s < 30; s++) {
+      int end = kDistBase[s] + (1 << kDistExtra[s]);
+      for (int d = kDistBase[s]; d < end && d <= (int) kWindowSize; d++) {
+        dist_sym[d] = (unsigned char) s;
+      }
+    }
+  }
+};
+
+const DeflateTables& deflate_tables() {
+  static const DeflateTables tables;
+  return tables;
+}
+
+struct CRCTable {
+
+  uint32_t entry[256];
+
+  CRCTable() {
+    for (uint32_t n = 0; n < 256; n++) {
+      uint32_t c = n;
+      for (int k = 0; k < 8; k++) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      entry[n] = c;
+    }
+  }
+};
+
+uint32_t crc32(uint32_t crc, const unsigned char* data, size_t size) {
+  static const CRCTable table;
+  crc = ~crc;
+  for (size_t i = 0; i < size; i++) {
+    crc = table.entry[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+// continues from adler, which starts at 1
+uint32_t adler32(uint32_t adler, const unsigned char* data, size_t size) {
+  uint32_t a = adler & 0xffff, b = adler >> 16;
+  while (size) {
+    size_t n = size < 5552 ? size : 5552;
+    for (size_t i = 0; i < n; i++) { a += data[i]; b += a; }
+    a %= 65521; b %= 65521;
+    data += n; size -= n;
+  }
+  return (b << 16) | a;
+}
+
+inline void write32(std::vector<unsigned char>& out, uint32_t v) {
+  out.push_back((unsigned char) (v >> 24));
+  out.push_back((unsigned char) (v >> 16));
+  out.push_back((unsigned char) (v >>  8));
+  out.push_back((unsigned char) (v      ));
+}
+
+struct BitWriter {
+
+  std::vector<unsigned char>& out;
+  uint64_t bits;
+  int count;
+
+  BitWriter( std::vector<unsigned char>& out ) : out(out), bits(0), count(0) { }
+
+  inline void put(uint32_t v, int n) {
+    bits |= (uint64_t) v << count;
+    count += n;
+    while (count >= 8) {
+      out.push_back((unsigned char) bits);
+      bits >>= 8; count -= 8;
+    }
+  }
+
+  inline void align() {
+    if (count) put(0, 8 - count);
+  }
+};
+
+// Computes code lengths limited to maxbits for the given frequencies.
+// Any code with a single used symbol gets a second, unused one so that
+// the code stays complete.
+void huffman_lengths(const uint32_t* freq, int n, int maxbits,
+                     unsigned char* lengths) {
+
+  memset(lengths, 0, n);
+
+  std::vector<std::pair<uint32_t, int> > syms;
+  for (int i = 0; i < n; i++) {
+    if (freq[i]) syms.push_back(std::make_pair(freq[i], i));
+  }
+  if (syms.empty()) return;
+  if (syms.size() == 1) {
+    lengths[syms[0].second] = 1;
+    lengths[syms[0].second ? 0 : 1] = 1;
+    return;
+  }
+  std::sort(syms.begin(), syms.end());
+
+  // two-queue Huffman construction over the sorted leaves
+  size_t m = syms.size();
+  std::vector<uint64_t> weight(2 * m - 1);
+  std::vector<int> parent(2 * m - 1, 0);
+  for (size_t i = 0; i < m; i++) weight[i] = syms[i].first;
+
+  size_t leaf = 0, node = m;
+  for (size_t k = m; k < 2 * m - 1; k++) {
+    size_t pick[2];
+    for (int j = 0; j < 2; j++) {
+      if (leaf < m && (node >= k || weight[leaf] <= weight[node])) {
+        pick[j] = leaf++;
+      } else {
+        pick[j] = node++;
+      }
+    }
+    weight[k] = weight[pick[0]] + weight[pick[1]];
+    parent[pick[0]] = parent[pick[1]] = (int) k;
+  }
+
+  // leaf depths, counted per length
+  std::vector<int> depth(2 * m - 1, 0);
+  int count[64] = { 0 };
+  for (int k = (int) (2 * m - 3); k >= 0; k--) {
+    depth[k] = depth[parent[k]] + 1;
+    if (k < (int) m) count[depth[k] < 63 ? depth[k] : 63]++;
+  }
+
+  // fold overlong codes into maxbits and restore the Kraft sum
+  for (int i = maxbits + 1; i < 64; i++) {
+    count[maxbits] += count[i];
+    count[i] = 0;
+  }
+  uint32_t total = 0;
+  for (int i = 1; i <= maxbits; i++) total += count[i] << (maxbits - i);
+  while (total != (1u << maxbits)) {
+    count[maxbits]--;
+    for (int i = maxbits - 1; i > 0; i--) {
+      if (count[i]) { count[i]--; count[i + 1] += 2; break; }
+    }
+    total--;
+  }
+
+  // rarest symbols get the longest codes
+  size_t s = 0;
+  for (int len = maxbits; len > 0; len--) {
+    for (int c = 0; c < count[len]; c++) {
+      lengths[syms[s++].second] = (unsigned char) len;
+    }
+  }
+}
+
+// canonical codes, bit-reversed for lsb-first output
+void huffman_codes(const unsigned char* lengths, int n, unsigned short* codes) {
+  int count[16] = { 0 };
+  int next[16];
+  for (int i = 0; i < n; i++) count[lengths[i]]++;
+  count[0] = 0;
+  int code = 0;
+  for (int i = 1; i < 16; i++) {
+    code = (code + count[i - 1]) << 1;
+    next[i] = code;
+  }
+  for (int i = 0; i < n; i++) {
+    int len = lengths[i];
+    if (!len) continue;
+    codes[i] = (unsigned short) (bit_reverse16(next[len]++) >> (16 - len));
+  }
+}
+
+// A token is a literal byte, or (length << 16) | distance for a match.
+inline uint32_t match_token(size_t len, size_t dist) {
+  return (uint32_t) ((len << 16) | dist);
+}
+
+// Finds matches for data[start, end). Positions back to start - 32K are
+// only used as history.
+void lz77(const unsigned char* data, size_t start, size_t end,
+          const LevelParams& params, std::vector<uint32_t>& tokens) {
+
+  size_t lo = start > kWindowSize ? start - kWindowSize : 0;
+  std::vector<int> head(1 << kHashBits, -1);
+  std::vector<int> prev(end - lo);
+
+  #define HASH(i) ((((uint32_t) data[i] << 16) | ((uint32_t) data[(i) + 1] << 8) | \
+                    data[(i) + 2]) * 2654435761u >> (32 - kHashBits))
+  #define INSERT(i) { uint32_t h = HASH(i); prev[(i) - lo] = head[h]; head[h] = (int) (i); }
+
+  for (size_t i = lo; i < start && i + 3 <= end; i++) INSERT(i);
+
+  size_t i = start;
+  size_t pending_len = 0, pending_dist = 0;
+  while (i < end) {
+
+    size_t best_len = 0, best_dist = 0;
+    if (i + 3 <= end) {
+      size_t max_len = end - i < 258 ? end - i : 258;
+      int chain = params.max_chain;
+      int cand = head[HASH(i)];
+      INSERT(i);
+      size_t min_len = pending_len > 2 ? pending_len : 2;
+      if (min_len >= max_len) chain = 0;
+      while (cand >= 0 && i - cand <= kWindowSize && chain--) {
+        const unsigned char* a = data + cand;
+        const unsigned char* b = data + i;
+        if (a[min_len] == b[min_len] && a[0] == b[0]) {
+          size_t len = 1;
+          while (len < max_len && a[len] == b[len]) len++;
+          if (len > min_len) {
+            best_len = min_len = len; best_dist = i - cand;
+            if (len >= (size_t) params.nice || len == max_len) break;
+          }
+        }
+        cand = prev[cand - lo];
+      }
+      if (best_len < 3) best_len = 0;
+    }
+
+    if (pending_len) {
+      if (best_len > pending_len) {
+        // the match one byte later is longer, the previous byte becomes a literal
+        tokens.push_back(data[i - 1]);
+      } else {
+        tokens.push_back(match_token(pending_len, pending_dist));
+        for (size_t k = i + 1; k < i - 1 + pending_len; k++) {
+          if (k + 3 <= end) INSERT(k);
+        }
+        i = i - 1 + pending_len;
+        pending_len = 0;
+        continue;
+      }
+      pending_len = 0;
+    }
+
+    if (!best_len) {
+      tokens.push_back(data[i]);
+      i++;
+    } else if (params.lazy && best_len < (size_t) params.nice) {
+      pending_len = best_len; pending_dist = best_dist;
+      i++;
+    } else {
+      tokens.push_back(match_token(best_len, best_dist));
+      for (size_t k = i + 1; k < i + best_len; k++) {
+        if (k + 3 <= end) INSERT(k);
+      }
+      i += best_len;
+    }
+  }
+  if (pending_len) tokens.push_back(match_token(pending_len, pending_dist));
+
+  #undef INSERT
+  #undef HASH
+}
+
+void write_dynamic_block(BitWriter& bw, const uint32_t* tokens, size_t n,
+                         bool final) {
+
+  const DeflateTables& t = deflate_tables();
+
+  uint32_t lit_freq[286] = { 0 }, dist_freq[30] = { 0 };
+  for (size_t i = 0; i < n; i++) {
+    uint32_t len = tokens[i] >> 16;
+    if (!len) { lit_freq[tokens[i]]++; continue; }
+    lit_freq[257 + t.length_sym[len]]++;
+    dist_freq[t.dist_sym[tokens[i] & 0xffff]]++;
+  }
+  lit_freq[256] = 1;
+
+  unsigned char lit_len[286], dist_len[30];
+  huffman_lengths(lit_freq, 286, 15, lit_len);
+  huffman_lengths(dist_freq, 30, 15, dist_len);
+
+  unsigned short lit_code[286], dist_code[30];
+  huffman_codes(lit_len, 286, lit_code);
+  huffman_codes(dist_len, 30, dist_code);
 
+  int hlit = 286, hdist = 30;
+  while (hlit > 257 && !lit_len[hlit - 1]) hlit--;
+  while (hdist > 1 && !dist_len[hdist - 1]) hdist--;
+  unsigned char lengths[286 + 30];
+  memcpy(lengths, lit_len, hlit);
+  memcpy(lengths + hlit, dist_len, hdist);
+
+  // run-length encode the code lengths
+  std::vector<std::pair<int, int> > cl_syms; // symbol, extra bits value
+  uint32_t cl_freq[19] = { 0 };
+  int total = hlit + hdist;
+  for (int i = 0; i < total;) {
+    int len = lengths[i], run = 1;
+    while (i + run < total && lengths[i + run] == len) run++;
+    i += run;
+    if (len == 0) {
+      while (run >= 11) {
+        int r = run < 138 ? run : 138;
+        cl_syms.push_back(std::make_pair(18, r - 11)); run -= r;
+      }
+      if (run >= 3) {
+        cl_syms.push_back(std::make_pair(17, run - 3)); run = 0;
+      }
+    } else {
+      cl_syms.push_back(std::make_pair(len, 0)); run--;
+      while (run >= 3) {
+        int r = run < 6 ? run : 6;
+        cl_syms.push_back(std::make_pair(16, r - 3)); run -= r;
+      }
+    }
+    while (run--) cl_syms.push_back(std::make_pair(len, 0));
+  }
+  for (size_t i = 0; i < cl_syms.size(); i++) cl_freq[cl_syms[i].first]++;
+
+  unsigned char cl_len[19];
+  unsigned short cl_code[19];
+  huffman_lengths(cl_freq, 19, 7, cl_len);
+  huffman_codes(cl_len, 19, cl_code);
+  int hclen = 19;
+  while (hclen > 4 && !cl_len[kCodeLengthOrder[hclen - 1]]) hclen--;
+
+  // header
+  bw.put(final ? 1 : 0, 1);
+  bw.put(2, 2);
+  bw.put(hlit - 257, 5);
+  bw.put(hdist - 1, 5);
+  bw.put(hclen - 4, 4);
+  for (int i = 0; i < hclen; i++) bw.put(cl_len[kCodeLengthOrder[i]], 3);
+  for (size_t i = 0; i < cl_syms.size(); i++) {
+    int s = cl_syms[i].first;
+    bw.put(cl_code[s], cl_len[s]);
+    if (s == 16) bw.put(cl_syms[i].second, 2);
+    if (s == 17) bw.put(cl_syms[i].second, 3);
+    if (s == 18) bw.put(cl_syms[i].second, 7);
+  }
+
+  // data
+  for (size_t i = 0; i < n; i++) {
+    uint32_t len = tokens[i] >> 16;
+    if (!len) {
+      bw.put(lit_code[tokens[i]], lit_len[tokens[i]]);
+      continue;
+    }
+    uint32_t dist = tokens[i] & 0xffff;
+    int ls = t.length_sym[len], ds = t.dist_sym[dist];
+    bw.put(lit_code[257 + ls], lit_len[257 + ls]);
+    bw.put(len - kLengthBase[ls], kLengthExtra[ls]);
+    bw.put(dist_code[ds], dist_len[ds]);
+    bw.put(dist - kDistBase[ds], kDistExtra[ds]);
+  }
+  bw.put(lit_code[256], lit_len[256]);
+}
+
+// Deflates data[start, end) as a run of raw deflate blocks. The last band
+// sets BFINAL, every other band ends byte-aligned with an empty stored block.
+void deflate_band(const unsigned char* data, size_t start, size_t end,
+                  bool last, int level, std::vector<unsigned char>& out) {
+
+  BitWriter bw(out);
+
+  if (level == 0) {
+    size_t pos = start;
+    do {
+      size_t n = end - pos < 65535 ? end - pos : 65535;
+      bool final = last && pos + n == end;
+      bw.put(final ? 1 : 0, 1);
+      bw.put(0, 2);
+      bw.align();
+      bw.put((uint32_t) n, 16);
+      bw.put((uint32_t) n ^ 0xffff, 16);
+      out.insert(out.end(), data + pos, data + pos + n);
+      pos += n;
+    } while (pos < end);
+    if (last) return;
+  } else {
+    std::vector<uint32_t> tokens;
+    tokens.reserve(end - start);
+    lz77(data, start, end, kLevels[level], tokens);
+    for (size_t i = 0; i < tokens.size(); i += kBlockTokens) {
+      size_t n = tokens.size() - i < kBlockTokens ? tokens.size() - i : kBlockTokens;
+      write_dynamic_block(bw, &tokens[i], n, last && i + n == tokens.size());
+    }
+    if (last) { bw.align(); return; }
+  }
+
+  // sync: empty stored block
+  bw.put(0, 3);
+  bw.align();
+  bw.put(0x0000, 16);
+  bw.put(0xffff, 16);
+}
+
+inline size_t residual_cost(const unsigned char* row, size_t length) {
+  size_t sum = 0;
+  for (size_t i = 0; i < length; i++) sum += abs((int) (signed char) row[i]);
+  return sum;
+}
+
+// Filters one row of 4-byte pixels into dst (filter byte first), choosing
+// the filter with the smallest residual sum. scratch holds 5 * length bytes.
+void filter_row(unsigned char* dst, const unsigned char* row,
+                const unsigned char* prev, size_t length, int level,
+                unsigned char* scratch) {
+
+  const size_t bpp = 4;
+  if (level == 0) {
+    dst[0] = 0;
+    memcpy(dst + 1, row, length);
+    return;
+  }
+
+  unsigned char* f[5];
+  for (int k = 0; k < 5; k++) f[k] = scratch + k * length;
+
+  for (size_t i = 0; i < length; i++) {
+    int a = i >= bpp ? row[i - bpp] : 0;
+    int b = prev[i];
+    int c = i >= bpp ? prev[i - bpp] : 0;
+    f[0][i] = row[i];
+    f[1][i] = (unsigned char) (row[i] - a);
+    f[2][i] = (unsigned char) (row[i] - b);
+    f[3][i] = (unsigned char) (row[i] - ((a + b) >> 1));
+    f[4][i] = (unsigned char) (row[i] - paeth(a, b, c));
+  }
+
+  int best = 0; size_t best_cost = residual_cost(f[0], length);
+  for (int k = 1; k < 5; k++) {
+    size_t cost = residual_cost(f[k], length);
+    if (cost < best_cost) { best = k; best_cost = cost; }
+  }
+
+  dst[0] = (unsigned char) best;
+  memcpy(dst + 1, f[best], length);
+}
+
+void write_chunk(std::vector<unsigned char>& out, const char* name,
+                 const unsigned char* data, size_t size) {
+  write32(out, (uint32_t) size);
+  size_t start = out.size();
+  out.insert(out.end(), name, name + 4);
+  if (size) out.insert(out.end(), data, data + size);
+  write32(out, crc32(0, &out[start], size + 4));
+}
+
+const unsigned char kSignature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+
+void write_header(std::vector<unsigned char>& out, size_t w, size_t h) {
+  unsigned char ihdr[13];
+  for (int i = 0; i < 4; i++) {
+    ihdr[i]     = (unsigned char) (w >> (24 - 8 * i));
+    ihdr[4 + i] = (unsigned char) (h >> (24 - 8 * i));
+  }
+  ihdr[8]  = 8; // bit depth
+  ihdr[9]  = 6; // rgba
+  ihdr[10] = 0; // deflate
+  ihdr[11] = 0; // adaptive filtering
+  ihdr[12] = 0; // no interlace
+
+  out.insert(out.end(), kSignature, kSignature + 8);
+  write_chunk(out, "IHDR", ihdr, 13);
+}
+
+void write_zlib_header(std::vector<unsigned char>& out, int level) {
+  static const unsigned char zlib_header[4][2] = {
+    { 0x78, 0x01 }, { 0x78, 0x5e }, { 0x78, 0x9c }, { 0x78, 0xda }
+  };
+  int flevel = level < 2 ? 0 : (level < 6 ? 1 : (level == 6 ? 2 : 3));
+  out.push_back(zlib_header[flevel][0]);
+  out.push_back(zlib_header[flevel][1]);
+}
+
+} // namespace
+
+int PNGParser::save(std::vector<unsigned char>& buffer, const PNG& png,
+                    int level) {
+
+  if (png.width <= 0 || png.height <= 0) return -1;
+  if (png.pixels.size() < 4 * (size_t) png.width * png.height) return -1;
+  level = level < 0 ? 0 : (level > 9 ? 9 : level);
+
+  size_t w = png.width, h = png.height;
+  size_t stride = 4 * w;
+  const unsigned char* pixels = png.pixels.data();
+
+  // filter rows
+  std::vector<unsigned char> filtered((stride + 1) * h);
+  std::vector<unsigned char> zero(stride, 0);
+  #pragma omp parallel
+  {
+    std::vector<unsigned char> scratch(5 * stride);
+    #pragma omp for schedule(static)
+    for (long y = 0; y < (long) h; y++) {
+      const unsigned char* prev = y ? pixels + (y - 1) * stride : zero.data();
+      filter_row(&filtered[y * (stride + 1)], pixels + y * stride, prev,
+                 stride, level, scratch.data());
+    }
+  }
+
+  // deflate bands of rows
+  size_t band_rows = kBandBytes / (stride + 1);
+  if (band_rows < 1) band_rows = 1;
+  long num_bands = (long) ((h + band_rows - 1) / band_rows);
+  std::vector<std::vector<unsigned char> > bands(num_bands);
+  #pragma omp parallel for schedule(dynamic)
+  for (long b = 0; b < num_bands; b++) {
+    size_t y0 = b * band_rows;
+    size_t y1 = y0 + band_rows < h ? y0 + band_rows : h;
+    deflate_band(filtered.data(), y0 * (stride + 1), y1 * (stride + 1),
+                 b == num_bands - 1, level, bands[b]);
+  }
+
+  // zlib stream
+  std::vector<unsigned char> zlib;
+  write_zlib_header(zlib, level);
+  for (long b = 0; b < num_bands; b++) {
+    zlib.insert(zlib.end(), bands[b].begin(), bands[b].end());
+  }
+  write32(zlib, adler32(1, filtered.data(), filtered.size()));
+
+  // png
+  buffer.clear();
+  buffer.reserve(zlib.size() + 64);
+  write_header(buffer, w, h);
+  write_chunk(buffer, "IDAT", zlib.data(), zlib.size());
+  write_chunk(buffer, "IEND", 0, 0);
+
+  return 0;
+}
+
+int PNGParser::save(const char *filename, const PNG& png, int level) {
+
+  std::vector<unsigned char> buffer;
+  int error = save(buffer, png, level);
+  if (error) return error;
+
+  std::ofstream file(filename, std::ios::out|std::ios::binary);
+  if (!file.is_open()) return -1;
+  file.write((const char*) buffer.data(), buffer.size());
+  return file.good() ? 0 : -1;
+}
+
+struct PNGRowWriter::State {
+  FILE* file;
+  size_t width, height, stride;
+  int level;
+  size_t row;                          // rows written
+  uint32_t adler;
+  bool error;
+  std::vector<unsigned char> prev;     // last row written, unfiltered
+  std::vector<unsigned char> history;  // filtered bytes matches can reach
+};
+
+PNGRowWriter::PNGRowWriter() : state ( NULL ) { }
+
+PNGRowWriter::~PNGRowWriter() {
+  if (state && state->file) fclose(state->file);
+  delete state;
+}
+
+int PNGRowWriter::open(const char* filename, int width, int height, int level) {
+
+  if (state) close();
+  if (width <= 0 || height <= 0) return -1;
+
+  FILE* file = fopen(filename, "wb");
+  if (!file) return -1;
+
+  state = new State();
+  state->file   = file;
+  state->width  = width;
+  state->height = height;
+  state->stride = 4 * (size_t) width;
+  state->level  = level < 0 ? 0 : (level > 9 ? 9 : level);
+  state->row    = 0;
+  state->adler  = 1;
+  state->error  = false;
+  state->prev.assign(state->stride, 0);
+
+  std::vector<unsigned char> header;
+  write_header(header, width, height);
+  state->error = fwrite(header.data(), 1, header.size(), file) != header.size();
+  return state->error ? -1 : 0;
+}
+
+int PNGRowWriter::write_rows(const unsigned char* rgba, size_t rows) {
+
+  if (!state || state->error) return -1;
+  if (!rows) return 0;
+  if (rows > state->height - state->row) return -1;
+
+  State& s = *state;
+  size_t stride = s.stride;
+  int level = s.level;
+  bool last = s.row + rows == s.height;
+
+  // filtered rows follow the history of earlier ones, which the first
+  // band matches against
+  size_t base = s.history.size();
+  std::vector<unsigned char> filtered(base + (stride + 1) * rows);
+  if (base) memcpy(&filtered[0], s.history.data(), base);
+  #pragma omp parallel
+  {
+    std::vector<unsigned char> scratch(5 * stride);
+    #pragma omp for schedule(static)
+    for (long y = 0; y < (long) rows; y++) {
+      const unsigned char* prev = y ? rgba + (y - 1) * stride : s.prev.data();
+      filter_row(&filtered[base + y * (stride + 1)], rgba + y * stride, prev,
+                 stride, level, scratch.data());
+    }
+  }
+  s.adler = adler32(s.adler, &filtered[base], filtered.size() - base);
+
+  // deflate bands of rows, as PNGParser::save does for the whole image
+  size_t band_rows = kBandBytes / (stride + 1);
+  if (band_rows < 1) band_rows = 1;
+  long num_bands = (long) ((rows + band_rows - 1) / band_rows);
+  std::vector<std::vector<unsigned char> > bands(num_bands);
+  #pragma omp parallel for schedule(dynamic)
+  for (long b = 0; b < num_bands; b++) {
+    size_t y0 = b * band_rows;
+    size_t y1 = y0 + band_rows < rows ? y0 + band_rows : rows;
+    deflate_band(filtered.data(), base + y0 * (stride + 1),
+                 base + y1 * (stride + 1), last && b == num_bands - 1,
+                 level, bands[b]);
+  }
+
+  // an IDAT chunk per call, the zlib stream running on across them
+  std::vector<unsigned char> zlib;
+  if (s.row == 0) write_zlib_header(zlib, level);
+  for (long b = 0; b < num_bands; b++) {
+    zlib.insert(zlib.end(), bands[b].begin(), bands[b].end());
+    std::vector<unsigned char>().swap(bands[b]);
+  }
+  if (last) write32(zlib, s.adler);
+
+  // chunks are limited to 2^31 - 1 bytes
+  const size_t max_chunk = (size_t) 1 << 30;
+  std::vector<unsigned char> chunk;
+  for (size_t i = 0; i < zlib.size() && !s.error; i += max_chunk) {
+    size_t n = zlib.size() - i < max_chunk ? zlib.size() - i : max_chunk;
+    chunk.clear();
+    write_chunk(chunk, "IDAT", &zlib[i], n);
+    s.error = fwrite(chunk.data(), 1, chunk.size(), s.file) != chunk.size();
+  }
+
+  size_t keep = filtered.size() < kWindowSize ? filtered.size() : kWindowSize;
+  s.history.assign(filtered.end() - keep, filtered.end());
+  memcpy(s.prev.data(), rgba + (rows - 1) * stride, stride);
+  s.row += rows;
+
+  return s.error ? -1 : 0;
+}
+
+int PNGRowWriter::close() {
+
+  if (!state) return -1;
+
+  int error = state->error || state->row != state->height ? -1 : 0;
+  if (!error) {
+    std::vector<unsigned char> chunk;
+    write_chunk(chunk, "IEND", 0, 0);
+    if (fwrite(chunk.data(), 1, chunk.size(), state->file) != chunk.size()) {
+      error = -1;
+    }
+  }
+  if (fclose(state->file) != 0) error = -1;
+
+  delete state;
+  state = NULL;
+  return error;
+}
+
+} // namespace CMU462
@@ -10,6 +10,11 @@
 
 namespace CMU462 {
 
+typedef enum PNGDecoder {
+  PNG_DECODER_PICO,  // picoPNG, bit-at-a-time inflate
+  PNG_DECODER_FAST   // table-driven inflate, falls back to picoPNG
+} PNGDecoder;
+
 struct PNG {
   int width;
   int height;
@@ -18,11 +23,72 @@ struct PNG {
 
 class PNGParser {
  public:
-  static int load( const unsigned char* buffer, size_t size, PNG& png );
-  static int load( const char* filename, PNG& png );
-  static int save( const char* filename, const PNG& png );
+  static int load( const unsigned char* buffer, size_t size, PNG& png,
+                   PNGDecoder decoder = PNG_DECODER_FAST );
+  static int load( const char* filename, PNG& png,
+                   PNGDecoder decoder = PNG_DECODER_FAST );
+
+  // Encodes as 8-bit RGBA. level trades CPU for size, from 0 (stored)
+  // to 9, and rows are filtered and compressed in parallel.
+  static int save( const char* filename, const PNG& png, int level = 6 );
+  static int save( std::vector<unsigned char>& buffer, const PNG& png,
+                   int level = 6 );
 }; // class PNGParser
 
+/**
+ * Decodes a png a row at a time, for images too large to be held decoded
+ * at once. Rows come out as rgba like PNGParser::load. Only non-interlaced
+ * 8-bit images can be streamed, open() fails for others. The encoded
+ * buffer must outlive the reader.
+ */
+class PNGRowReader {
+ public:
+  PNGRowReader();
+  ~PNGRowReader();
+
+  int open( const unsigned char* buffer, size_t size );
+
+  int width() const;
+  int height() const;
+
+  // decodes the next row into width() rgba pixels
+  int read_row( unsigned char* rgba );
+
+ private:
+  struct State;
+  State* state;
+
+  PNGRowReader( const PNGRowReader& );
+  PNGRowReader& operator=( const PNGRowReader& );
+}; // class PNGRowReader
+
+/**
+ * Encodes a png a few rows at a time, for images too large to be held
+ * whole. Rows go in as rgba like PNGParser::save, and each call to
+ * write_rows() filters and compresses its rows in parallel and appends
+ * them to the file as an IDAT chunk, so memory is bounded by the rows
+ * passed in. close() fails unless all rows were written.
+ */
+class PNGRowWriter {
+ public:
+  PNGRowWriter();
+  ~PNGRowWriter();
+
+  int open( const char* filename, int width, int height, int level = 6 );
+
+  // appends rows of width rgba pixels
+  int write_rows( const unsigned char* rgba, size_t rows );
+
+  int close();
+
+ private:
+  struct State;
+  State* state;
+
+  PNGRowWriter( const PNGRowWriter& );
+  PNGRowWriter& operator=( const PNGRowWriter& );
+}; // class PNGRowWriter
+
 } // namespace CMU462
 
 #endif // CMU462_PNG_H
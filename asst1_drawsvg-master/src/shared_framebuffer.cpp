@@ -0,0 +1,276 @@
+#include "shared_framebuffer.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <new>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace CMU462 {
+
+namespace {
+
+const uint32_t kMagic = 0x42465344; // "DSFB"
+const uint32_t kVersion = 1;
+const size_t kMaxBuffers = 3;
+
+// pixels start on a page of their own
+const size_t kPixelsOffset = 4096;
+
+// how long a double buffered producer waits for the consumer
+const int kWaitMilliseconds = 50;
+
+} // namespace
+
+/* NOTE:
+ * The handshake is on the sequence numbers alone. The producer claims a
+ * buffer by zeroing its sequence and then checks the consumer is not
+ * holding the frame that was in it, while the consumer announces the
+ * frame it holds and then checks the buffer still has it. Both are
+ * sequentially consistent, so one of the two always sees the other and
+ * backs off. Atomics of this size are lock free, and so work across
+ * processes. A double buffered producer that gave up waiting draws over
+ * the held frame after zeroing its sequence, as a seqlock writer does,
+ * and the consumer checks the sequence again after reading.
+ */
+struct SharedFramebuffer::Header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t width, height;
+  uint32_t count;
+
+  // set when the producer replaces or removes the segment
+  atomic<uint32_t> closed;
+
+  // buffer of the latest finished frame
+  atomic<uint32_t> front;
+
+  // sequence of the latest finished frame, 0 before the first
+  atomic<uint64_t> published;
+
+  // sequence of the frame the consumer holds, 0 for none
+  atomic<uint64_t> reading;
+
+  // sequence of the frame in each buffer, 0 while it is drawn
+  atomic<uint64_t> sequence[kMaxBuffers];
+};
+
+SharedFramebuffer::SharedFramebuffer()
+  : header ( NULL ), pixels ( NULL ), size ( 0 ),
+    producer ( false ), back ( 0 ), held_buffer ( 0 ), held ( 0 ) { }
+
+SharedFramebuffer::~SharedFramebuffer() {
+  close();
+}
+
+size_t SharedFramebuffer::width() const {
+  return header ? header->width : 0;
+}
+
+size_t SharedFramebuffer::height() const {
+  return header ? header->height : 0;
+}
+
+size_t SharedFramebuffer::count() const {
+  return header ? header->count : 0;
+}
+
+bool SharedFramebuffer::closed() const {
+  return !header || header->closed.load();
+}
+
+#ifdef _WIN32
+
+int SharedFramebuffer::create( const char*, size_t, size_t, size_t ) {
+  return -1;
+}
+
+int SharedFramebuffer::open( const char* ) {
+  return -1;
+}
+
+void SharedFramebuffer::close() { }
+
+#else
+
+int SharedFramebuffer::create( const char* name, size_t width, size_t height,
+                               size_t count ) {
+
+  close();
+  if (!width || !height || count < 2 || count > kMaxBuffers) return -1;
+
+  // a consumer of an earlier producer sees it closed and opens this one
+  shm_unlink(name);
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) return -1;
+
+  size_t total = kPixelsOffset + count * 4 * width * height;
+  void* memory = MAP_FAILED;
+  if (ftruncate(fd, total) == 0) {
+    memory = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  ::close(fd);
+  if (memory == MAP_FAILED) {
+    shm_unlink(name);
+    return -1;
+  }
+
+  header = new (memory) Header();
+  header->magic   = kMagic;
+  header->version = kVersion;
+  header->width   = width;
+  header->height  = height;
+  header->count   = count;
+  header->closed.store(0);
+  header->front.store(0);
+  header->published.store(0);
+  header->reading.store(0);
+  for (size_t b = 0; b < kMaxBuffers; b++) header->sequence[b].store(0);
+
+  pixels = static_cast<unsigned char*>(memory) + kPixelsOffset;
+  size = total;
+  this->name = name;
+  producer = true;
+  back = 0;
+  return 0;
+}
+
+int SharedFramebuffer::open( const char* name ) {
+
+  close();
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0) return -1;
+
+  struct stat st;
+  void* memory = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && (size_t) st.st_size >= kPixelsOffset) {
+    memory = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  ::close(fd);
+  if (memory == MAP_FAILED) return -1;
+
+  // the segment has to be the size its header says
+  Header* h = static_cast<Header*>(memory);
+  if (h->magic != kMagic || h->version != kVersion ||
+      h->count < 2 || h->count > kMaxBuffers ||
+      kPixelsOffset + (size_t) h->count * 4 * h->width * h->height
+        != (size_t) st.st_size) {
+    munmap(memory, st.st_size);
+    return -1;
+  }
+
+  header = h;
+  pixels = static_cast<unsigned char*>(memory) + kPixelsOffset;
+  size = st.st_size;
+  this->name = name;
+  producer = false;
+  return 0;
+}
+
+void SharedFramebuffer::close() {
+
+  if (!header) return;
+
+  if (producer) {
+    header->closed.store(1);
+    shm_unlink(name.c_str());
+  } else {
+    header->reading.store(0);
+    held = 0;
+  }
+  munmap(header, size);
+
+  header = NULL;
+  pixels = NULL;
+  size = 0;
+}
+
+#endif // _WIN32
+
+unsigned char* SharedFramebuffer::begin_frame() {
+
+  if (!header || !producer) return NULL;
+
+  size_t frame = 4 * (size_t) header->width * header->height;
+  for (int waited = 0; ; waited++) {
+
+    // any buffer but the latest frame and the one the consumer holds
+    uint32_t front = header->front.load();
+    bool first = header->published.load() == 0;
+    for (size_t b = 0; b < header->count; b++) {
+      if (b == front && !first) continue;
+      uint64_t s = header->sequence[b].load();
+      if (s && s == header->reading.load()) continue;
+      header->sequence[b].store(0);
+      if (s && s == header->reading.load()) {
+        header->sequence[b].store(s);
+        continue;
+      }
+      back = b;
+      return pixels + b * frame;
+    }
+
+    // double buffered, and the consumer holds the other buffer; past the
+    // wait it is drawn over regardless
+    if (waited == kWaitMilliseconds) {
+      back = (front + 1) % header->count;
+      header->sequence[back].store(0);
+      atomic_thread_fence(memory_order_release);
+      return pixels + back * frame;
+    }
+    this_thread::sleep_for(chrono::milliseconds(1));
+  }
+}
+
+uint64_t SharedFramebuffer::end_frame() {
+
+  if (!header || !producer) return 0;
+
+  uint64_t s = header->published.load() + 1;
+  header->sequence[back].store(s);
+  header->front.store(back);
+  header->published.store(s);
+  return s;
+}
+
+const unsigned char* SharedFramebuffer::acquire( uint64_t* sequence ) {
+
+  if (!header || producer) return NULL;
+
+  size_t frame = 4 * (size_t) header->width * header->height;
+  for (;;) {
+    if (header->published.load() == 0) return NULL;
+    uint32_t b = header->front.load();
+    uint64_t s = header->sequence[b].load();
+    if (!s) continue;
+    header->reading.store(s);
+    if (header->sequence[b].load() != s) continue;
+    if (sequence) *sequence = s;
+    held_buffer = b;
+    held = s;
+    return pixels + b * frame;
+  }
+}
+
+void SharedFramebuffer::release() {
+  if (header && !producer) header->reading.store(0);
+  held = 0;
+}
+
+bool SharedFramebuffer::validate() const {
+  if (!header || producer || !held) return false;
+
+  // the reads of the frame happen before the sequence is checked again
+  atomic_thread_fence(memory_order_acquire);
+  return header->sequence[held_buffer].load() == held;
+}
+
+} // namespace CMU462
@@ -0,0 +1,90 @@
+#ifndef CMU462_SHARED_FRAMEBUFFER_H
+#define CMU462_SHARED_FRAMEBUFFER_H
+
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace CMU462 {
+
+/**
+ * RGBA framebuffers in a POSIX shared-memory segment, so another local
+ * process can present finished frames without a copy. The producer draws
+ * into one buffer while the latest finished frame stays untouched in
+ * another, and a consumer holds the frame it presents by its sequence
+ * number, which the producer never draws over. With three buffers the
+ * producer never waits; with two it waits for the consumer to move on,
+ * at most briefly so a stuck consumer can not stall it, and then draws
+ * over the held frame anyway, which validate() tells the consumer. One
+ * consumer at a time. Not available on Windows, where create() and
+ * open() fail.
+ */
+class SharedFramebuffer {
+ public:
+
+  SharedFramebuffer();
+
+  // unmaps the segment, and removes it if this is the producer
+  ~SharedFramebuffer();
+
+  // Producer //
+
+  // Creates segment name (such as "/drawsvg") holding count buffers, 2
+  // or 3, of width by height pixels, replacing any earlier segment.
+  int create( const char* name, size_t width, size_t height,
+              size_t count = 3 );
+
+  // buffer to draw the next frame into, NULL without a segment
+  unsigned char* begin_frame();
+
+  // publishes the frame drawn since begin_frame(), returns its sequence
+  uint64_t end_frame();
+
+  // Consumer //
+
+  int open( const char* name );
+
+  // Latest finished frame, held until release() or the next acquire(),
+  // NULL before the first. sequence numbers frames from 1.
+  const unsigned char* acquire( uint64_t* sequence = NULL );
+  void release();
+
+  // Whether the frame held since acquire() is still the one acquired,
+  // false once the producer started drawing over it. Call after reading
+  // the frame and drop what was read when it fails.
+  bool validate() const;
+
+  // the producer replaced or removed the segment, open() it again
+  bool closed() const;
+
+  size_t width() const;
+  size_t height() const;
+  size_t count() const;
+
+  void close();
+
+ private:
+
+  struct Header;
+  Header* header;
+  unsigned char* pixels;
+  size_t size;
+
+  std::string name;
+  bool producer;
+
+  // buffer being drawn into
+  size_t back;
+
+  // buffer and sequence of the frame the consumer holds, 0 for none
+  size_t held_buffer;
+  uint64_t held;
+
+  SharedFramebuffer( const SharedFramebuffer& );
+  SharedFramebuffer& operator=( const SharedFramebuffer& );
+
+}; // class SharedFramebuffer
+
+} // namespace CMU462
+
+#endif // CMU462_SHARED_FRAMEBUFFER_H
@@ -0,0 +1,15 @@
+option(DRAWSVG_BUILD_SHMVIEW  "Build shared framebuffer reference consumer"  ON)
+
+# The consumer of the viewer's shared framebuffer (drawsvg -m), for POSIX
+# systems only
+if(DRAWSVG_BUILD_SHMVIEW AND UNIX)
+
+  add_executable( drawsvg_shmview shmview/shmview.cpp shared_framebuffer.cpp )
+  target_link_libraries( drawsvg_shmview ${CMAKE_THREAD_LIBS_INIT} )
+  if (NOT APPLE)
+    target_link_libraries( drawsvg_shmview rt )
+  endif(NOT APPLE)
+
+  install(TARGETS drawsvg_shmview DESTINATION ${drawsvg_SOURCE_DIR})
+
+endif(DRAWSVG_BUILD_SHMVIEW AND UNIX)
@@ -0,0 +1,124 @@
+#include "shared_framebuffer.h"
+
+#include <signal.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+
+using namespace std;
+using namespace CMU462;
+
+#define msg(s) cerr << "[DrawSVG] " << s << endl;
+
+/* NOTE:
+ * Reference consumer of the shared framebuffer the viewer exports with
+ * -m. It does what a compositor would, minus the display: waits for the
+ * segment, picks up each new frame where the viewer drew it, and holds
+ * it while it is in use, here while it is optionally written out, then
+ * checks it was not drawn over meanwhile. A segment the viewer replaced,
+ * as it does on resize, is opened again.
+ */
+
+static volatile sig_atomic_t stopping = 0;
+
+static void stop( int ) {
+  stopping = 1;
+}
+
+static void usage() {
+  cerr << "Usage: drawsvg_shmview [options] <segment name>\n"
+          "  -n <frames>   exit after this many frames (default: run until\n"
+          "                interrupted)\n"
+          "  -o <file>     write each frame to this ppm file\n";
+}
+
+static int write_ppm( const char* filename, const unsigned char* rgba,
+                      size_t w, size_t h ) {
+  FILE* file = fopen(filename, "wb");
+  if (!file) return -1;
+  fprintf(file, "P6\n%zu %zu\n255\n", w, h);
+  bool written = true;
+  unsigned char pixel[3];
+  for (size_t i = 0; i < w * h && written; i++) {
+    memcpy(pixel, rgba + 4 * i, 3);
+    written = fwrite(pixel, 1, 3, file) == 3;
+  }
+  return fclose(file) == 0 && written ? 0 : -1;
+}
+
+int main( int argc, char** argv ) {
+
+  long frames = 0;
+  const char* output = NULL;
+  const char* name = NULL;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "-n" && i + 1 < argc) {
+      frames = atol(argv[++i]);
+    } else if (arg == "-o" && i + 1 < argc) {
+      output = argv[++i];
+    } else if (arg[0] == '-' || name) {
+      usage(); return 1;
+    } else {
+      name = argv[i];
+    }
+  }
+  if (!name || frames < 0) {
+    usage(); return 1;
+  }
+
+  signal(SIGINT, stop);
+  signal(SIGTERM, stop);
+
+  SharedFramebuffer shared;
+  uint64_t last = 0;
+  long seen = 0, skipped = 0, torn = 0;
+  while (!stopping && (!frames || seen < frames)) {
+
+    if (shared.closed()) {
+      if (shared.open(name) < 0) {
+        this_thread::sleep_for(chrono::milliseconds(100));
+        continue;
+      }
+      msg("Opened " << name << ", " << shared.width() << "x"
+          << shared.height() << " in " << shared.count() << " buffers");
+      last = 0;
+    }
+
+    // a compositor would wait for its vertical blank instead
+    uint64_t sequence;
+    const unsigned char* frame = shared.acquire(&sequence);
+    if (!frame || sequence == last) {
+      shared.release();
+      this_thread::sleep_for(chrono::milliseconds(1));
+      continue;
+    }
+
+    if (output && write_ppm(output, frame, shared.width(), shared.height()) < 0) {
+      msg("Could not write " << output);
+      return 1;
+    }
+
+    // a double buffered producer draws over a frame held too long, what
+    // was read of it is torn and the next frame replaces it
+    if (!shared.validate()) {
+      shared.release();
+      torn++;
+      continue;
+    }
+    shared.release();
+
+    if (last && sequence > last + 1) skipped += sequence - last - 1;
+    last = sequence;
+    seen++;
+    msg("Frame " << sequence);
+  }
+
+  msg(seen << " frames, " << skipped << " drawn over before they were seen, "
+      << torn << " while they were read");
+  return 0;
+}
@@ -13,16 +13,21 @@ using namespace std;
 namespace CMU462 {
 
 
+	// pixels are found by flooring, so that lines left of or above the
+	// target, or of a tile or strip drawn with an offset, cover the same
+	// pixels as when drawn where the coordinates are positive
+	inline int ipart(float x)
+	{
+		return (int) floor(x);
+	}
+
 	inline int round(float x)
 	{
-		return int(x + 0.5f);
+		return ipart(x + 0.5f);
 	}
 
 	inline float fpart(float x)
 	{
-		if (x < 0.0f)
-			return 1 - (x - floor(x));
-
 		return x - floor(x);
 	}
 
@@ -44,6 +49,32 @@ void SoftwareRendererImp::draw_svg( SVG& svg ) {
   }
 
   // draw canvas outline
+  draw_outline(svg);
+
+  // resolve and send to render target
+  resolve();
+
+}
+
+void SoftwareRendererImp::draw_elements( SVGElement* const* elements,
+                                         const Matrix3x3* transforms,
+                                         size_t n, const SVG* outline ) {
+
+  for ( size_t i = 0; i < n; ++i ) {
+    transformation = canvas_to_screen * transforms[i];
+    draw_element(elements[i]);
+  }
+
+  if ( outline ) {
+    transformation = canvas_to_screen;
+    draw_outline(*outline);
+  }
+
+  resolve();
+}
+
+void SoftwareRendererImp::draw_outline( const SVG& svg ) {
+
   Vector2D a = transform(Vector2D(    0    ,     0    )); a.x--; a.y++;
   Vector2D b = transform(Vector2D(svg.width,     0    )); b.x++; b.y++;
   Vector2D c = transform(Vector2D(    0    ,svg.height)); c.x--; c.y--;
@@ -53,10 +84,6 @@ void SoftwareRendererImp::draw_svg( SVG& svg ) {
   rasterize_line(a.x, a.y, c.x, c.y, Color::Black);
   rasterize_line(d.x, d.y, b.x, b.y, Color::Black);
   rasterize_line(d.x, d.y, c.x, c.y, Color::Black);
-
-  // resolve and send to render target
-  resolve();
-
 }
 
 void SoftwareRendererImp::set_sample_rate( size_t sample_rate ) {
@@ -64,13 +91,7 @@ void SoftwareRendererImp::set_sample_rate( size_t sample_rate ) {
   // Task 4: 
   // You may want to modify this for supersampling support
   this->sample_rate = sample_rate;
-  if (nullptr != supersample_target)
-  {
-	  delete supersample_target;
-	  supersample_target = nullptr;
-  }
-  supersample_target = reinterpret_cast<unsigned char*>(::operator new(4 * target_w * target_h * sample_rate * sample_rate));
-  memset(supersample_target, 255, 4 * target_w * target_h * sample_rate * sample_rate);
+  reserve_supersample_target();
 }
 
 void SoftwareRendererImp::set_render_target( unsigned char* render_target,
@@ -81,13 +102,36 @@ void SoftwareRendererImp::set_render_target( unsigned char* render_target,
   this->render_target = render_target;
   this->target_w = width;
   this->target_h = height;
-  if (nullptr != supersample_target)
+  this->origin_x = this->origin_y = 0;
+  reserve_supersample_target();
+}
+
+void SoftwareRendererImp::set_target_origin( size_t x, size_t y ) {
+  origin_x = x;
+  origin_y = y;
+}
+
+void SoftwareRendererImp::reserve_supersample_target( void ) {
+
+  // the buffer is only ever grown, so renderers kept across targets and
+  // sample rates (see the daemon) stop allocating once warmed up
+  size_t size = 4 * target_w * target_h * sample_rate * sample_rate;
+  if (size > supersample_capacity)
   {
-	  delete supersample_target;
+	  ::operator delete(supersample_target);
 	  supersample_target = nullptr;
+	  supersample_capacity = 0;
+	  supersample_target = reinterpret_cast<unsigned char*>(::operator new(size));
+	  supersample_capacity = size;
   }
-  supersample_target = reinterpret_cast<unsigned char*>(::operator new(4 * target_w * target_h * sample_rate * sample_rate));
-  memset(supersample_target, 255, 4 * target_w * target_h * sample_rate * sample_rate);
+  memset(supersample_target, 255, size);
+}
+
+void SoftwareRendererImp::trim_supersample_target( size_t bytes ) {
+  if (supersample_capacity <= bytes) return;
+  ::operator delete(supersample_target);
+  supersample_target = nullptr;
+  supersample_capacity = 0;
 }
 
 void SoftwareRendererImp::draw_element( SVGElement* element ) {
@@ -203,9 +247,11 @@ void SoftwareRendererImp::draw_polygon( Polygon& polygon ) {
   c = polygon.style.fillColor;
   if( c.a != 0 ) {
 
-    // triangulate
-    vector<Vector2D> triangles;
-    triangulate( polygon, triangles );
+    // triangulate, unless the polygon was compiled with its triangulation
+    vector<Vector2D> triangulation;
+    if( polygon.triangles.empty() ) triangulate( polygon, triangulation );
+    const vector<Vector2D>& triangles = 
+      polygon.triangles.empty() ? triangulation : polygon.triangles;
 
     // draw as triangles
     for (size_t i = 0; i < triangles.size(); i += 3) {
@@ -236,10 +282,22 @@ void SoftwareRendererImp::draw_ellipse( Ellipse& ellipse ) {
 
 void SoftwareRendererImp::draw_image( Image& image ) {
 
+  // the image is a textured parallelogram under the current transform
   Vector2D p0 = transform(image.position);
-  Vector2D p1 = transform(image.position + image.dimension);
-
-  rasterize_image( p0.x, p0.y, p1.x, p1.y, image.tex );
+  Vector2D pu = transform(image.position + Vector2D(image.dimension.x, 0));
+  Vector2D pv = transform(image.position + Vector2D(0, image.dimension.y));
+
+  // pixelated images keep hard texel edges whatever the sampler does
+  SampleMethod method = image.pixelated ? NEAREST : sampler->get_sample_method();
+
+  // packed images are a rectangle of their atlas page
+  if (image.atlas) {
+    rasterize_image_affine( p0, pu - p0, pv - p0, *image.atlas, method,
+                            image.atlas_origin, image.atlas_size );
+  } else {
+    rasterize_image_affine( p0, pu - p0, pv - p0, image.sampled(), method,
+                            Vector2D(0, 0), Vector2D(1, 1), image.vtex.get() );
+  }
 }
 
 void SoftwareRendererImp::draw_group( Group& group ) {
@@ -257,8 +315,8 @@ void SoftwareRendererImp::draw_group( Group& group ) {
 
 void SoftwareRendererImp::rasterize_super_point(float x, float y, Color color) {
 	// fill in the nearest pixel
-	int sx = (int)floor(x);
-	int sy = (int)floor(y);
+	int sx = (int)floor(x) - origin_x * (int)sample_rate;
+	int sy = (int)floor(y) - origin_y * (int)sample_rate;
 
 	int super_w = target_w * sample_rate;
 	int super_y = target_h * sample_rate;
@@ -291,9 +349,10 @@ void SoftwareRendererImp::rasterize_point( float x, float y, Color color ) {
   int sx = (int) floor(x);
   int sy = (int) floor(y);
 
-  // check bounds
-  if ( sx < 0 || sx >= target_w * sample_rate) return;
-  if ( sy < 0 || sy >= target_h * sample_rate) return;
+  // check bounds, the samples of the point may straddle an edge
+  int rate = sample_rate;
+  if ( sx + rate <= origin_x * rate || sx >= (origin_x + (int) target_w) * rate) return;
+  if ( sy + rate <= origin_y * rate || sy >= (origin_y + (int) target_h) * rate) return;
 
   for (int iy = sy; iy < sy + sample_rate; iy++)
   {
@@ -335,7 +394,7 @@ void SoftwareRendererImp::rasterize_line(float x0, float y0,
 	float yend = y0 + gradient*(xend - x0);
 	float xgap = rfpart(x0 + 0.5f);
 	int xpx11 = xend;
-	int ypx11 = int(yend);
+	int ypx11 = ipart(yend);
 
 	if (steep)
 	{
@@ -355,7 +414,7 @@ void SoftwareRendererImp::rasterize_line(float x0, float y0,
 	xgap = fpart(x1 + 0.5f);
 	int xpx12 = xend;
 
-	int ypx12 = int(yend);
+	int ypx12 = ipart(yend);
 	if (steep)
 	{
 		rasterize_point(ypx12, xpx12, rfpart(yend)*xgap*color);
@@ -367,22 +426,31 @@ void SoftwareRendererImp::rasterize_line(float x0, float y0,
 		rasterize_point(xpx12, ypx12 + 1, fpart(yend)*xgap*color);
 	}
 
+	// the span along the major axis clipped to the target, with y found
+	// from the start of the line rather than stepped to, so a line clipped
+	// to a strip of the view covers the pixels it does in the whole view
+	int xs = xpx11 + 1, xb = xs, xe = xpx12;
+	int lo = steep ? origin_y : origin_x;
+	int hi = lo + (int) (steep ? target_h : target_w);
+	xb = max(xb, lo - 1);
+	xe = min(xe, hi + 1);
+
 	if (steep)
 	{
-		for (int x = xpx11 + 1; x < xpx12; x++)
+		for (int x = xb; x < xe; x++)
 		{
-			rasterize_point(int(intery), x, rfpart(intery)*color);
-			rasterize_point(int(intery) + 1, x, fpart(intery)*color);
-			intery = intery + gradient;
+			float y = intery + gradient * (x - xs);
+			rasterize_point(ipart(y), x, rfpart(y)*color);
+			rasterize_point(ipart(y) + 1, x, fpart(y)*color);
 		}
 	}
 	else
 	{
-		for (int x = xpx11 + 1; x < xpx12; x++)
+		for (int x = xb; x < xe; x++)
 		{
-			rasterize_point(x, int(intery), rfpart(intery)*color);
-			rasterize_point(x, int(intery) + 1, fpart(intery)*color);
-			intery = intery + gradient;
+			float y = intery + gradient * (x - xs);
+			rasterize_point(x, ipart(y), rfpart(y)*color);
+			rasterize_point(x, ipart(y) + 1, fpart(y)*color);
 		}
 	}
 }
@@ -394,31 +462,32 @@ void SoftwareRendererImp::rasterize_triangle( float x0, float y0,
   // Task 3: 
   // Implement triangle rasterization
 
-	if ((x0 < 0 && x1 < 0 && x2 < 0) ||
-		(y0 < 0 && y1 < 0 && y2 < 0) ||
-		(x0 >= target_w && x1 >= target_w && x2 >= target_w) ||
-		(y0 >= target_h && y1 >= target_h && y2 >= target_h))
+	float left = origin_x, right  = origin_x + (float) target_w;
+	float top  = origin_y, bottom = origin_y + (float) target_h;
+	if ((x0 < left && x1 < left && x2 < left) ||
+		(y0 < top && y1 < top && y2 < top) ||
+		(x0 >= right && x1 >= right && x2 >= right) ||
+		(y0 >= bottom && y1 >= bottom && y2 >= bottom))
 		return;
 
 	x0 *= sample_rate; y0 *= sample_rate;
 	x1 *= sample_rate; y1 *= sample_rate;
 	x2 *= sample_rate; y2 *= sample_rate;
-	int super_w = target_w * sample_rate;
-	int super_h = target_h * sample_rate;
 	float dY0 = y1 - y0, dY1 = y2 - y1, dY2 = y0 - y2;
 	float dX0 = x1 - x0, dX1 = x2 - x1, dX2 = x0 - x2;
 
-	int minX = floor(min(min(x0, x1), x2));
-	int minY = floor(min(min(y0, y1), y2));
-	int maxX = floor(max(max(x0, x1), x2));
-	int maxY = floor(max(max(y0, y1), y2));
+	// bounds clipped to the target, triangles of zoomed in scenes and map
+	// tiles are mostly off screen
+	float rate = sample_rate;
+	int minX = max((float) floor(min(min(x0, x1), x2)), left * rate);
+	int minY = max((float) floor(min(min(y0, y1), y2)), top * rate);
+	int maxX = min((float) floor(max(max(x0, x1), x2)), right * rate - 1);
+	int maxY = min((float) floor(max(max(y0, y1), y2)), bottom * rate - 1);
 
 	for (int sy = minY; sy <= maxY; sy++)
 	{
 		for (int sx = minX; sx <= maxX; sx++)
 		{
-			if (sx < 0 || sx >= super_w) continue;
-			if (sy < 0 || sy >= super_h) continue;
 
 			bool b1 = (sx  - x0)*dY0 - (sy  - y0)*dX0 <= FLT_EPSILON;
 			bool b2 = (sx  - x1)*dY1 - (sy  - y1)*dX1 <= FLT_EPSILON;
@@ -437,27 +506,108 @@ void SoftwareRendererImp::rasterize_image( float x0, float y0,
                                            Texture& tex ) {
   // Task 6: 
   // Implement image rasterization
-	int xs0 = floor(x0 * sample_rate), xs1 = ceil(x1 * sample_rate);
-	int ys0 = floor(y0 * sample_rate), ys1 = ceil(y1 * sample_rate);
-	int super_w = target_w * sample_rate;
-	int super_h = target_h * sample_rate;
-	float xw = 1.f / (xs1 - xs0); 
-	float yh = 1.f / (ys1 - ys0);
+	rasterize_image_affine( Vector2D(x0, y0), Vector2D(x1 - x0, 0),
+	                        Vector2D(0, y1 - y0), tex,
+	                        sampler->get_sample_method() );
+}
 
-	for (int x = xs0; x <= xs1; x++)
-	{
-		if (x < 0 || x >= super_w) 
-			continue;
+void SoftwareRendererImp::rasterize_image_affine( const Vector2D& origin,
+                                                  const Vector2D& du,
+                                                  const Vector2D& dv,
+                                                  Texture& tex,
+                                                  SampleMethod method,
+                                                  const Vector2D& uv_origin,
+                                                  const Vector2D& uv_size,
+                                                  VirtualTexture* vtex ) {
+	// work in sample space
+	Vector2D o = origin * sample_rate;
+	Vector2D a = du * sample_rate, b = dv * sample_rate;
+	double det = a.x * b.y - a.y * b.x;
+	if (fabs(det) < 1e-12) return;
+
+	// inverse of the affine map, uv changes by (dudx, dvdx) per sample
+	// along a row and by (dudy, dvdy) per row
+	double dudx =  b.y / det, dvdx = -a.y / det;
+	double dudy = -b.x / det, dvdy =  a.x / det;
+
+	int rate = sample_rate;
+	int super_x0 = origin_x * rate, super_x1 = (origin_x + (int) target_w) * rate;
+	int super_y0 = origin_y * rate, super_y1 = (origin_y + (int) target_h) * rate;
+	double min_x = o.x + min(0.0, a.x) + min(0.0, b.x);
+	double max_x = o.x + max(0.0, a.x) + max(0.0, b.x);
+	double min_y = o.y + min(0.0, a.y) + min(0.0, b.y);
+	double max_y = o.y + max(0.0, a.y) + max(0.0, b.y);
+	int xs = (int) floor(min_x);
+	int xb = max(xs, super_x0), xe = min((int) ceil(max_x), super_x1 - 1);
+	int yb = max((int) floor(min_y), super_y0), ye = min((int) ceil(max_y), super_y1 - 1);
+	if (xb > xe || yb > ye) return;
+
+	// one footprint for the whole image from the Jacobian, in texels per
+	// sample along the longer screen axis
+	double tw = uv_size.x * tex.width, th = uv_size.y * tex.height;
+	float footprint = max(sqrt(dudx * dudx * tw * tw + dvdx * dvdx * th * th),
+	                      sqrt(dudy * dudy * tw * tw + dvdy * dvdy * th * th));
+	float u_scale = tex.width  ? footprint / tex.width  : 0;
+	float v_scale = tex.height ? footprint / tex.height : 0;
+
+	// virtual textures sample their tiles when the preview in tex is too
+	// coarse for the footprint, and select their own level
+	if (vtex && !vtex->needs_tiles(method, u_scale, v_scale)) vtex = NULL;
+
+	// magnified images only ever read level 0
+	if (!vtex && (method == TRILINEAR || method == SUMMED_AREA) && footprint <= 1)
+		method = BILINEAR;
+
+	// summed-area tables box filter the uv bounds of a sample instead
+	if (method == SUMMED_AREA) {
+		u_scale = (fabs(dudx) + fabs(dudy)) * uv_size.x;
+		v_scale = (fabs(dvdx) + fabs(dvdy)) * uv_size.y;
+	}
+
+	// filter a row of samples at a time, without virtual calls when the
+	// sampler is ours
+	Sampler2DImp* sampler_imp = dynamic_cast<Sampler2DImp*>(sampler);
+	vector<float> uv(2 * (xe - xb + 1));
+	vector<Color> colors(xe - xb + 1);
 
-		float u = (x - xs0) * xw;
-		for (int y = ys0; y <= ys1; y++)
+	for (int y = yb; y <= ye; y++)
+	{
+		// uv at the center of the first sample of the row over the image,
+		// on the target or not, so a target that clips the image samples
+		// the same uv as a larger one
+		double dx = xs + 0.5 - o.x, dy = y + 0.5 - o.y;
+		double u0 = dudx * dx + dudy * dy;
+		double v0 = dvdx * dx + dvdy * dy;
+
+		// samples k of the row with 0 <= u, v < 1
+		double lo = xb - xs, hi = xe - xs + 1;
+		double start[2] = { u0, v0 }, step[2] = { dudx, dvdx };
+		for (int c = 0; c < 2; c++)
 		{
-			if (y < 0 || y >= super_h)
+			if (fabs(step[c]) < 1e-12) {
+				if (start[c] < 0 || start[c] >= 1) hi = lo;
 				continue;
-
-			float v = (y - ys0) * yh;
-			rasterize_super_point(x, y, sampler->sample_trilinear(tex, u, v, xw,yh));
+			}
+			double k0 = -start[c] / step[c], k1 = (1 - start[c]) / step[c];
+			lo = max(lo, min(k0, k1));
+			hi = min(hi, max(k0, k1));
 		}
+		int kb = (int) ceil(lo), ke = (int) ceil(hi);
+		if (kb >= ke) continue;
+
+		size_t n = ke - kb;
+		for (size_t i = 0; i < n; i++) {
+			double u = u0 + dudx * (kb + i), v = v0 + dvdx * (kb + i);
+			uv[2 * i]     = uv_origin.x + u * uv_size.x;
+			uv[2 * i + 1] = uv_origin.y + v * uv_size.y;
+		}
+
+		if (vtex) vtex->sample_span(method, &uv[0], n, u_scale, v_scale, &colors[0]);
+		else if (sampler_imp) sampler_imp->sample_span(tex, method, &uv[0], n, u_scale, v_scale, &colors[0]);
+		else sampler->sample_span(tex, method, &uv[0], n, u_scale, v_scale, &colors[0]);
+
+		for (size_t i = 0; i < n; i++)
+			rasterize_super_point(xs + kb + i, y, colors[i]);
 	}
 }
 
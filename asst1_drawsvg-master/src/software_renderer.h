@@ -73,11 +73,31 @@ class SoftwareRenderer : public SVGRenderer {
 class SoftwareRendererImp : public SoftwareRenderer {
  public:
 
-  SoftwareRendererImp( ) : SoftwareRenderer( ) { }
+  SoftwareRendererImp( ) : SoftwareRenderer( ), supersample_capacity ( 0 ),
+                           origin_x ( 0 ), origin_y ( 0 ) {
+    render_target = NULL; target_w = target_h = 0;
+  }
+
+  // renderers embedded through the core library come and go with
+  // their documents, so the supersample buffer must not outlive them
+  ~SoftwareRendererImp( ) { ::operator delete(supersample_target); }
+
+  // the renderer owns its supersample buffer, so copies would free it
+  // twice
+  SoftwareRendererImp( const SoftwareRendererImp& ) = delete;
+  SoftwareRendererImp& operator=( const SoftwareRendererImp& ) = delete;
 
   // draw an svg input to render target
   void draw_svg( SVG& svg );
 
+  // draw n elements, each under its own transform from the canvas (that
+  // of its parent groups), and resolve, with the canvas outline of
+  // outline when given. For callers drawing a flattened and culled part
+  // of a scene, see TileSet.
+  void draw_elements( SVGElement* const* elements,
+                      const Matrix3x3* transforms, size_t n,
+                      const SVG* outline = NULL );
+
   // set sample rate
   void set_sample_rate( size_t sample_rate );
   
@@ -85,6 +105,21 @@ class SoftwareRendererImp : public SoftwareRenderer {
   void set_render_target( unsigned char* target_buffer,
                           size_t width, size_t height );
 
+  // Frees the supersample buffer if more than bytes are allocated, as it
+  // is otherwise only ever grown. The next target or sample rate set
+  // allocates it again.
+  void trim_supersample_target( size_t bytes );
+
+  // Makes the render target the part of a larger view from pixel (x, y)
+  // on, such as a strip of it: the canvas to screen transform stays that
+  // of the whole view and only what falls on the target is drawn. Unlike
+  // moving the view by the origin, the pixels come out exactly as they do
+  // in a render of the whole view. Set after the render target, which
+  // resets the origin to (0, 0).
+  void set_target_origin( size_t x, size_t y );
+  size_t target_origin_x( void ) const { return origin_x; }
+  size_t target_origin_y( void ) const { return origin_y; }
+
  private:
 
   // Primitive Drawing //
@@ -92,6 +127,9 @@ class SoftwareRendererImp : public SoftwareRenderer {
   // Draws an SVG element
   void draw_element( SVGElement* element );
 
+  // Draws the canvas outline of an svg
+  void draw_outline( const SVG& svg );
+
   // Draws a point
   void draw_point( Point& p );
 
@@ -138,9 +176,29 @@ class SoftwareRendererImp : public SoftwareRenderer {
                         float x1, float y1,
                         Texture& tex );
 
+  // rasterize an image mapped onto the parallelogram spanned by du and dv
+  // from origin, in screen space, so rotated and skewed images draw right.
+  // The image is the uv_size rectangle at uv_origin of tex, or the tiles
+  // of vtex where its preview tex is too coarse.
+  void rasterize_image_affine( const Vector2D& origin,
+                               const Vector2D& du, const Vector2D& dv,
+                               Texture& tex, SampleMethod method,
+                               const Vector2D& uv_origin = Vector2D(0, 0),
+                               const Vector2D& uv_size   = Vector2D(1, 1),
+                               VirtualTexture* vtex = NULL );
+
   // resolve samples to render target
   void resolve( void );
 
+  // grow the supersample buffer to the target and sample rate, cleared
+  void reserve_supersample_target( void );
+
+  // bytes allocated at supersample_target
+  size_t supersample_capacity;
+
+  // pixel of the view at the top left of the render target
+  int origin_x, origin_y;
+
 }; // class SoftwareRendererImp
 
 
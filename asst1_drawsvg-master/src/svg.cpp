@@ -1,8 +1,11 @@
 #include "svg.h"
 #include "png.h"
 #include "base64.h"
+#include "texture_cache.h"
 
+#include <set>
 #include <string>
+#include <cstring>
 #include <fstream>
 #include <sstream>
 #include <iostream>
@@ -20,10 +23,71 @@ Group::~Group() {
   } elements.clear();
 }
 
+Image::~Image() {
+  TextureCache::remove(this);
+}
+
 SVG::~SVG() {
   for (size_t i = 0; i < elements.size(); i++) {
     delete elements[i];
   } elements.clear();
+  for (size_t i = 0; i < atlas.size(); i++) {
+    delete atlas[i];
+  } atlas.clear();
+}
+
+static size_t texture_bytes( const Texture& tex ) {
+  size_t bytes = tex.sat.size() * sizeof(uint32_t);
+  for (size_t l = 0; l < tex.mipmap.size(); l++) {
+    bytes += tex.mipmap[l].texels.size();
+  }
+  return bytes;
+}
+
+static size_t element_bytes( const vector<SVGElement*>& elements,
+                             set<const Texture*>& shared ) {
+
+  size_t bytes = 0;
+  for (size_t i = 0; i < elements.size(); i++) {
+    SVGElement* element = elements[i];
+    bytes += 256;
+    switch (element->type) {
+      case POLYLINE:
+        bytes += static_cast<Polyline*>(element)->points.size() * sizeof(Vector2D);
+        break;
+      case POLYGON: {
+        Polygon* polygon = static_cast<Polygon*>(element);
+        bytes += (polygon->points.size() + polygon->triangles.size()) * sizeof(Vector2D);
+        break;
+      }
+      case IMAGE: {
+
+        // a shared texture counts once, in full for each document holding
+        // it, as it stays as long as any of them does
+        Image* image = static_cast<Image*>(element);
+        bytes += texture_bytes(image->tex);
+        if (image->texture && shared.insert(image->texture.get()).second) {
+          bytes += texture_bytes(*image->texture);
+        }
+        break;
+      }
+      case GROUP:
+        bytes += element_bytes(static_cast<Group*>(element)->elements, shared);
+        break;
+      default:
+        break;
+    }
+  }
+  return bytes;
+}
+
+size_t SVG::bytes() const {
+  set<const Texture*> shared;
+  size_t bytes = sizeof(SVG) + element_bytes(elements, shared);
+  for (size_t i = 0; i < atlas.size(); i++) {
+    bytes += texture_bytes(*atlas[i]);
+  }
+  return bytes;
 }
 
 // Parser //
@@ -38,15 +102,29 @@ int SVGParser::load( const char* filename, SVG* svg ) {
 
   XMLDocument doc;
   doc.LoadFile( filename );
+  return parseDocument( doc, svg );
+}
+
+int SVGParser::load( const char* data, size_t size, SVG* svg ) {
+
+  XMLDocument doc;
+  doc.Parse( data, size );
+  return parseDocument( doc, svg );
+}
+
+int SVGParser::parseDocument( XMLDocument& doc, SVG* svg ) {
+
+  // malformed documents fail the load rather than the process, the
+  // parser is also embedded in services (see core/drawsvg_core.h)
   if( doc.Error() ) {
      doc.PrintError();
-     exit( 1 );
+     return -1;
   }
 
   XMLElement* root = doc.FirstChildElement( "svg" );
   if( !root ) {
      cerr << "Error: not an SVG file!" << endl;
-     exit( 1 );
+     return -1;
   }
 
   root->QueryFloatAttribute( "width",  &svg->width  );
@@ -346,34 +424,63 @@ void SVGParser::parseImage( XMLElement* xml, Image* image ) {
   image->dimension = Vector2D ( xml->FloatAttribute( "width"  ),
                                 xml->FloatAttribute( "height" )); 
 
+  // pixel art and the like keep hard texel edges
+  const char* rendering = xml->Attribute( "image-rendering" );
+  if ( rendering ) {
+    string r = rendering;
+    image->pixelated = r == "pixelated" || r == "crisp-edges" ||
+                       r == "optimizeSpeed";
+  }
+
   // read png data
   const char* data = xml->Attribute( "xlink:href" );
   while (*data != ',') data++; data++;
-  
-  // decode base64 encoded data
-  string encoded = data;
-  encoded.erase(remove(encoded.begin(), encoded.end(), ' ' ), encoded.end());
-  encoded.erase(remove(encoded.begin(), encoded.end(), '\t'), encoded.end());
-  encoded.erase(remove(encoded.begin(), encoded.end(), '\n'), encoded.end());
-  string decoded = base64_decode(encoded);
-
-  // load decoded data into buffer
-  const unsigned char* buffer = (unsigned char*) decoded.c_str(); 
-  size_t size = decoded.size();
-
-  // load into png
-  PNG png; PNGParser::load(buffer, size, png);
-  
-  // create bitmap texture from png (mip level 0)
-  MipLevel mip_start;
-  mip_start.width  = png.width;
-  mip_start.height = png.height;
-  mip_start.texels = png.pixels;
-
-  // add to svg
-  image->tex.width  = mip_start.width;
-  image->tex.height = mip_start.height;
-  image->tex.mipmap.push_back(mip_start);
+  size_t length = strlen(data);
+
+  // color-interpolation="linearRGB" filters the image in linear light,
+  // images share a texture only when they filter it the same way
+  const char* interpolation = xml->Attribute( "color-interpolation" );
+  bool srgb = interpolation && string(interpolation) == "linearRGB";
+  image->tex.srgb = srgb;
+
+  // images with a payload that is already loaded share its texture
+  image->tex_key = TextureCache::key(data, length);
+  if (!TextureCache::share(image)) {
+
+    // decode base64 encoded data straight from the attribute, whitespace
+    // is skipped by the decoder
+    vector<unsigned char> decoded(base64_decoded_size(length));
+    decoded.resize(base64_decode(data, length, &decoded[0]));
+
+    // images too large to decode at once are streamed into tiles, with
+    // only their preview in tex
+    PNGRowReader reader;
+    if (!reader.open(decoded.data(), decoded.size()) &&
+        (size_t) reader.width() * reader.height() > VirtualTexture::get_threshold()) {
+      image->vtex.reset(VirtualTexture::create(decoded.data(), decoded.size(),
+                                               image->tex));
+    }
+
+    if (!image->vtex) {
+
+      // load into png
+      PNG png; PNGParser::load(decoded.data(), decoded.size(), png);
+    
+      // create bitmap texture from png (mip level 0)
+      image->tex.mipmap.push_back(MipLevel());
+      MipLevel& mip_start = image->tex.mipmap.back();
+      mip_start.width  = png.width;
+      mip_start.height = png.height;
+      mip_start.texels.swap(png.pixels);
+
+      // add to svg
+      image->tex.width  = mip_start.width;
+      image->tex.height = mip_start.height;
+    }
+    image->tex.srgb = srgb;
+  }
+
+  TextureCache::add(image);
 }
 
 void SVGParser::parseGroup( XMLElement* xml, Group* group ) {
@@ -2,10 +2,13 @@
 #define CMU462_SVG_H
 
 #include <map>
+#include <memory>
 #include <vector>
+#include <stdint.h>
 
 #include "color.h"
 #include "texture.h"
+#include "virtual_texture.h"
 #include "vector2D.h"
 #include "matrix3x3.h"
 
@@ -95,6 +98,9 @@ struct Polygon : SVGElement {
   Polygon() : SVGElement  ( POLYGON ) { }
   std::vector<Vector2D> points;
 
+  // triangle list of points, empty until compiled (see svg_cache.h)
+  std::vector<Vector2D> triangles;
+
 };
 
 struct Ellipse : SVGElement {
@@ -107,19 +113,71 @@ struct Ellipse : SVGElement {
 
 struct Image : SVGElement {
 
-  Image() : SVGElement  ( IMAGE ) { }
+  Image() : SVGElement  ( IMAGE ), tex_key ( 0 ), pixelated ( false ),
+            atlas ( NULL ), mip_sampler ( NULL ), mips_dirty ( true ) { }
   Vector2D position;
   Vector2D dimension;
+
+  // Texels as decoded, until TextureCache::add() moves them into the
+  // shared texture, and afterwards a copy made only when the reference
+  // renderer or sampler needs one in place (see TextureManager).
+  // tex.srgb always holds the color space of the image.
   Texture tex;
+
+  // payload key in the texture cache, 0 if not shared
+  uint64_t tex_key;
+
+  // image-rendering asks for crisp pixels, drawn with nearest sampling
+  bool pixelated;
+
+  // atlas page holding the texels once packed, see TextureAtlas, with
+  // the uv origin and size of the image in the page; it then has no
+  // texture of its own
+  Texture* atlas;
+  Vector2D atlas_origin;
+  Vector2D atlas_size;
+
+  // tiles of an image too large to decode at once, its texture then holds
+  // its preview, shared by the images with the same payload
+  std::shared_ptr<VirtualTexture> vtex;
+
+  // sampler that built the levels of tex, and whether level 0 changed
+  // since, see TextureManager
+  Sampler2D* mip_sampler;
+  bool mips_dirty;
+
+  // texture shared with the images with the same payload and color
+  // space, never changed while shared, see TextureCache
+  std::shared_ptr<const Texture> texture;
+
+  // the texture our renderers draw: the copy in tex while it holds a
+  // chain a sampler built, otherwise the shared one once there is one;
+  // samplers take textures by reference but leave shared ones unchanged
+  Texture& sampled() {
+    return texture && (mips_dirty || !mip_sampler) ? const_cast<Texture&>(*texture)
+                                                   : tex;
+  }
+  const Texture& sampled() const {
+    return texture && (mips_dirty || !mip_sampler) ? *texture : tex;
+  }
+
+  ~Image();
   
 };
 
 struct SVG {
 
   ~SVG();
+
+  // estimate of the memory held by the document, mip chains included
+  size_t bytes() const;
+
   float width, height;
   std::vector<SVGElement*> elements;
 
+  // atlas pages of packed images, owned by the svg
+  std::vector<Texture*> atlas;
+
 };
 
 class SVGParser {
@@ -127,8 +185,14 @@ class SVGParser {
 
   static int load( const char* filename, SVG* svg );
   static int save( const char* filename, const SVG* svg );
+
+  // load from a document in memory, size bytes at data
+  static int load( const char* data, size_t size, SVG* svg );
  
  private:
+
+  // parse a loaded document, -1 if it is not a valid svg
+  static int parseDocument  ( XMLDocument& doc, SVG* svg );
   
   // parse a svg file
   static void parseSVG       ( XMLElement* xml, SVG* svg );
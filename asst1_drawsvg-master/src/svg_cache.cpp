@@ -0,0 +1,593 @@
+#include "svg_cache.h"
+#include "triangulation.h"
+#include "texture_cache.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include <map>
+#include <deque>
+#include <vector>
+#include <fstream>
+
+using namespace std;
+
+namespace CMU462 {
+
+/* NOTE:
+ * File layout, all integers in host byte order:
+ *
+ *   Header   magic, version, source stamp, section table
+ *   nodes    Node[], the element tree in pre-order. Groups store their
+ *            child count and their children follow them.
+ *   points   Vector2D[], point lists and polygon triangulations
+ *   levels   Level[], mip levels of all images
+ *   texels   rgba8 texels of each level
+ *
+ * Every section and every mip level starts on a 64 byte boundary and is
+ * addressed by its offset from the start of the file, so the file can
+ * be mapped anywhere and read in place.
+ */
+namespace {
+
+const char kMagic[8] = { 'D', 'S', 'V', 'G', 'C', '\r', '\n', 0x1a };
+const uint32_t kVersion = 4;
+const uint32_t kByteOrder = 0x01020304;
+const uint64_t kAlignment = 64;
+
+// Node::flags of images
+const uint64_t kPixelated = 1;
+const uint64_t kLinearRGB = 2;
+
+// keeps 4 * width * height far from overflowing
+const uint64_t kMaxLevelSize = 1 << 16;
+
+struct Section {
+  uint64_t offset;
+  uint64_t size;
+};
+
+struct Header {
+  char     magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t file_size;
+  uint64_t source_size;
+  int64_t  source_mtime;
+  uint64_t source_hash;
+  double   width;
+  double   height;
+  Section  nodes;
+  Section  points;
+  Section  levels;
+  Section  texels;
+};
+
+struct Node {
+  uint32_t type;
+  uint32_t count;          // children, points or mip levels
+  uint64_t first;          // first point or mip level
+  uint64_t triangles;      // first triangle vertex of polygons
+  uint64_t num_triangles;  // triangle vertex count of polygons
+  float    style[10];      // stroke rgba, fill rgba, width, miter limit
+  double   transform[9];   // row major
+  double   geometry[4];    // type specific pair of points
+  uint64_t key;            // texture cache key of images
+  uint64_t flags;          // kPixelated for images
+};
+
+struct Level {
+  uint64_t width;
+  uint64_t height;
+  uint64_t offset;         // texels, from the start of the file
+};
+
+inline uint64_t align(uint64_t offset) {
+  return (offset + kAlignment - 1) & ~(kAlignment - 1);
+}
+
+inline bool in_file(const Section& s, uint64_t file_size) {
+  return s.offset % kAlignment == 0 && s.offset <= file_size &&
+         s.size <= file_size - s.offset;
+}
+
+// 64-bit FNV-1a
+uint64_t hash_bytes(const unsigned char* data, size_t size) {
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ data[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+bool source_stamp(const char* filename, uint64_t& size, int64_t& mtime) {
+  struct stat st;
+  if (stat(filename, &st) < 0) return false;
+  size  = (uint64_t) st.st_size;
+  mtime = (int64_t) st.st_mtime;
+  return true;
+}
+
+bool source_hash(const char* filename, uint64_t& hash) {
+  ifstream in(filename, ios::in | ios::binary);
+  if (!in.is_open()) return false;
+  vector<unsigned char> data((istreambuf_iterator<char>(in)),
+                              istreambuf_iterator<char>());
+  hash = hash_bytes(data.data(), data.size());
+  return true;
+}
+
+// Read-only view of a whole file. Uses mmap where available and reads
+// the file into memory elsewhere.
+class MappedFile {
+ public:
+
+  MappedFile() : data ( NULL ), size ( 0 ) { }
+
+  ~MappedFile() {
+#ifndef _WIN32
+    if (data) munmap((void*) data, size);
+#endif
+  }
+
+  bool open(const char* filename) {
+#ifndef _WIN32
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size <= 0) { close(fd); return false; }
+    void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return false;
+    data = (const unsigned char*) p;
+    size = st.st_size;
+#else
+    ifstream in(filename, ios::in | ios::binary);
+    if (!in.is_open()) return false;
+    buffer.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    data = buffer.data();
+    size = buffer.size();
+#endif
+    return size > 0;
+  }
+
+  const unsigned char* data;
+  size_t size;
+
+ private:
+#ifdef _WIN32
+  vector<unsigned char> buffer;
+#endif
+};
+
+// Flattens an svg into the node, point and level tables.
+struct Writer {
+
+  Writer() : streamed ( false ) { }
+
+  vector<Node> nodes;
+  vector<Vector2D> points;
+  vector<Level> levels;
+  vector<const MipLevel*> mips;
+  map<uint64_t, uint64_t> shared;  // texture key -> first level
+  deque<Texture> linear;           // row-major copies of tiled textures
+  bool streamed;                   // has images with virtual textures
+
+  void add_points(Node& node, const vector<Vector2D>& p) {
+    node.first = points.size();
+    node.count = p.size();
+    points.insert(points.end(), p.begin(), p.end());
+  }
+
+  void add(const SVGElement* element) {
+
+    size_t index = nodes.size();
+    nodes.push_back(Node());
+    Node node;
+    memset(&node, 0, sizeof(Node));
+    node.type = element->type;
+
+    const Style& style = element->style;
+    memcpy(node.style, &style.strokeColor.r, 4 * sizeof(float));
+    memcpy(node.style + 4, &style.fillColor.r, 4 * sizeof(float));
+    node.style[8] = style.strokeWidth;
+    node.style[9] = style.miterLimit;
+    for (int i = 0; i < 9; i++) {
+      node.transform[i] = element->transform(i / 3, i % 3);
+    }
+
+    double* g = node.geometry;
+    switch (element->type) {
+      case POINT: {
+        const Point* e = static_cast<const Point*>(element);
+        g[0] = e->position.x; g[1] = e->position.y;
+        break;
+      }
+      case LINE: {
+        const Line* e = static_cast<const Line*>(element);
+        g[0] = e->from.x; g[1] = e->from.y;
+        g[2] = e->to.x;   g[3] = e->to.y;
+        break;
+      }
+      case POLYLINE: {
+        add_points(node, static_cast<const Polyline*>(element)->points);
+        break;
+      }
+      case RECT: {
+        const Rect* e = static_cast<const Rect*>(element);
+        g[0] = e->position.x;  g[1] = e->position.y;
+        g[2] = e->dimension.x; g[3] = e->dimension.y;
+        break;
+      }
+      case POLYGON: {
+        const Polygon* e = static_cast<const Polygon*>(element);
+        add_points(node, e->points);
+        node.triangles = points.size();
+        node.num_triangles = e->triangles.size();
+        points.insert(points.end(), e->triangles.begin(), e->triangles.end());
+        break;
+      }
+      case ELLIPSE: {
+        const Ellipse* e = static_cast<const Ellipse*>(element);
+        g[0] = e->center.x; g[1] = e->center.y;
+        g[2] = e->radius.x; g[3] = e->radius.y;
+        break;
+      }
+      case IMAGE: {
+        const Image* e = static_cast<const Image*>(element);
+        g[0] = e->position.x;  g[1] = e->position.y;
+        g[2] = e->dimension.x; g[3] = e->dimension.y;
+        node.key   = e->tex_key;
+        node.flags = (e->pixelated ? kPixelated : 0) |
+                     (e->tex.srgb  ? kLinearRGB : 0);
+        node.count = e->sampled().mipmap.size();
+        if (e->vtex) streamed = true;
+
+        // images with the same payload share their levels
+        map<uint64_t, uint64_t>::iterator it = shared.find(e->tex_key);
+        if (e->tex_key && it != shared.end()) {
+          node.first = it->second;
+          break;
+        }
+        node.first = levels.size();
+        if (e->tex_key) shared[e->tex_key] = node.first;
+
+        // texels are stored row-major
+        const Texture* tex = &e->sampled();
+        if (tex->layout != LINEAR_LAYOUT) {
+          linear.push_back(*tex);
+          convert_texels(linear.back(), LINEAR_LAYOUT);
+          tex = &linear.back();
+        }
+        for (size_t i = 0; i < tex->mipmap.size(); i++) {
+          Level level = { tex->mipmap[i].width, tex->mipmap[i].height, 0 };
+          levels.push_back(level);
+          mips.push_back(&tex->mipmap[i]);
+        }
+        break;
+      }
+      case GROUP: {
+        const Group* e = static_cast<const Group*>(element);
+        node.count = e->elements.size();
+        for (size_t i = 0; i < e->elements.size(); i++) {
+          add(e->elements[i]);
+        }
+        break;
+      }
+      default:
+        break;
+    }
+
+    nodes[index] = node;
+  }
+};
+
+// Rebuilds elements from a mapped file, validating every reference.
+struct Reader {
+
+  const unsigned char* base;
+  const Node* nodes;      size_t num_nodes;
+  const Vector2D* points; size_t num_points;
+  const Level* levels;    size_t num_levels;
+  uint64_t file_size;
+  size_t next;
+
+  bool read_points(uint64_t first, uint64_t count, vector<Vector2D>& out) {
+    if (first > num_points || count > num_points - first) return false;
+    out.assign(points + first, points + first + count);
+    return true;
+  }
+
+  bool read_levels(const Node& node, Texture& tex) {
+    if (!node.count || node.first > num_levels ||
+        node.count > num_levels - node.first) return false;
+    tex.mipmap.resize(node.count);
+    for (size_t i = 0; i < node.count; i++) {
+      const Level& level = levels[node.first + i];
+      if (!level.width  || level.width  > kMaxLevelSize ||
+          !level.height || level.height > kMaxLevelSize) return false;
+      uint64_t size = 4 * level.width * level.height;
+      if (level.offset > file_size || size > file_size - level.offset) {
+        return false;
+      }
+      MipLevel& mip = tex.mipmap[i];
+      mip.width  = level.width;
+      mip.height = level.height;
+      mip.texels.assign(base + level.offset, base + level.offset + size);
+    }
+    tex.width  = tex.mipmap[0].width;
+    tex.height = tex.mipmap[0].height;
+    return true;
+  }
+
+  // next element in pre-order, NULL if the file is inconsistent
+  SVGElement* read() {
+
+    if (next >= num_nodes) return NULL;
+    const Node& node = nodes[next++];
+    const double* g = node.geometry;
+
+    SVGElement* element = NULL;
+    bool ok = true;
+    switch (node.type) {
+      case POINT: {
+        Point* e = new Point(); element = e;
+        e->position = Vector2D(g[0], g[1]);
+        break;
+      }
+      case LINE: {
+        Line* e = new Line(); element = e;
+        e->from = Vector2D(g[0], g[1]);
+        e->to   = Vector2D(g[2], g[3]);
+        break;
+      }
+      case POLYLINE: {
+        Polyline* e = new Polyline(); element = e;
+        ok = read_points(node.first, node.count, e->points);
+        break;
+      }
+      case RECT: {
+        Rect* e = new Rect(); element = e;
+        e->position  = Vector2D(g[0], g[1]);
+        e->dimension = Vector2D(g[2], g[3]);
+        break;
+      }
+      case POLYGON: {
+        Polygon* e = new Polygon(); element = e;
+        ok = read_points(node.first, node.count, e->points) &&
+             read_points(node.triangles, node.num_triangles, e->triangles);
+        break;
+      }
+      case ELLIPSE: {
+        Ellipse* e = new Ellipse(); element = e;
+        e->center = Vector2D(g[0], g[1]);
+        e->radius = Vector2D(g[2], g[3]);
+        break;
+      }
+      case IMAGE: {
+        Image* e = new Image(); element = e;
+        e->position  = Vector2D(g[0], g[1]);
+        e->dimension = Vector2D(g[2], g[3]);
+        e->tex_key = node.key;
+        e->pixelated = (node.flags & kPixelated) != 0;
+
+        // levels read back were generated in the color space of the image
+        e->tex.srgb = (node.flags & kLinearRGB) != 0;
+        ok = (node.key && TextureCache::share(e)) || read_levels(node, e->tex);
+        if (ok) TextureCache::add(e);
+        break;
+      }
+      case GROUP: {
+        Group* e = new Group(); element = e;
+        for (size_t i = 0; ok && i < node.count; i++) {
+          SVGElement* child = read();
+          if (child) e->elements.push_back(child);
+          ok = child != NULL;
+        }
+        break;
+      }
+      default:
+        return NULL;
+    }
+
+    if (!ok) {
+      delete element;
+      return NULL;
+    }
+
+    Style& style = element->style;
+    memcpy(&style.strokeColor.r, node.style, 4 * sizeof(float));
+    memcpy(&style.fillColor.r, node.style + 4, 4 * sizeof(float));
+    style.strokeWidth = node.style[8];
+    style.miterLimit  = node.style[9];
+    for (int i = 0; i < 9; i++) {
+      element->transform(i / 3, i % 3) = node.transform[i];
+    }
+
+    return element;
+  }
+};
+
+void write_padded(ofstream& out, const void* data, size_t size) {
+  static const char zeros[kAlignment] = { 0 };
+  out.write((const char*) data, size);
+  out.write(zeros, align(size) - size);
+}
+
+} // namespace
+
+string SVGCache::path( const char* filename ) {
+  return string(filename) + "c";
+}
+
+int SVGCache::load( const char* filename, SVG* svg ) {
+
+  uint64_t source_size; int64_t source_mtime;
+  if (!source_stamp(filename, source_size, source_mtime)) return -1;
+
+  MappedFile file;
+  if (!file.open(path(filename).c_str())) return -1;
+  if (file.size < sizeof(Header)) return -1;
+
+  const Header& header = *(const Header*) file.data;
+  if (memcmp(header.magic, kMagic, sizeof(kMagic)) ||
+      header.version != kVersion || header.byte_order != kByteOrder ||
+      header.file_size != file.size) {
+    return -1;
+  }
+
+  // a touched but unchanged source keeps its compiled scene
+  if (header.source_size != source_size) return -1;
+  if (header.source_mtime != source_mtime) {
+    uint64_t hash;
+    if (!source_hash(filename, hash) || hash != header.source_hash) return -1;
+  }
+
+  if (!in_file(header.nodes,  file.size) ||
+      !in_file(header.points, file.size) ||
+      !in_file(header.levels, file.size) ||
+      !in_file(header.texels, file.size)) {
+    return -1;
+  }
+
+  Reader reader;
+  reader.base       = file.data;
+  reader.nodes      = (const Node*)     (file.data + header.nodes.offset);
+  reader.num_nodes  = header.nodes.size  / sizeof(Node);
+  reader.points     = (const Vector2D*) (file.data + header.points.offset);
+  reader.num_points = header.points.size / sizeof(Vector2D);
+  reader.levels     = (const Level*)    (file.data + header.levels.offset);
+  reader.num_levels = header.levels.size / sizeof(Level);
+  reader.file_size  = file.size;
+  reader.next       = 0;
+
+  svg->width  = header.width;
+  svg->height = header.height;
+  while (reader.next < reader.num_nodes) {
+    SVGElement* element = reader.read();
+    if (!element) {
+      for (size_t i = 0; i < svg->elements.size(); i++) {
+        delete svg->elements[i];
+      } svg->elements.clear();
+      return -1;
+    }
+    svg->elements.push_back(element);
+  }
+
+  return 0;
+}
+
+int SVGCache::save( const char* filename, const SVG* svg ) {
+
+  // packed images have no texture of their own to write
+  if (!svg->atlas.empty()) return -1;
+
+  Header header;
+  memset(&header, 0, sizeof(Header));
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version    = kVersion;
+  header.byte_order = kByteOrder;
+  if (!source_stamp(filename, header.source_size, header.source_mtime) ||
+      !source_hash(filename, header.source_hash)) {
+    return -1;
+  }
+  header.width  = svg->width;
+  header.height = svg->height;
+
+  Writer writer;
+  for (size_t i = 0; i < svg->elements.size(); i++) {
+    writer.add(svg->elements[i]);
+  }
+
+  // streamed images only hold their preview, the cache would lose them
+  if (writer.streamed) return -1;
+
+  // lay out sections
+  header.nodes.offset  = align(sizeof(Header));
+  header.nodes.size    = writer.nodes.size() * sizeof(Node);
+  header.points.offset = align(header.nodes.offset + header.nodes.size);
+  header.points.size   = writer.points.size() * sizeof(Vector2D);
+  header.levels.offset = align(header.points.offset + header.points.size);
+  header.levels.size   = writer.levels.size() * sizeof(Level);
+  header.texels.offset = align(header.levels.offset + header.levels.size);
+
+  uint64_t offset = header.texels.offset;
+  for (size_t i = 0; i < writer.levels.size(); i++) {
+    writer.levels[i].offset = offset;
+    offset = align(offset + writer.mips[i]->texels.size());
+  }
+  header.texels.size = offset - header.texels.offset;
+  header.file_size = offset;
+
+  // write to a temporary and move it in place, so that a concurrent
+  // load never sees a partial file
+  string target = path(filename);
+  string temp = target + ".tmp";
+  ofstream out(temp.c_str(), ios::out | ios::binary);
+  if (!out.is_open()) return -1;
+
+  write_padded(out, &header, sizeof(Header));
+  write_padded(out, writer.nodes.data(),  header.nodes.size);
+  write_padded(out, writer.points.data(), header.points.size);
+  write_padded(out, writer.levels.data(), header.levels.size);
+  for (size_t i = 0; i < writer.mips.size(); i++) {
+    const vector<unsigned char>& texels = writer.mips[i]->texels;
+    write_padded(out, texels.data(), texels.size());
+  }
+
+  out.close();
+#ifdef _WIN32
+  remove(target.c_str());
+#endif
+  if (!out || rename(temp.c_str(), target.c_str()) != 0) {
+    remove(temp.c_str());
+    return -1;
+  }
+
+  return 0;
+}
+
+static void compile_element( SVGElement* element, Sampler2DImp* sampler ) {
+
+  switch (element->type) {
+    case POLYGON: {
+      Polygon* polygon = static_cast<Polygon*>(element);
+      if (polygon->triangles.empty()) {
+        triangulate(*polygon, polygon->triangles);
+      }
+      break;
+    }
+    case IMAGE: {
+      Image* image = static_cast<Image*>(element);
+      if (image->texture && image->texture->mipmap.size() == 1) {
+        image->texture = TextureCache::extend(image, sampler, kMaxMipLevels, false);
+      }
+      break;
+    }
+    case GROUP: {
+      Group* group = static_cast<Group*>(element);
+      for (size_t i = 0; i < group->elements.size(); i++) {
+        compile_element(group->elements[i], sampler);
+      }
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+void SVGCache::compile( SVG* svg, Sampler2DImp* sampler ) {
+  for (size_t i = 0; i < svg->elements.size(); i++) {
+    compile_element(svg->elements[i], sampler);
+  }
+}
+
+} // namespace CMU462
@@ -0,0 +1,43 @@
+#ifndef CMU462_SVG_CACHE_H
+#define CMU462_SVG_CACHE_H
+
+#include <string>
+
+#include "svg.h"
+#include "texture.h"
+
+namespace CMU462 {
+
+/**
+ * Compiled scenes.
+ * A compiled scene is a binary image of a parsed svg that sits next to
+ * its source ("foo.svg" -> "foo.svgc"). It holds the flattened element
+ * tree with styles and transforms, all point lists, polygon triangulations
+ * and complete mip chains in aligned sections addressed by file offsets,
+ * so loading it is a mmap and a handful of copies instead of XML parsing,
+ * base64 and PNG decoding, triangulation and mipmapping.
+ * A compiled scene is only used while its source has the same size and
+ * either the same mtime or the same content hash as when it was written.
+ */
+class SVGCache {
+ public:
+
+  // path of the compiled scene for a source file
+  static std::string path( const char* filename );
+
+  // load the compiled scene of filename, fails if missing or out of date
+  static int load( const char* filename, SVG* svg );
+
+  // write the compiled scene of filename, including whatever
+  // triangulations and mip chains compile() has produced; scenes must
+  // be saved before their images are packed into atlas pages
+  static int save( const char* filename, const SVG* svg );
+
+  // triangulate all polygons and generate missing mip chains
+  static void compile( SVG* svg, Sampler2DImp* sampler );
+
+}; // class SVGCache
+
+} // namespace CMU462
+
+#endif // CMU462_SVG_CACHE_H
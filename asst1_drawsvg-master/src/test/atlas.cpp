@@ -0,0 +1,133 @@
+/*
+ * Atlas test.
+ * Draws a document of small images, some sharing a payload, once as
+ * parsed and once with its images packed into atlas pages (see
+ * TextureAtlas), at a few scales with every sample method, and checks
+ * that both agree: packing moves texels, it should not change what is
+ * drawn. Samples are placed in page uv, which rounds differently near
+ * texel edges, and trilinear and summed-area sampling of a page differ
+ * where a view minifies past the levels pages keep, so a few pixels may
+ * differ, but the mean difference has to stay well below one level.
+ *
+ * usage: atlas_test
+ */
+
+#include "svg.h"
+#include "png.h"
+#include "base64.h"
+#include "viewport.h"
+#include "texture_atlas.h"
+#include "texture_manager.h"
+#include "software_renderer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace CMU462;
+
+// gradients under a checker of odd sized cells, with a translucent
+// column, as icons have hard edges and soft ones
+static string image( size_t width, size_t height, int seed ) {
+  PNG png; png.width = width; png.height = height;
+  png.pixels.resize(4 * width * height);
+  for (size_t y = 0; y < height; y++) {
+    for (size_t x = 0; x < width; x++) {
+      unsigned char* p = &png.pixels[4 * (y * width + x)];
+      p[0] = (x * 255) / width; p[1] = (y * 255) / height;
+      p[2] = ((x / (3 + seed)) ^ (y / 5)) & 1 ? 255 : 0;
+      p[3] = x % 11 < 2 ? 128 : 255;
+    }
+  }
+  vector<unsigned char> encoded;
+  PNGParser::save(encoded, png);
+  return base64_encode(&encoded[0], encoded.size());
+}
+
+static string document() {
+  const size_t sizes[][2] = { {16, 16}, {32, 24}, {64, 64}, {48, 96},
+                              {128, 128}, {40, 40}, {96, 32}, {128, 80} };
+  string svg = "<svg xmlns=\"http://www.w3.org/2000/svg\" "
+               "xmlns:xlink=\"http://www.w3.org/1999/xlink\" "
+               "width=\"1024\" height=\"512\">\n";
+  char element[256];
+  for (int i = 0; i < 16; i++) {
+
+    // every other image repeats a payload, the second half of the
+    // images are drawn larger than their texels
+    int k = i % 8;
+    string data = image(sizes[k][0], sizes[k][1], i % 2 ? k : 0);
+    snprintf(element, sizeof(element),
+             "<image x=\"%d\" y=\"%d\" width=\"%d\" height=\"%d\" "
+             "xlink:href=\"data:image/png;base64,",
+             (i % 4) * 256 + 20, (i / 4) * 128 + 10,
+             (int) sizes[k][0] * (i / 8 + 2) / 2, (int) sizes[k][1] * (i / 8 + 2) / 2);
+    svg += element + data + "\"/>\n";
+  }
+  return svg + "</svg>\n";
+}
+
+static void render( SVG* svg, Sampler2DImp& sampler, double zoom,
+                    size_t width, size_t height, vector<unsigned char>& pixels ) {
+
+  ViewportImp viewport;
+  viewport.set_viewbox(svg->width / 2, svg->height / 2, svg->width / 2 / zoom);
+  Matrix3x3 norm_to_screen = Matrix3x3::identity();
+  norm_to_screen(0,0) = width; norm_to_screen(1,1) = width;
+  norm_to_screen(1,2) = (height - (double) width) / 2;
+  Matrix3x3 canvas_to_screen = norm_to_screen * viewport.get_canvas_to_norm();
+
+  pixels.assign(4 * width * height, 0);
+  SoftwareRendererImp renderer;
+  renderer.set_tex_sampler(&sampler);
+  renderer.set_render_target(&pixels[0], width, height);
+  renderer.set_sample_rate(1);
+  renderer.set_canvas_to_screen(canvas_to_screen);
+  TextureManager::update(svg, &sampler, canvas_to_screen, 1);
+  renderer.clear_target();
+  renderer.draw_svg(*svg);
+}
+
+int main() {
+
+  string source = document();
+  SVG parsed, packed;
+  if (SVGParser::load(source.data(), source.size(), &parsed) < 0 ||
+      SVGParser::load(source.data(), source.size(), &packed) < 0) {
+    fprintf(stderr, "Could not parse the test document\n");
+    return 1;
+  }
+  Sampler2DImp builder;
+  if (TextureAtlas::pack(&packed, &builder) != 16) {
+    fprintf(stderr, "Not every image was packed\n");
+    return 1;
+  }
+
+  const char* names[4] = { "nearest", "bilinear", "trilinear", "summed-area" };
+  const SampleMethod methods[4] = { NEAREST, BILINEAR, TRILINEAR, SUMMED_AREA };
+  const double zooms[4] = { 4, 1, 0.5, 0.25 };
+  int failed = 0;
+  for (int m = 0; m < 4; m++) {
+    for (int z = 0; z < 4; z++) {
+      Sampler2DImp sampler(methods[m]);
+      vector<unsigned char> a, b;
+      render(&parsed, sampler, zooms[z], 512, 256, a);
+      render(&packed, sampler, zooms[z], 512, 256, b);
+      int worst = 0; double total = 0;
+      for (size_t i = 0; i < a.size(); i++) {
+        int d = abs((int) a[i] - (int) b[i]);
+        worst = max(worst, d);
+        total += d;
+      }
+      double mean = total / a.size();
+      bool ok = mean < 0.1 && worst < 64;
+      printf("%-12s zoom %-5g max %3d mean %.4f %s\n", names[m], zooms[z],
+             worst, mean, ok ? "ok" : "FAILED");
+      failed += !ok;
+    }
+  }
+  return failed ? 1 : 0;
+}
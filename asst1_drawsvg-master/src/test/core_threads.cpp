@@ -0,0 +1,78 @@
+/*
+ * Core library thread test.
+ * Loads and renders documents of the same svg from several threads at
+ * once through the C interface, each thread with documents of its own
+ * but all of them sharing image textures, with every sample method and
+ * zoom level mixed so mip chains and tables are built concurrently. Every
+ * image has to match the one rendered alone. Run under ThreadSanitizer
+ * to check the sharing itself.
+ *
+ * usage: core_threads_test <svg file>
+ */
+
+#include "core/drawsvg_core.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+static const size_t kSize = 256;
+static const int kViews = 8;
+
+// view i: every sample method, close up and from afar
+static int render( const string& source, int i, vector<unsigned char>& rgba ) {
+  drawsvg_document* doc = drawsvg_load_memory(source.data(), source.size());
+  if (!doc) return -1;
+  float width, height;
+  drawsvg_get_size(doc, &width, &height);
+  float span = (i / 4 % 2 ? 0.1f : 2.f) * max(width, height);
+  drawsvg_set_viewport(doc, width / 2, height / 2, span);
+  drawsvg_set_sample_method(doc, (drawsvg_sample_method) (i % 4));
+  rgba.assign(4 * kSize * kSize, 0);
+  int error = drawsvg_render(doc, &rgba[0], kSize, kSize, 0);
+  drawsvg_free(doc);
+  return error;
+}
+
+int main( int argc, char** argv ) {
+
+  if (argc != 2) {
+    fprintf(stderr, "usage: core_threads_test <svg file>\n");
+    return 1;
+  }
+  ifstream file(argv[1], ios::binary);
+  string source((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+
+  vector<vector<unsigned char> > expected(kViews);
+  for (int i = 0; i < kViews; i++) {
+    if (render(source, i, expected[i]) < 0) {
+      fprintf(stderr, "Could not render %s\n", argv[1]);
+      return 1;
+    }
+  }
+
+  // each thread starts at another view, so views are built concurrently
+  atomic<int> failed(0);
+  vector<thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.push_back(thread([&, t]() {
+      vector<unsigned char> rgba;
+      for (int n = 0; n < 2 * kViews; n++) {
+        int i = (t + n) % kViews;
+        if (render(source, i, rgba) < 0 || rgba != expected[i]) failed++;
+      }
+    }));
+  }
+  for (size_t t = 0; t < threads.size(); t++) threads[t].join();
+
+  printf("%d of %d concurrent renders differ\n", failed.load(), 4 * 2 * kViews);
+  return failed ? 1 : 0;
+}
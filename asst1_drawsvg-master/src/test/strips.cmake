@@ -0,0 +1,34 @@
+# Renders an svg whole and in strips, on one thread and on several, and
+# fails unless the images are the same.
+#
+# usage: cmake -DHEADLESS=<drawsvg_headless> -DSVG=<svg file>
+#              -DOUTPUT=<directory> -P strips.cmake
+
+set(ARGS -w 700 -h 500 -s 2 -f ppm)
+
+function(render name threads)
+  execute_process(
+    COMMAND ${CMAKE_COMMAND} -E env OMP_NUM_THREADS=${threads}
+            ${HEADLESS} ${ARGS} ${ARGN} -o ${OUTPUT}/${name}.ppm ${SVG}
+    RESULT_VARIABLE result OUTPUT_QUIET)
+  if(NOT result EQUAL 0)
+    message(FATAL_ERROR "Could not render ${SVG} (${name})")
+  endif()
+endfunction()
+
+function(compare name)
+  execute_process(
+    COMMAND ${CMAKE_COMMAND} -E compare_files
+            ${OUTPUT}/whole.ppm ${OUTPUT}/${name}.ppm
+    RESULT_VARIABLE result)
+  if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${name} differs from the whole image")
+  endif()
+endfunction()
+
+# a megabyte holds 62 rows of 700 pixels at 4 samples each
+render(whole     1)
+render(strips_1  1 -M 1)
+render(strips_3  3 -M 1)
+compare(strips_1)
+compare(strips_3)
@@ -0,0 +1,26 @@
+# Tests, run with ctest. They link the core library only, or run the
+# headless renderer, so they build with the headless tools as well.
+if(DRAWSVG_BUILD_TESTS)
+
+  # packed images draw as unpacked ones
+  add_executable( atlas_test test/atlas.cpp )
+  target_link_libraries( atlas_test drawsvg_core ${CMAKE_THREAD_LIBS_INIT} )
+  add_test( NAME atlas COMMAND atlas_test )
+
+  # documents sharing textures load and render concurrently
+  add_executable( core_threads_test test/core_threads.cpp )
+  target_link_libraries( core_threads_test drawsvg_core ${CMAKE_THREAD_LIBS_INIT} )
+  add_test( NAME core_threads
+            COMMAND core_threads_test ${PROJECT_SOURCE_DIR}/svg/alpha/04_scotty.svg )
+
+  # images drawn in strips are those drawn whole
+  if(DRAWSVG_BUILD_HEADLESS)
+    add_test( NAME strips
+              COMMAND ${CMAKE_COMMAND}
+                      -DHEADLESS=$<TARGET_FILE:drawsvg_headless>
+                      -DSVG=${PROJECT_SOURCE_DIR}/svg/illustration/01_sketchpad.svg
+                      -DOUTPUT=${CMAKE_CURRENT_BINARY_DIR}
+                      -P ${CMAKE_CURRENT_SOURCE_DIR}/test/strips.cmake )
+  endif(DRAWSVG_BUILD_HEADLESS)
+
+endif(DRAWSVG_BUILD_TESTS)
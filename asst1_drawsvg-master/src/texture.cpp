@@ -2,9 +2,16 @@
 #include "color.h"
 
 #include <assert.h>
+#include <stdint.h>
+#include <math.h>
+#include <string.h>
 #include <iostream>
 #include <algorithm>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 using namespace std;
 
 namespace CMU462 {
@@ -31,19 +38,377 @@ inline T interpolate(const T& arg1, const T& arg2, float t)
 	return arg1 + t * (arg2 - arg1);
 }
 
+// byte offset of texel (x, y) of a level
+template <TexelLayout L>
+inline size_t texel_offset(const MipLevel& tex, size_t x, size_t y)
+{
+	if (L == LINEAR_LAYOUT) return 4 * (y * tex.width + x);
+	size_t blocks_w = (tex.width + 3) >> 2;
+	return 4 * ((((y >> 2) * blocks_w + (x >> 2)) << 4) + ((y & 3) << 2) + (x & 3));
+}
+
+template <TexelLayout L>
 inline Color sip(const MipLevel& tex, int x, int y)
 {
 	if (x < 0) x = 0;
 	if (y < 0) y = 0;
 	if (x > tex.width - 1) x = tex.width - 1;
 	if (y > tex.height - 1) y = tex.height - 1;
-	int index = 4 * (y * tex.width + x);
+	size_t index = texel_offset<L>(tex, x, y);
 	float f = 1.f / 255;
 	return Color(tex.texels[index] * f, tex.texels[index+1] * f, tex.texels[index+2] * f, tex.texels[index+3] * f);
 }
 
+/* NOTE:
+ * sRGB textures are filtered in linear light without a pow() per texel.
+ * Decoding an 8-bit value is a lookup in a table of its 256 linear
+ * values. Encoding rounds linear light to 1 / 4095 steps and looks up
+ * the 8-bit value, which is fine enough that every 8-bit value survives
+ * a decode and encode. Alpha is not gamma encoded and is filtered as is.
+ */
+struct SRGBTables {
+
+  static const int kEncodeSteps = 4095;
+
+  float to_linear[256];
+  unsigned char to_srgb[kEncodeSteps + 1];
+
+  SRGBTables() {
+    for (int i = 0; i < 256; i++) {
+      double c = i / 255.0;
+      to_linear[i] = c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+    }
+    for (int i = 0; i <= kEncodeSteps; i++) {
+      double l = (double) i / kEncodeSteps;
+      double c = l <= 0.0031308 ? 12.92 * l : 1.055 * pow(l, 1 / 2.4) - 0.055;
+      to_srgb[i] = (unsigned char) (255 * c + 0.5);
+    }
+  }
+};
+
+static const SRGBTables& srgb_tables() {
+  static const SRGBTables tables;
+  return tables;
+}
+
+// 8-bit texel to linear light, alpha scaled to [0, 1]
+inline void decode_srgb(const SRGBTables& t, const unsigned char* texel, float* linear)
+{
+	linear[0] = t.to_linear[texel[0]];
+	linear[1] = t.to_linear[texel[1]];
+	linear[2] = t.to_linear[texel[2]];
+	linear[3] = texel[3] * (1.f / 255);
+}
+
+// linear light back to an 8-bit texel
+inline void encode_srgb(const SRGBTables& t, const float* linear, unsigned char* texel)
+{
+	const float steps = SRGBTables::kEncodeSteps;
+	for (int c = 0; c < 3; c++) {
+		texel[c] = t.to_srgb[(int) (steps * max(0.f, min(1.f, linear[c])) + 0.5f)];
+	}
+	texel[3] = (unsigned char) (255 * max(0.f, min(1.f, linear[3])) + 0.5f);
+}
+
+#ifdef __SSE2__
+inline __m128 decode_srgb(const SRGBTables& t, const unsigned char* texel)
+{
+	return _mm_setr_ps(t.to_linear[texel[0]], t.to_linear[texel[1]],
+	                   t.to_linear[texel[2]], texel[3] * (1.f / 255));
+}
+
+inline void encode_srgb(const SRGBTables& t, __m128 linear, unsigned char* texel)
+{
+	const float steps = SRGBTables::kEncodeSteps;
+	linear = _mm_min_ps(_mm_max_ps(linear, _mm_setzero_ps()), _mm_set1_ps(1.f));
+	linear = _mm_mul_ps(linear, _mm_setr_ps(steps, steps, steps, 255.f));
+	__m128i index = _mm_cvttps_epi32(_mm_add_ps(linear, _mm_set1_ps(0.5f)));
+	int32_t i[4];
+	_mm_storeu_si128((__m128i*) i, index);
+	texel[0] = t.to_srgb[i[0]];
+	texel[1] = t.to_srgb[i[1]];
+	texel[2] = t.to_srgb[i[2]];
+	texel[3] = (unsigned char) i[3];
+}
+#endif
+
+// texels of sRGB textures are sampled in linear light, S selects that
+template <TexelLayout L, bool S>
+inline Color sip(const MipLevel& tex, int x, int y)
+{
+	if (!S) return sip<L>(tex, x, y);
+	if (x < 0) x = 0;
+	if (y < 0) y = 0;
+	if (x > tex.width - 1) x = tex.width - 1;
+	if (y > tex.height - 1) y = tex.height - 1;
+	float c[4];
+	decode_srgb(srgb_tables(), &tex.texels[texel_offset<L>(tex, x, y)], c);
+	return Color(c[0], c[1], c[2], c[3]);
+}
+
+// encodes a color filtered in linear light
+inline Color encode_srgb(const SRGBTables& t, const Color& linear)
+{
+	unsigned char texel[4];
+	encode_srgb(t, &linear.r, texel);
+	float f = 1.f / 255;
+	return Color(texel[0] * f, texel[1] * f, texel[2] * f, texel[3] * f);
+}
+
+
+/* NOTE:
+ * Levels are reduced with integer box filters. When both dimensions halve
+ * exactly, each texel is the rounded mean of a 2x2 block, computed with
+ * 16-bit lanes a few texels at a time. An odd dimension of 2n + 1 that is
+ * rounded down to n covers three source texels per output texel, with
+ * weights (n - i, n, i + 1) / (2n + 1), so that no source row or column is
+ * dropped or counted twice. Rows of large levels are filtered in parallel.
+ */
+
+// Filter taps of one axis, up to three source texels per output texel.
+struct BoxTaps {
+  std::vector<int> index;   // 3 source indices per output
+  std::vector<int> weight;  // 3 weights per output
+  int denominator;
+
+  BoxTaps(int src, int dst) : index(3 * dst), weight(3 * dst) {
+    for (int i = 0; i < dst; i++) {
+      int* idx = &index[3 * i];
+      int* wt  = &weight[3 * i];
+      if (src == dst) {
+        idx[0] = idx[1] = idx[2] = i;
+        wt[0] = 1; wt[1] = wt[2] = 0;
+      } else if (src == 2 * dst) {
+        idx[0] = 2 * i; idx[1] = idx[2] = 2 * i + 1;
+        wt[0] = wt[1] = 1; wt[2] = 0;
+      } else { // src == 2 * dst + 1
+        idx[0] = 2 * i; idx[1] = 2 * i + 1; idx[2] = 2 * i + 2;
+        wt[0] = dst - i; wt[1] = dst; wt[2] = i + 1;
+      }
+    }
+    denominator = src == dst ? 1 : (src == 2 * dst ? 2 : src);
+  }
+};
+
+// parallelize levels with at least this many texels
+static const size_t kParallelTexels = 256 * 256;
+
+// 2x2 mean of one row pair, dst_w output texels
+static void downsample_row_2x2(const unsigned char* r0, const unsigned char* r1,
+                               unsigned char* dst, size_t dst_w) {
+
+  size_t x = 0;
+#ifdef __SSE2__
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i two  = _mm_set1_epi16(2);
+  for (; x + 4 <= dst_w; x += 4) {
+
+    // 8 source texels of each row, 4 output texels
+    __m128i a0 = _mm_loadu_si128((const __m128i*) (r0 + 8 * x));
+    __m128i a1 = _mm_loadu_si128((const __m128i*) (r0 + 8 * x + 16));
+    __m128i b0 = _mm_loadu_si128((const __m128i*) (r1 + 8 * x));
+    __m128i b1 = _mm_loadu_si128((const __m128i*) (r1 + 8 * x + 16));
+
+    // vertical sums, 2 texels per register
+    __m128i s0 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+    __m128i s1 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+    __m128i s2 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+    __m128i s3 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+
+    // horizontal sums of texel pairs
+    __m128i h0 = _mm_unpacklo_epi64(_mm_add_epi16(s0, _mm_srli_si128(s0, 8)),
+                                    _mm_add_epi16(s1, _mm_srli_si128(s1, 8)));
+    __m128i h1 = _mm_unpacklo_epi64(_mm_add_epi16(s2, _mm_srli_si128(s2, 8)),
+                                    _mm_add_epi16(s3, _mm_srli_si128(s3, 8)));
+
+    h0 = _mm_srli_epi16(_mm_add_epi16(h0, two), 2);
+    h1 = _mm_srli_epi16(_mm_add_epi16(h1, two), 2);
+    _mm_storeu_si128((__m128i*) (dst + 4 * x), _mm_packus_epi16(h0, h1));
+  }
+#endif
+  for (; x < dst_w; x++) {
+    for (int c = 0; c < 4; c++) {
+      dst[4 * x + c] = (r0[8 * x + c] + r0[8 * x + 4 + c] +
+                        r1[8 * x + c] + r1[8 * x + 4 + c] + 2) >> 2;
+    }
+  }
+}
+
+static void downsample(const MipLevel& src, MipLevel& dst) {
+
+  size_t sw = src.width, sh = src.height;
+  size_t dw = dst.width, dh = dst.height;
+  const unsigned char* s = &src.texels[0];
+  unsigned char* d = &dst.texels[0];
+  long rows = dh;
+
+  if (sw == 2 * dw && sh == 2 * dh) {
+    #pragma omp parallel for schedule(static) if (dw * dh >= kParallelTexels)
+    for (long y = 0; y < rows; y++) {
+      downsample_row_2x2(s + 4 * sw * (2 * y), s + 4 * sw * (2 * y + 1),
+                         d + 4 * dw * y, dw);
+    }
+    return;
+  }
+
+  // separable: weighted column sums of the source rows, then across
+  BoxTaps tx(sw, dw), ty(sh, dh);
+  uint64_t denominator = (uint64_t) tx.denominator * ty.denominator;
+
+  // exact for rounding: results that are not whole numbers are at least
+  // 1 / denominator away from one, far above the error of the product
+  double inverse = 1.0 / denominator;
+
+  #pragma omp parallel if (dw * dh >= kParallelTexels)
+  {
+    std::vector<uint32_t> column(4 * sw);
+
+    #pragma omp for schedule(static)
+    for (long y = 0; y < rows; y++) {
+
+      const int* yi = &ty.index[3 * y];
+      const int* yw = &ty.weight[3 * y];
+      std::fill(column.begin(), column.end(), 0);
+      for (int j = 0; j < 3; j++) {
+        if (!yw[j]) continue;
+        const unsigned char* row = s + 4 * sw * yi[j];
+        for (size_t i = 0; i < 4 * sw; i++) column[i] += yw[j] * row[i];
+      }
+
+      unsigned char* out = d + 4 * dw * y;
+      for (size_t x = 0; x < dw; x++) {
+        const int* xi = &tx.index[3 * x];
+        const int* xw = &tx.weight[3 * x];
+        for (int c = 0; c < 4; c++) {
+          uint64_t sum = (uint64_t) xw[0] * column[4 * xi[0] + c] +
+                         (uint64_t) xw[1] * column[4 * xi[1] + c] +
+                         (uint64_t) xw[2] * column[4 * xi[2] + c];
+          out[4 * x + c] = (unsigned char) ((sum + denominator / 2) * inverse + 1e-12);
+        }
+      }
+    }
+  }
+}
+
+// 2x2 mean in linear light of one row pair, dst_w output texels
+static void downsample_row_2x2_srgb(const SRGBTables& t,
+                                    const unsigned char* r0, const unsigned char* r1,
+                                    unsigned char* dst, size_t dst_w) {
+
+  size_t x = 0;
+#ifdef __SSE2__
+  const __m128 quarter = _mm_set1_ps(0.25f);
+  for (; x < dst_w; x++) {
+    __m128 sum = _mm_add_ps(_mm_add_ps(decode_srgb(t, r0 + 8 * x), decode_srgb(t, r0 + 8 * x + 4)),
+                            _mm_add_ps(decode_srgb(t, r1 + 8 * x), decode_srgb(t, r1 + 8 * x + 4)));
+    encode_srgb(t, _mm_mul_ps(sum, quarter), dst + 4 * x);
+  }
+#endif
+  for (; x < dst_w; x++) {
+    float a[4], b[4], c[4], d[4], mean[4];
+    decode_srgb(t, r0 + 8 * x, a);
+    decode_srgb(t, r0 + 8 * x + 4, b);
+    decode_srgb(t, r1 + 8 * x, c);
+    decode_srgb(t, r1 + 8 * x + 4, d);
+    for (int k = 0; k < 4; k++) mean[k] = 0.25f * (a[k] + b[k] + c[k] + d[k]);
+    encode_srgb(t, mean, dst + 4 * x);
+  }
+}
+
+// weighted linear light of a row of texels added to sums, 4 per texel
+static void accumulate_srgb_row(const SRGBTables& t, const unsigned char* row,
+                                size_t w, float weight, float* sums) {
+
+  size_t x = 0;
+#ifdef __SSE2__
+  const __m128 wt = _mm_set1_ps(weight);
+  for (; x < w; x++) {
+    __m128 sum = _mm_loadu_ps(sums + 4 * x);
+    _mm_storeu_ps(sums + 4 * x, _mm_add_ps(sum, _mm_mul_ps(wt, decode_srgb(t, row + 4 * x))));
+  }
+#endif
+  for (; x < w; x++) {
+    float linear[4];
+    decode_srgb(t, row + 4 * x, linear);
+    for (int c = 0; c < 4; c++) sums[4 * x + c] += weight * linear[c];
+  }
+}
+
+// Same taps as downsample, in linear light. Each output row sums its
+// source rows decoded to floats, then the columns are filtered and
+// encoded back through the tables.
+static void downsample_srgb(const MipLevel& src, MipLevel& dst) {
+
+  size_t sw = src.width, sh = src.height;
+  size_t dw = dst.width, dh = dst.height;
+  const unsigned char* s = &src.texels[0];
+  unsigned char* d = &dst.texels[0];
+  const SRGBTables& tables = srgb_tables();
+  long rows = dh;
+
+  if (sw == 2 * dw && sh == 2 * dh) {
+    #pragma omp parallel for schedule(static) if (dw * dh >= kParallelTexels)
+    for (long y = 0; y < rows; y++) {
+      downsample_row_2x2_srgb(tables, s + 4 * sw * (2 * y), s + 4 * sw * (2 * y + 1),
+                              d + 4 * dw * y, dw);
+    }
+    return;
+  }
+
+  BoxTaps tx(sw, dw), ty(sh, dh);
+  float scale = 1.f / ((float) tx.denominator * ty.denominator);
+
+  #pragma omp parallel if (dw * dh >= kParallelTexels)
+  {
+    std::vector<float> column(4 * sw);
+
+    #pragma omp for schedule(static)
+    for (long y = 0; y < rows; y++) {
+
+      const int* yi = &ty.index[3 * y];
+      const int* yw = &ty.weight[3 * y];
+      std::fill(column.begin(), column.end(), 0.f);
+      for (int j = 0; j < 3; j++) {
+        if (!yw[j]) continue;
+        accumulate_srgb_row(tables, s + 4 * sw * yi[j], sw, yw[j], &column[0]);
+      }
+
+      unsigned char* out = d + 4 * dw * y;
+      for (size_t x = 0; x < dw; x++) {
+        const int* xi = &tx.index[3 * x];
+        const int* xw = &tx.weight[3 * x];
+#ifdef __SSE2__
+        __m128 sum = _mm_mul_ps(_mm_set1_ps(xw[0]), _mm_loadu_ps(&column[4 * xi[0]]));
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(xw[1]), _mm_loadu_ps(&column[4 * xi[1]])));
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(xw[2]), _mm_loadu_ps(&column[4 * xi[2]])));
+        encode_srgb(tables, _mm_mul_ps(sum, _mm_set1_ps(scale)), out + 4 * x);
+#else
+        float linear[4];
+        for (int c = 0; c < 4; c++) {
+          linear[c] = scale * (xw[0] * column[4 * xi[0] + c] +
+                               xw[1] * column[4 * xi[1] + c] +
+                               xw[2] * column[4 * xi[2] + c]);
+        }
+        encode_srgb(tables, linear, out + 4 * x);
+#endif
+      }
+    }
+  }
+}
+
+Sampler2D::~Sampler2D() { }
+
+int num_mip_levels( const Texture& tex ) {
+  if (tex.mipmap.empty()) return 0;
+  int size = max(tex.mipmap[0].width, tex.mipmap[0].height);
+  return min((int) log2f((float) size), kMaxMipLevels - 1) + 1;
+}
 
 void Sampler2DImp::generate_mips(Texture& tex, int startLevel) {
+  generate_mips(tex, startLevel, kMaxMipLevels - 1);
+}
+
+void Sampler2DImp::generate_mips(Texture& tex, int startLevel, int endLevel) {
 
   // NOTE(sky): 
   // The starter code allocates the mip levels and generates a level 
@@ -54,16 +419,24 @@ void Sampler2DImp::generate_mips(Texture& tex, int startLevel) {
   // Task 7: Implement this
 
   // check start level
-  if ( startLevel >= tex.mipmap.size() ) {
+  if ( startLevel < 0 || startLevel >= tex.mipmap.size() ) {
     std::cerr << "Invalid start level"; 
+    return;
   }
 
+  // levels are built row-major and reordered afterwards
+  convert_texels(tex, LINEAR_LAYOUT);
+
+  // a new level 0 needs a new summed-area table
+  if (startLevel == 0) tex.sat.clear();
+
   // allocate sublevels
   int baseWidth  = tex.mipmap[startLevel].width;
   int baseHeight = tex.mipmap[startLevel].height;
   int numSubLevels = (int)(log2f( (float)max(baseWidth, baseHeight)));
 
   numSubLevels = min(numSubLevels, kMaxMipLevels - startLevel - 1);
+  numSubLevels = max(0, min(numSubLevels, endLevel - startLevel));
   tex.mipmap.resize(startLevel + numSubLevels + 1);
 
   int width  = baseWidth;
@@ -82,24 +455,39 @@ void Sampler2DImp::generate_mips(Texture& tex, int startLevel) {
 
   }
 
-  // fill all 0 sub levels with interchanging colors
-  Color colors[3] = { Color(1,0,0,1), Color(0,1,0,1), Color(0,0,1,1) };
-  for(size_t i = 1; i < tex.mipmap.size(); ++i) {
-
-    Color c = colors[i % 3];
-    MipLevel& mip = tex.mipmap[i];
-	
-    for(size_t j = 0; j < 4 * mip.width * mip.height; j += 4) {
-	  int index = j * 0.25f;
-	  int x = index % mip.width;
-	  int y = index / mip.width;
-	  Color c = 0.25f * sip(tex.mipmap[i - 1], 2*x, 2*y) +
-		  0.25f * sip(tex.mipmap[i - 1], 2*x + 1, 2*y) +
-		  0.25f * sip(tex.mipmap[i - 1], 2*x, 2*y + 1) +
-		  0.25f * sip(tex.mipmap[i - 1], 2*x + 1,2*y + 1);
-	  float_to_uint8(&mip.texels[j], &c.r);
-    }
+  // filter each level from the one above it
+  for (size_t i = startLevel + 1; i < tex.mipmap.size(); ++i) {
+    if (tex.srgb) downsample_srgb(tex.mipmap[i - 1], tex.mipmap[i]);
+    else downsample(tex.mipmap[i - 1], tex.mipmap[i]);
   }
+
+  convert_texels(tex, layout);
+}
+
+// filters on a level, shared by the per sample and the span interface
+template <TexelLayout L>
+inline Color nearest(const MipLevel& mipTex, float u, float v)
+{
+	float x = mipTex.width * u - 0.5f;
+	float y = mipTex.height * v - 0.5f;
+	int sx = floor(x), sy = floor(y);
+	if (x - sx >= 0.5f) ++sx;
+	if (y - sy >= 0.5f) ++sy;
+	return sip<L>(mipTex, sx, sy);
+}
+
+// in linear light when S, the result is then encoded by the caller
+template <TexelLayout L, bool S>
+inline Color bilinear(const MipLevel& mipTex, float u, float v)
+{
+	float x = mipTex.width * u - 0.5f;
+	float y = mipTex.height * v - 0.5f;
+	int sx = floor(x), sy = floor(y);
+	float tx = x - sx, ty = y - sy;
+
+	Color c1 = interpolate(sip<L,S>(mipTex,sx,sy), sip<L,S>(mipTex, sx+1,sy),tx);
+	Color c2 = interpolate(sip<L,S>(mipTex, sx, sy+1), sip<L,S>(mipTex, sx + 1, sy+1), tx);
+	return interpolate(c1, c2, ty);
 }
 
 Color Sampler2DImp::sample_nearest(Texture& tex, 
@@ -107,37 +495,35 @@ Color Sampler2DImp::sample_nearest(Texture& tex,
                                    int level) {
 
   // Task 6: Implement nearest neighbour interpolation
+
+  // return magenta for invalid level
 	if (level < 0 || level >= tex.mipmap.size())
 		return Color(1, 0, 1, 1);
 
-	MipLevel mipTex = tex.mipmap[level];
-	float x = mipTex.width * u - 0.5f;
-	float y = mipTex.height * v - 0.5f;
-	int sx = floor(x), sy = floor(y);
-	if (x - sx >= 0.5f) ++sx;
-	if (y - sy >= 0.5f) ++sy;
-  // return magenta for invalid level
-	return sip(mipTex, sx, sy);
+	if (tex.layout == TILED_LAYOUT)
+		return nearest<TILED_LAYOUT>(tex.mipmap[level], u, v);
+	return nearest<LINEAR_LAYOUT>(tex.mipmap[level], u, v);
 }
 
 Color Sampler2DImp::sample_bilinear(Texture& tex, 
                                     float u, float v, 
                                     int level) {
-  if (level < 0 || level >= tex.mipmap.size())
-	  return Color(1, 0, 1, 1);
 
   // Task 6: Implement bilinear filtering
-	MipLevel mipTex = tex.mipmap[level];
-	float x = mipTex.width * u - 0.5f;
-	float y = mipTex.height * v - 0.5f;
-	int sx = floor(x), sy = floor(y);
-	float tx = x - sx, ty = y - sy;
 
-	Color c1 = interpolate(sip(mipTex,sx,sy), sip(mipTex, sx+1,sy),tx);
-	Color c2 = interpolate(sip(mipTex, sx, sy+1), sip(mipTex, sx + 1, sy+1), tx);
-	
   // return magenta for invalid level
-	return interpolate(c1, c2, ty);
+  if (level < 0 || level >= tex.mipmap.size())
+	  return Color(1, 0, 1, 1);
+
+	if (tex.srgb) {
+		const MipLevel& mip = tex.mipmap[level];
+		return encode_srgb(srgb_tables(), tex.layout == TILED_LAYOUT
+		                                  ? bilinear<TILED_LAYOUT, true>(mip, u, v)
+		                                  : bilinear<LINEAR_LAYOUT, true>(mip, u, v));
+	}
+	if (tex.layout == TILED_LAYOUT)
+		return bilinear<TILED_LAYOUT, false>(tex.mipmap[level], u, v);
+	return bilinear<LINEAR_LAYOUT, false>(tex.mipmap[level], u, v);
 }
 
 Color Sampler2DImp::sample_trilinear(Texture& tex, 
@@ -145,6 +531,15 @@ Color Sampler2DImp::sample_trilinear(Texture& tex,
                                      float u_scale, float v_scale) {
 
   // Task 7: Implement trilinear filtering
+
+	// sRGB levels are blended in linear light too, which the span does
+	if (tex.srgb) {
+		float uv[2] = { u, v };
+		Color color;
+		sample_span(tex, TRILINEAR, uv, 1, u_scale, v_scale, &color);
+		return color;
+	}
+
 	float L = max(u_scale * tex.width, v_scale * tex.height);
 	float d = log2f(L);
 	int level = floor(d);
@@ -157,4 +552,288 @@ Color Sampler2DImp::sample_trilinear(Texture& tex,
 	return interpolate(c1, c2, d - level);
 }
 
+void Sampler2D::sample_span(Texture& tex, const float* uv, size_t n,
+                            float u_scale, float v_scale, Color* colors) {
+  sample_span(tex, method, uv, n, u_scale, v_scale, colors);
+}
+
+void Sampler2D::sample_span(Texture& tex, SampleMethod method,
+                            const float* uv, size_t n,
+                            float u_scale, float v_scale, Color* colors) {
+
+  for (size_t i = 0; i < n; i++) {
+    float u = uv[2 * i], v = uv[2 * i + 1];
+    switch (method) {
+      case NEAREST:
+        colors[i] = sample_nearest(tex, u, v, 0);
+        break;
+      case BILINEAR:
+        colors[i] = sample_bilinear(tex, u, v, 0);
+        break;
+      case TRILINEAR:
+      case SUMMED_AREA:
+        colors[i] = sample_trilinear(tex, u, v, u_scale, v_scale);
+        break;
+    }
+  }
+}
+
+/* NOTE:
+ * A summed-area table gives the sum of any box of whole texels from its
+ * four corners. A box with fractional edges is split into at most three
+ * runs per axis, the partial texel at each end and the whole texels in
+ * between, and the nine products are weighted by their overlap. That is
+ * the exact average of the box over the texture, at the same cost
+ * whatever the footprint, where mip levels would have to blend two
+ * power of two approximations of it and stop at kMaxMipLevels.
+ */
+
+// per channel sums of texels [x0, x1) x [y0, y1), wrap-safe
+inline void box_sum(const Texture& tex, size_t x0, size_t x1,
+                    size_t y0, size_t y1, uint32_t sum[4])
+{
+	size_t stride = 4 * (tex.mipmap[0].width + 1);
+	const uint32_t* a = &tex.sat[y0 * stride + 4 * x0];
+	const uint32_t* b = &tex.sat[y0 * stride + 4 * x1];
+	const uint32_t* c = &tex.sat[y1 * stride + 4 * x0];
+	const uint32_t* d = &tex.sat[y1 * stride + 4 * x1];
+	for (int k = 0; k < 4; k++) sum[k] = d[k] - b[k] - c[k] + a[k];
+}
+
+// splits [lo, hi) into runs of texels, the partial texel at either end
+// and the whole ones in between, with the overlap of each of their texels
+inline int box_runs(float lo, float hi, size_t begin[3], size_t end[3],
+                    float weight[3])
+{
+	size_t i0 = (size_t) lo, i1 = (size_t) hi;
+	if (hi <= i0 + 1) {
+		begin[0] = i0; end[0] = i0 + 1; weight[0] = hi - lo;
+		return 1;
+	}
+	int n = 0;
+	size_t first = i0;
+	if (lo > i0) {
+		begin[n] = i0; end[n] = i0 + 1; weight[n++] = i0 + 1 - lo;
+		first = i0 + 1;
+	}
+	if (i1 > first) {
+		begin[n] = first; end[n] = i1; weight[n++] = 1;
+	}
+	if (hi > i1) {
+		begin[n] = i1; end[n] = i1 + 1; weight[n++] = hi - i1;
+	}
+	return n;
+}
+
+// box filtered color over a footprint of w by h texels centered at (u, v)
+inline Color summed_area(const Texture& tex, float u, float v, float w, float h)
+{
+	const MipLevel& base = tex.mipmap[0];
+	float x = base.width * u, y = base.height * v;
+	w = max(w, 1.f) * 0.5f; h = max(h, 1.f) * 0.5f;
+	float x0 = max(x - w, 0.f), x1 = min(x + w, (float) base.width);
+	float y0 = max(y - h, 0.f), y1 = min(y + h, (float) base.height);
+
+	// footprint entirely off the texture, use the nearest edge texel
+	if (x0 >= x1) { x0 = min(x0, base.width - 1.f); x1 = x0 + 1; }
+	if (y0 >= y1) { y0 = min(y0, base.height - 1.f); y1 = y0 + 1; }
+
+	size_t xb[3], xe[3], yb[3], ye[3]; float xw[3], yw[3];
+	int nx = box_runs(x0, x1, xb, xe, xw);
+	int ny = box_runs(y0, y1, yb, ye, yw);
+
+	float acc[4] = { 0, 0, 0, 0 };
+	for (int j = 0; j < ny; j++) {
+		for (int i = 0; i < nx; i++) {
+			uint32_t sum[4];
+			box_sum(tex, xb[i], xe[i], yb[j], ye[j], sum);
+			float wt = xw[i] * yw[j];
+			for (int k = 0; k < 4; k++) acc[k] += wt * sum[k];
+		}
+	}
+	float f = 1.f / (255.f * (x1 - x0) * (y1 - y0));
+	return Color(acc[0] * f, acc[1] * f, acc[2] * f, acc[3] * f);
+}
+
+// span filtering with one sample method on one texel layout, in linear
+// light when S, see Sampler2DImp::sample_span
+template <TexelLayout L, SampleMethod M, bool S>
+static void filter_span(Texture& tex, const float* uv, size_t n,
+                        float u_scale, float v_scale, Color* colors) {
+
+  // nearest texels are not filtered and need no decoding
+  if (M == NEAREST) {
+    const MipLevel& base = tex.mipmap[0];
+    for (size_t i = 0; i < n; i++) {
+      colors[i] = nearest<L>(base, uv[2 * i], uv[2 * i + 1]);
+    }
+    return;
+  }
+
+  // falls back to trilinear when the texture is too large for a table,
+  // and for sRGB textures, whose table would have to sum linear light
+  if (M == SUMMED_AREA && !S &&
+      (!tex.sat.empty() || build_summed_area_table(tex) == 0)) {
+    float w = u_scale * tex.mipmap[0].width, h = v_scale * tex.mipmap[0].height;
+    for (size_t i = 0; i < n; i++) {
+      colors[i] = summed_area(tex, uv[2 * i], uv[2 * i + 1], w, h);
+    }
+    return;
+  }
+
+  // the footprint is shared, so is the level pair (see sample_trilinear)
+  int level = 0; float t = 0;
+  if (M == TRILINEAR || M == SUMMED_AREA) {
+    float footprint = max(u_scale * tex.width, v_scale * tex.height);
+    float d = log2f(footprint);
+    level = floor(d);
+    t = d - level;
+    if (level < 0) {
+      level = 0; t = 0;
+    } else if (level >= (int) tex.mipmap.size() - 1) {
+      level = tex.mipmap.size() - 1; t = 0;
+    }
+  }
+
+  const MipLevel& mip0 = tex.mipmap[level];
+  if (t == 0) {
+    for (size_t i = 0; i < n; i++) {
+      colors[i] = bilinear<L, S>(mip0, uv[2 * i], uv[2 * i + 1]);
+    }
+  } else {
+    const MipLevel& mip1 = tex.mipmap[level + 1];
+    for (size_t i = 0; i < n; i++) {
+      float u = uv[2 * i], v = uv[2 * i + 1];
+      colors[i] = interpolate(bilinear<L, S>(mip0, u, v), bilinear<L, S>(mip1, u, v), t);
+    }
+  }
+
+  if (S) {
+    const SRGBTables& tables = srgb_tables();
+    for (size_t i = 0; i < n; i++) colors[i] = encode_srgb(tables, colors[i]);
+  }
+}
+
+template <TexelLayout L, bool S>
+static void filter_span(Texture& tex, SampleMethod method,
+                        const float* uv, size_t n,
+                        float u_scale, float v_scale, Color* colors) {
+  switch (method) {
+    case NEAREST:
+      filter_span<L, NEAREST, S>(tex, uv, n, u_scale, v_scale, colors);
+      break;
+    case BILINEAR:
+      filter_span<L, BILINEAR, S>(tex, uv, n, u_scale, v_scale, colors);
+      break;
+    case TRILINEAR:
+      filter_span<L, TRILINEAR, S>(tex, uv, n, u_scale, v_scale, colors);
+      break;
+    case SUMMED_AREA:
+      filter_span<L, SUMMED_AREA, S>(tex, uv, n, u_scale, v_scale, colors);
+      break;
+  }
+}
+
+void Sampler2DImp::sample_span(Texture& tex, const float* uv, size_t n,
+                               float u_scale, float v_scale, Color* colors) {
+  sample_span(tex, method, uv, n, u_scale, v_scale, colors);
+}
+
+void Sampler2DImp::sample_span(Texture& tex, SampleMethod method,
+                               const float* uv, size_t n,
+                               float u_scale, float v_scale, Color* colors) {
+
+  if (tex.mipmap.empty()) {
+    for (size_t i = 0; i < n; i++) colors[i] = Color(1, 0, 1, 1);
+    return;
+  }
+
+  if (tex.layout == TILED_LAYOUT) {
+    if (tex.srgb) filter_span<TILED_LAYOUT, true>(tex, method, uv, n, u_scale, v_scale, colors);
+    else filter_span<TILED_LAYOUT, false>(tex, method, uv, n, u_scale, v_scale, colors);
+  } else {
+    if (tex.srgb) filter_span<LINEAR_LAYOUT, true>(tex, method, uv, n, u_scale, v_scale, colors);
+    else filter_span<LINEAR_LAYOUT, false>(tex, method, uv, n, u_scale, v_scale, colors);
+  }
+}
+
+// Reorders one level between layouts. Padding texels of tiled levels
+// repeat the last row and column.
+static void convert_level(MipLevel& mip, TexelLayout from, TexelLayout to) {
+
+  size_t w = mip.width, h = mip.height;
+  size_t pw = (w + 3) & ~3, ph = (h + 3) & ~3;
+  const vector<unsigned char>& src = mip.texels;
+  vector<unsigned char> dst(to == TILED_LAYOUT ? 4 * pw * ph : 4 * w * h);
+
+  size_t dw = to == TILED_LAYOUT ? pw : w;
+  size_t dh = to == TILED_LAYOUT ? ph : h;
+  for (size_t y = 0; y < dh; y++) {
+    size_t sy = min(y, h - 1);
+    for (size_t x = 0; x < dw; x++) {
+      size_t sx = min(x, w - 1);
+      size_t s = from == TILED_LAYOUT ? texel_offset<TILED_LAYOUT>(mip, sx, sy)
+                                      : texel_offset<LINEAR_LAYOUT>(mip, sx, sy);
+      size_t d = to == TILED_LAYOUT ? texel_offset<TILED_LAYOUT>(mip, x, y)
+                                    : texel_offset<LINEAR_LAYOUT>(mip, x, y);
+      memcpy(&dst[d], &src[s], 4);
+    }
+  }
+  mip.texels.swap(dst);
+}
+
+size_t texel_offset( const MipLevel& level, TexelLayout layout,
+                     size_t x, size_t y ) {
+  return layout == TILED_LAYOUT ? texel_offset<TILED_LAYOUT>(level, x, y)
+                                : texel_offset<LINEAR_LAYOUT>(level, x, y);
+}
+
+void convert_texels( Texture& tex, TexelLayout layout ) {
+  if (tex.layout == layout) return;
+  for (size_t i = 0; i < tex.mipmap.size(); i++) {
+    convert_level(tex.mipmap[i], tex.layout, layout);
+  }
+  tex.layout = layout;
+}
+
+template <TexelLayout L>
+static void build_table(const MipLevel& base, uint32_t* sat) {
+
+  size_t stride = 4 * (base.width + 1);
+  memset(sat, 0, stride * sizeof(uint32_t));
+  for (size_t y = 0; y < base.height; y++) {
+    const uint32_t* above = sat + y * stride;
+    uint32_t* row = sat + (y + 1) * stride;
+    uint32_t run[4] = { 0, 0, 0, 0 };
+    row[0] = row[1] = row[2] = row[3] = 0;
+    for (size_t x = 0; x < base.width; x++) {
+      const unsigned char* texel = &base.texels[texel_offset<L>(base, x, y)];
+      for (int k = 0; k < 4; k++) {
+        run[k] += texel[k];
+        row[4 * (x + 1) + k] = above[4 * (x + 1) + k] + run[k];
+      }
+    }
+  }
+}
+
+bool summed_area_table_fits( const Texture& tex ) {
+  if (tex.mipmap.empty()) return false;
+  const MipLevel& base = tex.mipmap[0];
+  return base.width && base.height &&
+         base.width * base.height <= 0xffffffffu / 255;
+}
+
+int build_summed_area_table( Texture& tex ) {
+
+  // a texture without a table is left untouched, it may be shared
+  if (!summed_area_table_fits(tex)) return -1;
+
+  const MipLevel& base = tex.mipmap[0];
+  tex.sat.clear();
+  tex.sat.resize(4 * (base.width + 1) * (base.height + 1));
+  if (tex.layout == TILED_LAYOUT) build_table<TILED_LAYOUT>(base, &tex.sat[0]);
+  else build_table<LINEAR_LAYOUT>(base, &tex.sat[0]);
+  return 0;
+}
+
 } // namespace CMU462
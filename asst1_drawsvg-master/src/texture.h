@@ -2,6 +2,7 @@
 #define CMU462_TEXTURE_H
 
 #include <vector>
+#include <stdint.h>
 #include "CMU462.h"
 
 namespace CMU462 {
@@ -11,9 +12,23 @@ static const int kMaxMipLevels = 14;
 typedef enum SampleMethod{
   NEAREST,
   BILINEAR,
-  TRILINEAR
+  TRILINEAR,
+  SUMMED_AREA
 } SampleMethod;
 
+/**
+ * Storage order of the texels of every level of a texture.
+ * LINEAR_LAYOUT is row-major. TILED_LAYOUT stores 4x4 blocks of texels,
+ * one 64 byte cache line each, in row-major block order, with the level
+ * padded to whole blocks. A bilinear footprint then mostly falls in one
+ * line whatever direction the texture is walked in. Only Sampler2DImp
+ * reads tiled texels; the reference sampler and renderer expect linear.
+ */
+typedef enum TexelLayout {
+  LINEAR_LAYOUT,
+  TILED_LAYOUT
+} TexelLayout;
+
 struct MipLevel {
   size_t width; 
   size_t height;
@@ -21,11 +36,49 @@ struct MipLevel {
 };
 
 struct Texture {
+
+  Texture() : width ( 0 ), height ( 0 ), layout ( LINEAR_LAYOUT ),
+              srgb ( false ) { }
+
   size_t width;
   size_t height;
   std::vector<MipLevel> mipmap;
+
+  // texel layout of all levels
+  TexelLayout layout;
+
+  // summed-area table of level 0, empty until SUMMED_AREA sampling
+  // needs it, see build_summed_area_table and TextureManager
+  std::vector<uint32_t> sat;
+
+  // texels are sRGB encoded and are mipmapped and filtered in linear
+  // light by Sampler2DImp, which keeps minified images from darkening.
+  // Off by default, filtering the encoded values is cheaper.
+  bool srgb;
 };
 
+// number of levels of the full mip chain of tex, level 0 included
+int num_mip_levels( const Texture& tex );
+
+// reorders the texels of all levels of tex to the given layout
+void convert_texels( Texture& tex, TexelLayout layout );
+
+// byte offset of texel (x, y) of a level stored in the given layout
+size_t texel_offset( const MipLevel& level, TexelLayout layout,
+                     size_t x, size_t y );
+
+/**
+ * Builds the summed-area table of level 0 of tex. Entry (x, y) holds the
+ * per channel sums of all texels above and left of it, (width + 1) by
+ * (height + 1) entries of 4 channels. Sums wrap around, which keeps box
+ * sums exact as long as a box holds less than 2^32 / 255 texels, so
+ * larger textures get no table and -1 is returned.
+ */
+int build_summed_area_table( Texture& tex );
+
+// whether build_summed_area_table() can build a table for tex
+bool summed_area_table_fits( const Texture& tex );
+
 class Sampler2D {
  public:
 
@@ -46,6 +99,16 @@ class Sampler2D {
   virtual Color sample_trilinear(Texture& tex, 
                                  float u, float v, 
                                  float u_scale, float v_scale) = 0;
+
+  // Filters n samples sharing one footprint with the sample method of
+  // the sampler. uv holds n (u, v) pairs, colors receives n results.
+  void sample_span(Texture& tex, const float* uv, size_t n,
+                   float u_scale, float v_scale, Color* colors);
+
+  // same, with the given sample method instead of the sampler's
+  void sample_span(Texture& tex, SampleMethod method,
+                   const float* uv, size_t n,
+                   float u_scale, float v_scale, Color* colors);
   
   inline SampleMethod get_sample_method() const {
     return method;
@@ -60,10 +123,26 @@ class Sampler2D {
 class Sampler2DImp : public Sampler2D {
  public:
 
-  Sampler2DImp( SampleMethod method = TRILINEAR ) : Sampler2D ( method ) { }
+  Sampler2DImp( SampleMethod method = TRILINEAR )
+    : Sampler2D ( method ), layout ( LINEAR_LAYOUT ) { }
+
+  // layout that generate_mips leaves textures in
+  inline void set_texel_layout( TexelLayout layout ) {
+    this->layout = layout;
+  }
+
+  // SUMMED_AREA suits thumbnails and overviews of large images
+  inline void set_sample_method( SampleMethod method ) {
+    this->method = method;
+  }
   
   void generate_mips( Texture& tex, int startLevel );
 
+  // Keeps levels up to startLevel and rebuilds the ones below it down to
+  // endLevel at most, dropping any coarser ones. Spans sample a partial
+  // chain as if it were full, clamped to its coarsest level.
+  void generate_mips( Texture& tex, int startLevel, int endLevel );
+
   Color sample_nearest(Texture& tex, 
                        float u, float v, 
                        int level = 0);
@@ -75,6 +154,20 @@ class Sampler2DImp : public Sampler2D {
   Color sample_trilinear(Texture& tex, 
                          float u, float v, 
                          float u_scale, float v_scale);
+
+  // same as Sampler2D::sample_span, with the level selected once for the
+  // span and a loop compiled for each sample method and texel layout, so
+  // there are no virtual calls or branches per sample
+  void sample_span(Texture& tex, const float* uv, size_t n,
+                   float u_scale, float v_scale, Color* colors);
+
+  void sample_span(Texture& tex, SampleMethod method,
+                   const float* uv, size_t n,
+                   float u_scale, float v_scale, Color* colors);
+
+ private:
+
+  TexelLayout layout;
   
 }; // class sampler2DImp
 
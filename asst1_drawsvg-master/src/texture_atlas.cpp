@@ -0,0 +1,194 @@
+#include "texture_atlas.h"
+#include "texture_cache.h"
+
+#include <map>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+namespace CMU462 {
+
+namespace {
+
+struct Slot {
+  Image* image;       // first image with this payload
+  size_t width;       // texels of the image
+  size_t height;
+  size_t page;        // placement, of the image's first texel
+  size_t x, y;
+};
+
+inline size_t padded(size_t size) {
+  const size_t p = TextureAtlas::kPadding;
+  return (size + 2 * p + p - 1) / p * p;
+}
+
+// taller first keeps shelves tight
+bool taller(const Slot* a, const Slot* b) {
+  if (a->height != b->height) return a->height > b->height;
+  return a->width > b->width;
+}
+
+void collect(vector<SVGElement*>& elements, vector<Image*>& images) {
+  for (size_t i = 0; i < elements.size(); i++) {
+    SVGElement* element = elements[i];
+    if (element->type == GROUP) {
+      collect(static_cast<Group*>(element)->elements, images);
+    } else if (element->type == IMAGE) {
+      Image* image = static_cast<Image*>(element);
+      if (image->atlas || image->vtex || image->tex.srgb ||
+          image->sampled().mipmap.empty()) continue;
+      const MipLevel& base = image->sampled().mipmap[0];
+      if (base.width  && base.width  <= TextureAtlas::kMaxImageSize &&
+          base.height && base.height <= TextureAtlas::kMaxImageSize) {
+        images.push_back(image);
+      }
+    }
+  }
+}
+
+// copies an image into a linear page with its edges repeated into the
+// border around it
+void blit(const Texture& src, MipLevel& page, size_t x0, size_t y0) {
+  const MipLevel& base = src.mipmap[0];
+  const int p = TextureAtlas::kPadding;
+  for (int y = -p; y < (int) base.height + p; y++) {
+    size_t sy = min(max(y, 0), (int) base.height - 1);
+    unsigned char* dst = &page.texels[4 * ((y0 + y) * page.width + x0 - p)];
+    for (int x = -p; x < (int) base.width + p; x++, dst += 4) {
+      size_t sx = min(max(x, 0), (int) base.width - 1);
+      const unsigned char* texel = &base.texels[texel_offset(base, src.layout, sx, sy)];
+      dst[0] = texel[0]; dst[1] = texel[1]; dst[2] = texel[2]; dst[3] = texel[3];
+    }
+  }
+}
+
+} // namespace
+
+int TextureAtlas::pack( SVG* svg, Sampler2D* sampler ) {
+
+  vector<Image*> images;
+  collect(svg->elements, images);
+  if (images.empty()) return 0;
+
+  // one slot per payload
+  vector<Slot> slots;
+  vector<size_t> slot_of(images.size());
+  map<uint64_t, size_t> by_key;
+  slots.reserve(images.size());
+  for (size_t i = 0; i < images.size(); i++) {
+    Image* image = images[i];
+    if (image->tex_key) {
+      map<uint64_t, size_t>::iterator it = by_key.find(image->tex_key);
+      if (it != by_key.end()) { slot_of[i] = it->second; continue; }
+      by_key[image->tex_key] = slots.size();
+    }
+    const MipLevel& base = image->sampled().mipmap[0];
+    Slot slot = { image, base.width, base.height, 0, 0, 0 };
+    slot_of[i] = slots.size();
+    slots.push_back(slot);
+  }
+
+  // shelf packing, page heights are what their shelves use
+  vector<Slot*> order(slots.size());
+  for (size_t i = 0; i < slots.size(); i++) order[i] = &slots[i];
+  sort(order.begin(), order.end(), taller);
+
+  vector<size_t> heights(1, 0);
+  size_t x = 0, y = 0, shelf = 0;
+  for (size_t i = 0; i < order.size(); i++) {
+    Slot* slot = order[i];
+    size_t w = padded(slot->width), h = padded(slot->height);
+    if (x + w > kPageSize) {
+      x = 0; y += shelf; shelf = 0;
+    }
+    if (y + h > kPageSize) {
+      heights.push_back(0);
+      x = y = shelf = 0;
+    }
+    slot->page = heights.size() - 1;
+    slot->x = x + kPadding;
+    slot->y = y + kPadding;
+    x += w;
+    shelf = max(shelf, h);
+    heights.back() = y + shelf;
+  }
+
+  // allocate and fill the pages
+  size_t first_page = svg->atlas.size();
+  for (size_t i = 0; i < heights.size(); i++) {
+    Texture* page = new Texture();
+    page->width  = kPageSize;
+    page->height = heights[i];
+    page->mipmap.resize(1);
+    page->mipmap[0].width  = page->width;
+    page->mipmap[0].height = page->height;
+    page->mipmap[0].texels.resize(4 * page->width * page->height);
+    svg->atlas.push_back(page);
+  }
+
+  #pragma omp parallel for schedule(dynamic)
+  for (int i = 0; i < (int) slots.size(); i++) {
+    const Slot& slot = slots[i];
+    blit(slot.image->sampled(), svg->atlas[first_page + slot.page]->mipmap[0], slot.x, slot.y);
+  }
+
+  // the borders keep images apart for the first kAtlasLevels levels
+  for (size_t i = first_page; i < svg->atlas.size(); i++) {
+    Texture& page = *svg->atlas[i];
+    sampler->generate_mips(page, 0);
+    if (page.mipmap.size() > kAtlasLevels) page.mipmap.resize(kAtlasLevels);
+  }
+
+  // point the images at their rectangles and release their textures
+  for (size_t i = 0; i < images.size(); i++) {
+    Image* image = images[i];
+    const Slot& slot = slots[slot_of[i]];
+    Texture* page = svg->atlas[first_page + slot.page];
+    image->atlas = page;
+    image->atlas_origin = Vector2D((double) slot.x / page->width,
+                                   (double) slot.y / page->height);
+    image->atlas_size   = Vector2D((double) slot.width  / page->width,
+                                   (double) slot.height / page->height);
+  }
+  for (size_t i = 0; i < images.size(); i++) {
+    Image* image = images[i];
+    TextureCache::remove(image);
+    image->tex_key = 0;
+    image->texture.reset();
+    image->tex = Texture();
+  }
+
+  return images.size();
+}
+
+int TextureAtlas::extract( const Image& image, Texture& tex ) {
+
+  if (!image.atlas) return -1;
+
+  const Texture& page = *image.atlas;
+  const MipLevel& base = page.mipmap[0];
+  size_t x0 = (size_t) (image.atlas_origin.x * page.width  + 0.5);
+  size_t y0 = (size_t) (image.atlas_origin.y * page.height + 0.5);
+  size_t w  = (size_t) (image.atlas_size.x   * page.width  + 0.5);
+  size_t h  = (size_t) (image.atlas_size.y   * page.height + 0.5);
+
+  tex = Texture();
+  tex.width  = w;
+  tex.height = h;
+  tex.mipmap.resize(1);
+  MipLevel& level = tex.mipmap[0];
+  level.width  = w;
+  level.height = h;
+  level.texels.resize(4 * w * h);
+  for (size_t y = 0; y < h; y++) {
+    for (size_t x = 0; x < w; x++) {
+      const unsigned char* texel = &base.texels[texel_offset(base, page.layout, x0 + x, y0 + y)];
+      copy(texel, texel + 4, &level.texels[4 * (y * w + x)]);
+    }
+  }
+  return 0;
+}
+
+} // namespace CMU462
@@ -0,0 +1,50 @@
+#ifndef CMU462_TEXTURE_ATLAS_H
+#define CMU462_TEXTURE_ATLAS_H
+
+#include "svg.h"
+#include "texture.h"
+
+namespace CMU462 {
+
+/**
+ * Atlas pages for small images.
+ * Documents full of icons carry thousands of tiny textures, each with its
+ * own mip chain and a heap allocation per level. Packing moves the decoded
+ * texels of small images into shared pages owned by the svg, one texture
+ * with one mip chain per page, and leaves each image with the uv rectangle
+ * of its texels in the page. Images with the same payload share a
+ * rectangle. Every rectangle sits kPadding texels from its neighbours on
+ * a kPadding grid, with its edge texels repeated into the border, so the
+ * kAtlasLevels mip levels a page keeps never mix two images. Pages are
+ * filtered as encoded values, so sRGB textures are left unpacked.
+ * The reference renderer reads Image::tex directly, so svgs that it may
+ * draw must not be packed; drawsvg_headless packs them with -a.
+ */
+class TextureAtlas {
+ public:
+
+  // images up to this size in both dimensions are packed
+  static const size_t kMaxImageSize = 128;
+
+  // page width and maximum page height
+  static const size_t kPageSize = 1024;
+
+  // border around each image, and the grid images are placed on
+  static const size_t kPadding = 8;
+
+  // mip levels kept per page, as many as the border keeps apart
+  static const size_t kAtlasLevels = 4;
+
+  // packs the small images of svg into pages and generates their mips
+  // with sampler, returns the number of images packed
+  static int pack( SVG* svg, Sampler2D* sampler );
+
+  // copies the texels of a packed image out of its page into tex as a
+  // single row-major level, returns -1 if the image is not packed
+  static int extract( const Image& image, Texture& tex );
+
+}; // class TextureAtlas
+
+} // namespace CMU462
+
+#endif // CMU462_TEXTURE_ATLAS_H
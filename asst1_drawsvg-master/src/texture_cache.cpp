@@ -0,0 +1,186 @@
+#include "texture_cache.h"
+
+#include <map>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+namespace CMU462 {
+
+/* NOTE:
+ * Shared textures are immutable, so an image can be drawn while another
+ * thread parses a document that shares its payload, or builds levels the
+ * other document needs. A texture is only ever replaced, under the lock,
+ * by a more complete copy. A payload is held once per color space, plus
+ * for a while the older textures still held by images that have not
+ * asked for the latest one, plus the copies in Image::tex made for the
+ * reference renderer.
+ */
+namespace {
+
+struct Entry {
+
+  // images using this payload in this color space, the reference count
+  vector<Image*> users;
+
+  // latest texture, and the tiles of streamed images
+  shared_ptr<const Texture> texture;
+  shared_ptr<VirtualTexture> vtex;
+};
+
+typedef pair<uint64_t, bool> Key;
+
+struct Registry {
+  mutex lock;
+  map<Key, Entry> entries;
+};
+
+// never destroyed, images may outlive static destruction
+Registry& registry() {
+  static Registry* registry = new Registry();
+  return *registry;
+}
+
+inline Key key_of( const Image* image ) {
+  return Key(image->tex_key, image->tex.srgb);
+}
+
+// texture has levels down to end, and its table if it is to have one
+bool covers( const Texture& tex, int end, bool table ) {
+  return (int) tex.mipmap.size() > end &&
+         (!table || tex.srgb || !tex.sat.empty() ||
+          !summed_area_table_fits(tex));
+}
+
+} // namespace
+
+uint64_t TextureCache::key( const char* data, size_t length ) {
+
+  // 64-bit FNV-1a over the payload, whitespace is part of the payload
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ (unsigned char) data[i]) * 1099511628211ull;
+  }
+  hash ^= length;
+  return hash ? hash : 1;
+}
+
+bool TextureCache::share( Image* image ) {
+
+  if (!image->tex_key) return false;
+  Registry& r = registry();
+  lock_guard<mutex> guard(r.lock);
+  map<Key, Entry>::iterator it = r.entries.find(key_of(image));
+  if (it != r.entries.end() && it->second.texture) {
+    image->texture = it->second.texture;
+    image->vtex    = it->second.vtex;
+    return true;
+  }
+
+  // the payload in the other color space, whose levels are filtered the
+  // other way and are not shared
+  it = r.entries.find(Key(image->tex_key, !image->tex.srgb));
+  if (it == r.entries.end() || !it->second.texture) return false;
+  const Texture& other = *it->second.texture;
+  shared_ptr<Texture> texture = make_shared<Texture>();
+  texture->width  = other.width;
+  texture->height = other.height;
+  texture->layout = other.layout;
+  texture->srgb   = image->tex.srgb;
+  texture->mipmap.assign(other.mipmap.begin(), other.mipmap.begin() + 1);
+
+  Entry& entry = r.entries[key_of(image)];
+  entry.texture = texture;
+  entry.vtex    = it->second.vtex;
+  image->texture = entry.texture;
+  image->vtex    = entry.vtex;
+  return true;
+}
+
+void TextureCache::add( Image* image ) {
+
+  // decoded texels become the shared texture, keeping the color space
+  if (!image->texture && !image->tex.mipmap.empty()) {
+    shared_ptr<Texture> texture = make_shared<Texture>();
+    swap(*texture, image->tex);
+    image->tex.srgb = texture->srgb;
+    image->texture = texture;
+  }
+  if (!image->tex_key) return;
+
+  Registry& r = registry();
+  lock_guard<mutex> guard(r.lock);
+  Entry& entry = r.entries[key_of(image)];
+  if (!entry.texture) {
+    entry.texture = image->texture;
+    entry.vtex    = image->vtex;
+  } else if (image->texture != entry.texture) {
+    image->texture = entry.texture;
+    image->vtex    = entry.vtex;
+  }
+  entry.users.push_back(image);
+}
+
+void TextureCache::remove( Image* image ) {
+
+  if (!image->tex_key) return;
+  Registry& r = registry();
+  lock_guard<mutex> guard(r.lock);
+  map<Key, Entry>::iterator it = r.entries.find(key_of(image));
+  if (it == r.entries.end()) return;
+
+  Entry& entry = it->second;
+  entry.users.erase(std::remove(entry.users.begin(), entry.users.end(), image),
+                    entry.users.end());
+  if (entry.users.empty()) r.entries.erase(it);
+}
+
+shared_ptr<const Texture> TextureCache::extend( Image* image,
+                                                Sampler2DImp* sampler,
+                                                int end, bool table ) {
+
+  Registry& r = registry();
+  shared_ptr<const Texture> current;
+  if (image->tex_key) {
+    lock_guard<mutex> guard(r.lock);
+    map<Key, Entry>::iterator it = r.entries.find(key_of(image));
+    if (it != r.entries.end()) current = it->second.texture;
+  }
+  if (!current) current = image->texture;
+  if (!current || current->mipmap.empty()) return current;
+  end = min(end, num_mip_levels(*current) - 1);
+  if (covers(*current, end, table)) return current;
+
+  // the levels there are, completed in a copy
+  shared_ptr<Texture> texture = make_shared<Texture>();
+  int have = (int) current->mipmap.size() - 1;
+  texture->width  = current->width;
+  texture->height = current->height;
+  texture->layout = current->layout;
+  texture->srgb   = current->srgb;
+  texture->mipmap.assign(current->mipmap.begin(), current->mipmap.end());
+  if (end > have) sampler->generate_mips(*texture, have, end);
+  texture->sat = current->sat;
+  if (table && !texture->srgb && texture->sat.empty()) {
+    build_summed_area_table(*texture);
+  }
+
+  if (image->tex_key) {
+    lock_guard<mutex> guard(r.lock);
+    map<Key, Entry>::iterator it = r.entries.find(key_of(image));
+    if (it != r.entries.end()) {
+
+      // another thread may have completed it meanwhile
+      Entry& entry = it->second;
+      if (entry.texture != current && covers(*entry.texture, end, table)) {
+        return entry.texture;
+      }
+      entry.texture = texture;
+    }
+  }
+  return texture;
+}
+
+} // namespace CMU462
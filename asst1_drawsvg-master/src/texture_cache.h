@@ -0,0 +1,52 @@
+#ifndef CMU462_TEXTURE_CACHE_H
+#define CMU462_TEXTURE_CACHE_H
+
+#include <memory>
+#include <stdint.h>
+
+#include "svg.h"
+#include "texture.h"
+
+namespace CMU462 {
+
+/**
+ * Registry of image textures by content.
+ * Images are keyed by a hash of their encoded payload. The images with
+ * the same payload and color space, in any svg, share one texture
+ * (Image::texture), which is decoded once and never changed once shared:
+ * extending its mip chain or adding its summed-area table builds a new
+ * texture that replaces it for images that ask afterwards, while images
+ * drawing the old one keep it until they do. Entries are reference
+ * counted by the images that use them and go away with the last one.
+ */
+class TextureCache {
+ public:
+
+  // key of an encoded image payload, 0 is never a valid key
+  static uint64_t key( const char* data, size_t length );
+
+  // gives image the shared texture of a loaded image with the same key
+  // and color space (image->tex.srgb), returns false if there is none
+  // and the image has to be decoded
+  static bool share( Image* image );
+
+  // Registers an image under its key. Texels decoded into image->tex
+  // move into a new shared texture, or are dropped for the one another
+  // image registered meanwhile. Images without a key get a texture of
+  // their own.
+  static void add   ( Image* image );
+  static void remove( Image* image );
+
+  // Latest shared texture of image with levels down to end at least and
+  // a summed-area table if table (and the texture can have one). A
+  // texture that falls short is copied and completed by sampler, and the
+  // copy is shared from then on. Returns NULL for images without texels.
+  static std::shared_ptr<const Texture> extend( Image* image,
+                                                Sampler2DImp* sampler,
+                                                int end, bool table );
+
+}; // class TextureCache
+
+} // namespace CMU462
+
+#endif // CMU462_TEXTURE_CACHE_H
@@ -0,0 +1,229 @@
+#include "texture_manager.h"
+
+#include <map>
+#include <memory>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include "vector3D.h"
+#include "texture_cache.h"
+
+using namespace std;
+
+namespace CMU462 {
+
+namespace {
+
+// images sharing a payload and color space
+struct Job {
+
+  Job() : need ( 0 ), builder ( NULL ), have ( -1 ) { }
+
+  vector<Image*> images;
+  int need;
+
+  // image whose copy in Image::tex has the most valid levels, and how
+  // many, for the reference sampler
+  Image* builder;
+  int have;
+};
+
+Vector2D apply( const Matrix3x3& m, const Vector2D& p ) {
+  Vector3D u = m * Vector3D(p.x, p.y, 1.0);
+  return Vector2D(u.x / u.z, u.y / u.z);
+}
+
+// levels of the copy of image usable as they are, -1 if it needs a new
+// chain
+int valid_levels( Image* image, Sampler2D* sampler ) {
+  if (image->mips_dirty || image->mip_sampler != sampler) return -1;
+  return (int) image->tex.mipmap.size() - 1;
+}
+
+// level 0 of the shared texture copied to Image::tex, row-major
+void copy_base( Image* image ) {
+  const Texture& shared = *image->texture;
+  Texture& tex = image->tex;
+  tex = Texture();
+  tex.width  = shared.width;
+  tex.height = shared.height;
+  tex.layout = shared.layout;
+  tex.srgb   = shared.srgb;
+  tex.mipmap.assign(shared.mipmap.begin(), shared.mipmap.begin() + 1);
+  convert_texels(tex, LINEAR_LAYOUT);
+  image->mip_sampler = NULL;
+  image->mips_dirty  = true;
+}
+
+void collect( vector<SVGElement*>& elements, const Matrix3x3& transform,
+              size_t sample_rate, Sampler2D* sampler, bool lazy, bool copies,
+              map<pair<uint64_t, bool>, Job>& shared, vector<Job>& jobs ) {
+
+  for (size_t i = 0; i < elements.size(); i++) {
+    SVGElement* element = elements[i];
+    Matrix3x3 m = transform * element->transform;
+    if (element->type == GROUP) {
+      collect(static_cast<Group*>(element)->elements, m, sample_rate,
+              sampler, lazy, copies, shared, jobs);
+      continue;
+    }
+    if (element->type != IMAGE) continue;
+
+    // packed images are mipmapped with their page
+    Image* image = static_cast<Image*>(element);
+    if (image->atlas || image->sampled().mipmap.empty()) continue;
+
+    int full = num_mip_levels(image->sampled()) - 1;
+    int need = lazy ? min(TextureManager::coarsest_level(*image, m, sample_rate), full)
+                    : full;
+
+    Job single;
+    Job& job = image->tex_key ? shared[make_pair(image->tex_key, image->tex.srgb)]
+                              : single;
+    job.images.push_back(image);
+    job.need = max(job.need, need);
+
+    if (copies) {
+      if (image->tex.mipmap.empty() && image->texture) copy_base(image);
+      int have = valid_levels(image, sampler);
+      if (have > job.have) {
+        job.have = have;
+        job.builder = image;
+      }
+      if (!job.builder) job.builder = image;
+    }
+    if (!image->tex_key) jobs.push_back(job);
+  }
+}
+
+// the copies of the images of job made for the reference renderer,
+// built by a sampler of its own
+bool build_copies( Job& job, Sampler2D* sampler ) {
+
+  Image* builder = job.builder;
+  Texture& tex = builder->tex;
+  bool built = false;
+  if (job.need > job.have) {
+    convert_texels(tex, LINEAR_LAYOUT);
+    sampler->generate_mips(tex, 0);
+    builder->mip_sampler = sampler;
+    builder->mips_dirty  = false;
+    built = true;
+  }
+
+  for (size_t j = 0; j < job.images.size(); j++) {
+    Image* image = job.images[j];
+    if (image == builder || valid_levels(image, sampler) == (int) tex.mipmap.size() - 1) {
+      continue;
+    }
+    image->tex = tex;
+    image->mip_sampler = sampler;
+    image->mips_dirty  = false;
+  }
+  return built;
+}
+
+// the same, copied from the shared texture our sampler completed
+void copy_shared( Job& job, Sampler2D* sampler ) {
+  for (size_t j = 0; j < job.images.size(); j++) {
+    Image* image = job.images[j];
+    if (!image->texture ||
+        valid_levels(image, sampler) == (int) image->texture->mipmap.size() - 1) {
+      continue;
+    }
+    image->tex = *image->texture;
+    convert_texels(image->tex, LINEAR_LAYOUT);
+    image->mip_sampler = sampler;
+    image->mips_dirty  = false;
+  }
+}
+
+// copies no renderer reads any more
+void drop_copies( Job& job ) {
+  for (size_t j = 0; j < job.images.size(); j++) {
+    Image* image = job.images[j];
+    if (image->tex.mipmap.empty() || !image->texture) continue;
+    bool srgb = image->tex.srgb;
+    image->tex = Texture();
+    image->tex.srgb = srgb;
+    image->mip_sampler = NULL;
+    image->mips_dirty  = true;
+  }
+}
+
+} // namespace
+
+int TextureManager::coarsest_level( const Image& image, const Matrix3x3& transform,
+                                    size_t sample_rate ) {
+
+  // the footprint of SoftwareRendererImp::rasterize_image_affine
+  Vector2D o = apply(transform, image.position);
+  Vector2D a = apply(transform, image.position + Vector2D(image.dimension.x, 0)) - o;
+  Vector2D b = apply(transform, image.position + Vector2D(0, image.dimension.y)) - o;
+  a *= sample_rate; b *= sample_rate;
+  double det = a.x * b.y - a.y * b.x;
+  if (fabs(det) < 1e-12) return 0;
+
+  double dudx =  b.y / det, dvdx = -a.y / det;
+  double dudy = -b.x / det, dvdy =  a.x / det;
+  double tw = image.sampled().width, th = image.sampled().height;
+  double footprint = max(sqrt(dudx * dudx * tw * tw + dvdx * dvdx * th * th),
+                         sqrt(dudy * dudy * tw * tw + dvdy * dvdy * th * th));
+
+  // trilinear blends the level of the footprint with the next one
+  return footprint > 1 ? (int) floor(log2(footprint)) + 1 : 0;
+}
+
+int TextureManager::update( SVG* svg, Sampler2D* sampler,
+                            const Matrix3x3& canvas_to_screen, size_t sample_rate,
+                            bool lazy ) {
+
+  Sampler2DImp* imp = dynamic_cast<Sampler2DImp*>(sampler);
+  if (!imp) lazy = false;
+
+  // the reference renderer and sampler read Image::tex in place
+  bool copies = !lazy;
+
+  map<pair<uint64_t, bool>, Job> shared;
+  vector<Job> jobs;
+  collect(svg->elements, canvas_to_screen, sample_rate, sampler, lazy,
+          copies && !imp, shared, jobs);
+  for (map<pair<uint64_t, bool>, Job>::iterator it = shared.begin();
+       it != shared.end(); ++it) {
+    jobs.push_back(it->second);
+  }
+
+  // the reference sampler is not known to be thread safe
+  long n = jobs.size();
+  int changed = 0;
+  if (!imp) {
+    for (long i = 0; i < n; i++) changed += build_copies(jobs[i], sampler);
+    return changed;
+  }
+
+  // across textures in parallel, a single texture parallelizes its
+  // levels; tables are built here so that drawing never changes a
+  // shared texture
+  bool table = imp->get_sample_method() == SUMMED_AREA;
+  #pragma omp parallel for schedule(dynamic) reduction(+:changed) if (n > 1)
+  for (long i = 0; i < n; i++) {
+
+    Job& job = jobs[i];
+    shared_ptr<const Texture> texture =
+      TextureCache::extend(job.images[0], imp, job.need, table);
+    for (size_t j = 0; j < job.images.size(); j++) {
+      Image* image = job.images[j];
+      if (image->texture == texture) continue;
+      image->texture = texture;
+      changed++;
+    }
+
+    if (copies) copy_shared(job, sampler);
+    else drop_copies(job);
+  }
+
+  return changed;
+}
+
+} // namespace CMU462
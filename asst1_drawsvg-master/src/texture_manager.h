@@ -0,0 +1,41 @@
+#ifndef CMU462_TEXTURE_MANAGER_H
+#define CMU462_TEXTURE_MANAGER_H
+
+#include "svg.h"
+#include "texture.h"
+#include "matrix3x3.h"
+
+namespace CMU462 {
+
+/**
+ * Keeps the mip chains of the images of an svg ready for drawing.
+ * Images are found at any depth of groups. Our sampler extends the shared
+ * texture of each payload (see TextureCache) only down to the coarsest
+ * level the current view samples, so zooming out extends it a few levels
+ * at a time, in parallel across payloads. The reference renderer and
+ * sampler read Image::tex in place instead, which then holds a copy with
+ * the whole chain, rebuilt only when level 0 changed (Image::mips_dirty)
+ * or another sampler built it.
+ */
+class TextureManager {
+ public:
+
+  // Brings the chains of svg up to date for drawing with canvas_to_screen
+  // at sample_rate, with levels built by sampler. Chains are built whole
+  // when lazy is false or the sampler is not ours, as the reference
+  // renderer and sampler may read any level; lazy updates drop the copies
+  // made for them. Returns the number of images whose texture changed.
+  static int update( SVG* svg, Sampler2D* sampler,
+                     const Matrix3x3& canvas_to_screen, size_t sample_rate,
+                     bool lazy = true );
+
+  // coarsest level of image trilinear filtering reads when drawn with
+  // transform at sample_rate, 0 when it is magnified
+  static int coarsest_level( const Image& image, const Matrix3x3& transform,
+                             size_t sample_rate );
+
+}; // class TextureManager
+
+} // namespace CMU462
+
+#endif // CMU462_TEXTURE_MANAGER_H
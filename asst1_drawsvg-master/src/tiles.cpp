@@ -0,0 +1,292 @@
+#include "tiles.h"
+
+#include <cmath>
+#include <cstdio>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <functional>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+#include "vector3D.h"
+#include "triangulation.h"
+#include "texture_cache.h"
+#include "texture_manager.h"
+
+using namespace std;
+
+namespace CMU462 {
+
+namespace {
+
+Vector2D apply( const Matrix3x3& m, const Vector2D& p ) {
+  Vector3D u = m * Vector3D(p.x, p.y, 1.0);
+  return Vector2D(u.x / u.z, u.y / u.z);
+}
+
+// bounds of points in their own space, false if there are none
+bool local_bounds( SVGElement* element, Vector2D& lo, Vector2D& hi ) {
+
+  vector<Vector2D> points;
+  switch (element->type) {
+    case POINT:
+      points.push_back(static_cast<Point*>(element)->position);
+      break;
+    case LINE: {
+      Line* line = static_cast<Line*>(element);
+      points.push_back(line->from);
+      points.push_back(line->to);
+      break;
+    }
+    case POLYLINE:
+      points = static_cast<Polyline*>(element)->points;
+      break;
+    case POLYGON:
+      points = static_cast<Polygon*>(element)->points;
+      break;
+    case RECT: {
+      Rect* rect = static_cast<Rect*>(element);
+      points.push_back(rect->position);
+      points.push_back(rect->position + rect->dimension);
+      break;
+    }
+    case ELLIPSE: {
+      Ellipse* ellipse = static_cast<Ellipse*>(element);
+      points.push_back(ellipse->center - ellipse->radius);
+      points.push_back(ellipse->center + ellipse->radius);
+      break;
+    }
+    case IMAGE: {
+      Image* image = static_cast<Image*>(element);
+      points.push_back(image->position);
+      points.push_back(image->position + image->dimension);
+      break;
+    }
+    default:
+      break;
+  }
+  if (points.empty()) return false;
+
+  lo = hi = points[0];
+  for (size_t i = 1; i < points.size(); i++) {
+    lo.x = min(lo.x, points[i].x); lo.y = min(lo.y, points[i].y);
+    hi.x = max(hi.x, points[i].x); hi.y = max(hi.y, points[i].y);
+  }
+  return true;
+}
+
+void prepare_table( Texture& tex ) {
+  if (tex.sat.empty() && !tex.srgb && !tex.mipmap.empty()) {
+    build_summed_area_table(tex);
+  }
+}
+
+} // namespace
+
+// Tile set //
+
+TileSet::TileSet( SVG* svg ) : svg ( svg ) {
+  flatten(svg->elements, Matrix3x3::identity());
+}
+
+void TileSet::flatten( vector<SVGElement*>& elements,
+                       const Matrix3x3& transform ) {
+
+  for (size_t i = 0; i < elements.size(); i++) {
+    SVGElement* element = elements[i];
+    Matrix3x3 m = transform * element->transform;
+    if (element->type == GROUP) {
+      flatten(static_cast<Group*>(element)->elements, m);
+      continue;
+    }
+
+    // tiles draw polygons concurrently, so they are triangulated here
+    if (element->type == POLYGON) {
+      Polygon* polygon = static_cast<Polygon*>(element);
+      if (polygon->triangles.empty()) {
+        triangulate(*polygon, polygon->triangles);
+      }
+    }
+
+    Vector2D lo, hi;
+    if (!local_bounds(element, lo, hi)) continue;
+
+    // corners of the local bounds, on the canvas
+    Vector2D corners[4] = { apply(m, lo), apply(m, Vector2D(hi.x, lo.y)),
+                            apply(m, Vector2D(lo.x, hi.y)), apply(m, hi) };
+    float x0 = corners[0].x, y0 = corners[0].y, x1 = x0, y1 = y0;
+    for (int c = 1; c < 4; c++) {
+      x0 = min(x0, (float) corners[c].x); y0 = min(y0, (float) corners[c].y);
+      x1 = max(x1, (float) corners[c].x); y1 = max(y1, (float) corners[c].y);
+    }
+
+    this->elements.push_back(element);
+    transforms.push_back(transform);
+    bounds.push_back(x0); bounds.push_back(y0);
+    bounds.push_back(x1); bounds.push_back(y1);
+  }
+}
+
+Matrix3x3 TileSet::canvas_to_tile( int z, int x, int y,
+                                   size_t tile_size ) const {
+  double side = max(max(svg->width, svg->height), 1.f);
+  double scale = ldexp((double) tile_size, z) / side;
+  Matrix3x3 m = Matrix3x3::identity();
+  m(0,0) = scale; m(0,2) = -(double) x * tile_size;
+  m(1,1) = scale; m(1,2) = -(double) y * tile_size;
+  return m;
+}
+
+void TileSet::prepare( Sampler2D* sampler, int z, size_t tile_size,
+                       size_t sample_rate ) {
+
+  // the footprint of images is the same in every tile of a level
+  prepare(sampler, canvas_to_tile(z, 0, 0, tile_size), sample_rate);
+}
+
+void TileSet::prepare( Sampler2D* sampler, const Matrix3x3& canvas_to_screen,
+                       size_t sample_rate ) {
+
+  TextureManager::update(svg, sampler, canvas_to_screen, sample_rate);
+
+  // the update builds the tables of images, those of atlas pages are
+  // otherwise built on first use, by whichever tile gets there
+  if (sampler->get_sample_method() == SUMMED_AREA) {
+    for (size_t i = 0; i < svg->atlas.size(); i++) {
+      prepare_table(*svg->atlas[i]);
+    }
+  }
+}
+
+size_t TileSet::draw( int z, int x, int y, size_t tile_size,
+                      SoftwareRendererImp& renderer ) const {
+  return draw(canvas_to_tile(z, x, y, tile_size), tile_size, tile_size,
+              renderer);
+}
+
+size_t TileSet::draw( const Matrix3x3& canvas_to_screen, size_t width,
+                      size_t height, SoftwareRendererImp& renderer,
+                      bool outline ) const {
+
+  // screen bounds of the target on the canvas, with a margin for the
+  // pixel wide lines and points drawn around the edges of elements
+  Matrix3x3 screen_to_canvas = canvas_to_screen.inv();
+  double sx0 = renderer.target_origin_x() - 2.0, sx1 = sx0 + width + 4.0;
+  double sy0 = renderer.target_origin_y() - 2.0, sy1 = sy0 + height + 4.0;
+  Vector2D corners[4] = {
+    apply(screen_to_canvas, Vector2D(sx0, sy0)),
+    apply(screen_to_canvas, Vector2D(sx1, sy0)),
+    apply(screen_to_canvas, Vector2D(sx0, sy1)),
+    apply(screen_to_canvas, Vector2D(sx1, sy1))
+  };
+  double x0 = corners[0].x, y0 = corners[0].y, x1 = x0, y1 = y0;
+  for (int c = 1; c < 4; c++) {
+    x0 = min(x0, corners[c].x); y0 = min(y0, corners[c].y);
+    x1 = max(x1, corners[c].x); y1 = max(y1, corners[c].y);
+  }
+
+  // a scan over the flattened bounds, cheap next to drawing the tile
+  vector<SVGElement*> visible;
+  vector<Matrix3x3> visible_transforms;
+  for (size_t i = 0; i < elements.size(); i++) {
+    const float* b = &bounds[4 * i];
+    if (b[2] < x0 || b[0] > x1 || b[3] < y0 || b[1] > y1) continue;
+    visible.push_back(elements[i]);
+    visible_transforms.push_back(transforms[i]);
+  }
+
+  renderer.set_canvas_to_screen(canvas_to_screen);
+  renderer.clear_target();
+  renderer.draw_elements(visible.data(), visible_transforms.data(),
+                         visible.size(), outline ? svg : NULL);
+  return visible.size();
+}
+
+// Tile store //
+
+TileStore::TileStore( const string& dir, uint64_t document, size_t tile_size,
+                      size_t sample_rate, SampleMethod method )
+  : dir ( dir ) {
+
+  // bump the version when tiles of the same document come out different
+  char text[128];
+  int n = snprintf(text, sizeof(text), "tiles 1 %016llx %zu %zu %d",
+                   (unsigned long long) document, tile_size, sample_rate,
+                   (int) method);
+  key = TextureCache::key(text, n);
+}
+
+string TileStore::path( int z, int x, int y ) const {
+  char text[128];
+  int n = snprintf(text, sizeof(text), "%016llx %d %d %d",
+                   (unsigned long long) key, z, x, y);
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx",
+           (unsigned long long) TextureCache::key(text, n));
+
+  // a directory per leading byte keeps directories small
+  return dir + "/" + string(name, 2) + "/" + string(name + 2) + ".png";
+}
+
+int TileStore::load( int z, int x, int y, vector<unsigned char>& png ) const {
+
+  FILE* file = fopen(path(z, x, y).c_str(), "rb");
+  if (!file) return -1;
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  png.resize(size > 0 ? size : 0);
+  size_t read = size > 0 ? fread(&png[0], 1, size, file) : 0;
+  fclose(file);
+  return size > 0 && read == (size_t) size ? 0 : -1;
+}
+
+int TileStore::save( int z, int x, int y,
+                     const vector<unsigned char>& png ) const {
+
+  string file = path(z, x, y);
+  if (make_directories(file.substr(0, file.find_last_of('/'))) < 0) return -1;
+
+  // unique to the writer, so a reader only ever sees whole tiles
+  char suffix[64];
+  snprintf(suffix, sizeof(suffix), ".%zx.%llx.tmp",
+           hash<thread::id>()(this_thread::get_id()),
+           (unsigned long long) chrono::steady_clock::now().time_since_epoch().count());
+  string temporary = file + suffix;
+
+  FILE* out = fopen(temporary.c_str(), "wb");
+  if (!out) return -1;
+  bool written = fwrite(png.data(), 1, png.size(), out) == png.size();
+  written &= fclose(out) == 0;
+  if (!written || rename(temporary.c_str(), file.c_str()) != 0) {
+    remove(temporary.c_str());
+    return -1;
+  }
+  return 0;
+}
+
+int make_directories( const string& path ) {
+
+  struct stat st;
+  if (path.empty() || stat(path.c_str(), &st) == 0) return 0;
+
+  size_t slash = path.find_last_of('/');
+  if (slash != string::npos && slash > 0) {
+    if (make_directories(path.substr(0, slash)) < 0) return -1;
+  }
+
+#ifdef _WIN32
+  int error = _mkdir(path.c_str());
+#else
+  int error = mkdir(path.c_str(), 0755);
+#endif
+
+  // another writer may have made it meanwhile
+  return error == 0 || stat(path.c_str(), &st) == 0 ? 0 : -1;
+}
+
+} // namespace CMU462
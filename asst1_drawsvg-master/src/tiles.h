@@ -0,0 +1,113 @@
+#ifndef CMU462_TILES_H
+#define CMU462_TILES_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "svg.h"
+#include "texture.h"
+#include "matrix3x3.h"
+#include "software_renderer.h"
+
+namespace CMU462 {
+
+/**
+ * Map tiles of an svg, in the z/x/y scheme of web maps. Zoom level z is
+ * 2^z by 2^z tiles of tile_size pixels, and level 0 is a single tile
+ * holding the square of the longer side of the canvas, from its top left.
+ * The scene is flattened once into its leaf elements with their transforms
+ * and canvas bounds, so a tile only draws the elements it overlaps, and
+ * after prepare() the tiles of a level can be drawn concurrently, each
+ * thread with its own renderer.
+ */
+class TileSet {
+ public:
+
+  // flattens svg, which has to outlive the tile set, triangulating its
+  // polygons that were not compiled
+  TileSet( SVG* svg );
+
+  // canvas to screen transform of tile (x, y) of level z
+  Matrix3x3 canvas_to_tile( int z, int x, int y, size_t tile_size ) const;
+
+  // Brings the mip chains, and summed-area tables when sampler uses
+  // them, up to date for drawing level z. Not thread safe, call before
+  // drawing tiles of the level.
+  void prepare( Sampler2D* sampler, int z, size_t tile_size,
+                size_t sample_rate );
+
+  // as above, for drawing under canvas_to_screen or any translation of
+  // it, all of the view at once or a strip of it at a time
+  void prepare( Sampler2D* sampler, const Matrix3x3& canvas_to_screen,
+                size_t sample_rate );
+
+  // Draws tile (x, y) of level z with renderer, whose target has to be
+  // tile_size pixels square. Returns the number of elements drawn.
+  size_t draw( int z, int x, int y, size_t tile_size,
+               SoftwareRendererImp& renderer ) const;
+
+  // Draws the part of the scene under canvas_to_screen that falls on a
+  // width by height target, the target of renderer at its target origin,
+  // with the canvas outline as draw_svg() has it when outline is set.
+  size_t draw( const Matrix3x3& canvas_to_screen, size_t width,
+               size_t height, SoftwareRendererImp& renderer,
+               bool outline = false ) const;
+
+  // number of leaf elements of the scene
+  inline size_t size() const { return elements.size(); }
+
+ private:
+
+  void flatten( std::vector<SVGElement*>& elements,
+                const Matrix3x3& transform );
+
+  SVG* svg;
+
+  // leaf elements in drawing order, with the transform of their parent
+  // groups and their bounds on the canvas
+  std::vector<SVGElement*> elements;
+  std::vector<Matrix3x3> transforms;
+  std::vector<float> bounds;
+
+}; // class TileSet
+
+/**
+ * Directory of encoded tiles addressed by content: a tile is stored under
+ * a hash of the document source and everything that goes into drawing it,
+ * so a document that changes gets new tiles and stale ones are never
+ * served. Tiles are written to a temporary file and renamed into place,
+ * so concurrent writers, threads or processes, are safe.
+ */
+class TileStore {
+ public:
+
+  // tiles of the document whose source hashes to document (see
+  // TextureCache::key) under directory dir
+  TileStore( const std::string& dir, uint64_t document, size_t tile_size,
+             size_t sample_rate, SampleMethod method );
+
+  // file of tile (x, y) of level z
+  std::string path( int z, int x, int y ) const;
+
+  // reads a stored tile, -1 if there is none
+  int load( int z, int x, int y, std::vector<unsigned char>& png ) const;
+
+  // stores an encoded tile
+  int save( int z, int x, int y, const std::vector<unsigned char>& png ) const;
+
+ private:
+
+  std::string dir;
+
+  // hash of the document and drawing parameters
+  uint64_t key;
+
+}; // class TileStore
+
+// creates a directory and its missing parents, -1 on failure
+int make_directories( const std::string& path );
+
+} // namespace CMU462
+
+#endif // CMU462_TILES_H
@@ -0,0 +1,406 @@
+#include "virtual_texture.h"
+
+#include <cmath>
+#include <mutex>
+#include <cstring>
+#include <algorithm>
+
+#include "png.h"
+
+using namespace std;
+
+namespace CMU462 {
+
+/* NOTE:
+ * A png can not be decoded from the middle, so level 0 is decoded once,
+ * a row at a time, and spilled to an anonymous store file one band of
+ * tiles at a time while the preview is averaged from the same rows.
+ * Nothing larger than a band of rows is ever held decoded. Coarser tiles
+ * are box filtered from their four children the first time they are
+ * needed and written through to the store, so zooming back out of a
+ * region reads them instead of filtering them again.
+ */
+static const size_t kTileBytes = 4 * VirtualTexture::kTileSize *
+                                     VirtualTexture::kTileSize;
+static const size_t kNoSlot = (size_t) -1;
+
+struct VirtualTile {
+
+  VirtualTile( VirtualTexture* owner, size_t slot )
+    : owner ( owner ), slot ( slot ), prev ( NULL ), next ( NULL ),
+      texels ( kTileBytes ) { }
+
+  VirtualTexture* owner;
+  size_t slot;
+
+  // neighbours in the cache, most recently used first
+  VirtualTile* prev;
+  VirtualTile* next;
+
+  std::vector<unsigned char> texels;
+
+  // drops the tile from its owner, the cache unlinks it
+  void evict() {
+    owner->resident[slot] = NULL;
+    if (owner->last_slot == slot) owner->last_slot = kNoSlot;
+  }
+};
+
+namespace {
+
+struct TileCache {
+
+  TileCache() : head ( NULL ), tail ( NULL ), bytes ( 0 ),
+                limit ( 256 << 20 ), threshold ( 1 << 26 ) { }
+
+  mutex lock;
+  VirtualTile* head;
+  VirtualTile* tail;
+  size_t bytes;
+  size_t limit;
+  size_t threshold;
+
+  void unlink( VirtualTile* t ) {
+    (t->prev ? t->prev->next : head) = t->next;
+    (t->next ? t->next->prev : tail) = t->prev;
+    t->prev = t->next = NULL;
+  }
+
+  void push_front( VirtualTile* t ) {
+    t->next = head;
+    if (head) head->prev = t;
+    head = t;
+    if (!tail) tail = t;
+  }
+
+  // evicts least recently used tiles down to the limit, sparing keep
+  void trim( VirtualTile* keep ) {
+    while (bytes > limit && tail && tail != keep) {
+      VirtualTile* t = tail;
+      unlink(t);
+      t->evict();
+      bytes -= kTileBytes;
+      delete t;
+    }
+  }
+};
+
+// never destroyed, images may outlive static destruction
+TileCache& cache() {
+  static TileCache* cache = new TileCache();
+  return *cache;
+}
+
+} // namespace
+
+void VirtualTexture::set_threshold( size_t texels ) {
+  TileCache& c = cache();
+  lock_guard<mutex> guard(c.lock);
+  c.threshold = texels;
+}
+
+size_t VirtualTexture::get_threshold() {
+  TileCache& c = cache();
+  lock_guard<mutex> guard(c.lock);
+  return c.threshold;
+}
+
+void VirtualTexture::set_cache_limit( size_t bytes ) {
+  TileCache& c = cache();
+  lock_guard<mutex> guard(c.lock);
+  c.limit = max(bytes, 16 * kTileBytes);
+  c.trim(NULL);
+}
+
+size_t VirtualTexture::get_cache_limit() {
+  TileCache& c = cache();
+  lock_guard<mutex> guard(c.lock);
+  return c.limit;
+}
+
+VirtualTexture::VirtualTexture() : store ( NULL ), last_slot ( kNoSlot ),
+                                   last_texels ( NULL ) { }
+
+VirtualTexture::~VirtualTexture() {
+
+  TileCache& c = cache();
+  {
+    lock_guard<mutex> guard(c.lock);
+    for (size_t i = 0; i < resident.size(); i++) {
+      if (!resident[i]) continue;
+      c.unlink(resident[i]);
+      c.bytes -= kTileBytes;
+      delete resident[i];
+    }
+  }
+  if (store) fclose(store);
+}
+
+VirtualTexture* VirtualTexture::create( const unsigned char* png, size_t size,
+                                        Texture& preview ) {
+
+  PNGRowReader reader;
+  if (reader.open(png, size)) return NULL;
+  size_t w = reader.width(), h = reader.height();
+  const size_t T = kTileSize;
+
+  // levels halve like the mip chain, down to the preview
+  VirtualTexture* vt = new VirtualTexture();
+  size_t slots = 0;
+  for (size_t lw = w, lh = h; ; lw = max(lw / 2, (size_t) 1),
+                                lh = max(lh / 2, (size_t) 1)) {
+    Level level;
+    level.width   = lw;
+    level.height  = lh;
+    level.tiles_x = (lw + T - 1) / T;
+    level.tiles_y = (lh + T - 1) / T;
+    level.first_slot = slots;
+    slots += level.tiles_x * level.tiles_y;
+    vt->levels.push_back(level);
+    if (max(lw, lh) <= kPreviewSize) break;
+  }
+
+  // small enough to be an ordinary texture
+  if (vt->levels.size() == 1 || !(vt->store = tmpfile())) {
+    delete vt;
+    return NULL;
+  }
+  vt->stored.assign(slots, false);
+  vt->resident.assign(slots, NULL);
+
+  // preview texels average blocks of 2^shift by 2^shift source texels
+  size_t shift = vt->levels.size() - 1;
+  size_t pw = vt->levels.back().width, ph = vt->levels.back().height;
+  vector<uint64_t> sums(4 * pw);
+  vector<uint32_t> columns(pw, 0);
+  for (size_t x = 0; x < w && (x >> shift) < pw; x++) columns[x >> shift]++;
+
+  preview = Texture();
+  preview.mipmap.push_back(MipLevel());
+  MipLevel& mip = preview.mipmap.back();
+  mip.width  = pw;
+  mip.height = ph;
+  mip.texels.resize(4 * pw * ph);
+  preview.width  = pw;
+  preview.height = ph;
+
+  const Level& base = vt->levels[0];
+  vector<unsigned char> band(4 * w * T);
+  vector<unsigned char> tile(kTileBytes);
+  for (size_t y = 0; y < h; y++) {
+
+    unsigned char* row = &band[4 * w * (y % T)];
+    if (reader.read_row(row)) {
+      delete vt;
+      return NULL;
+    }
+
+    // accumulate the preview row, emitting it after its last source row
+    size_t py = y >> shift;
+    if (py < ph) {
+      for (size_t x = 0; x < w && (x >> shift) < pw; x++) {
+        uint64_t* sum = &sums[4 * (x >> shift)];
+        for (int c = 0; c < 4; c++) sum[c] += row[4 * x + c];
+      }
+      if (y + 1 == min((py + 1) << shift, h)) {
+        uint64_t rows = y + 1 - (py << shift);
+        unsigned char* out = &mip.texels[4 * pw * py];
+        for (size_t x = 0; x < pw; x++) {
+          uint64_t count = rows * columns[x];
+          for (int c = 0; c < 4; c++) {
+            out[4 * x + c] = (unsigned char) ((sums[4 * x + c] + count / 2) / count);
+          }
+        }
+        fill(sums.begin(), sums.end(), 0);
+      }
+    }
+
+    // spill the band once its tiles are complete
+    if (y % T == T - 1 || y == h - 1) {
+      size_t ty = y / T, rows = y % T + 1;
+      for (size_t tx = 0; tx < base.tiles_x; tx++) {
+        size_t x0 = tx * T, cols = min(T, w - x0);
+        for (size_t r = 0; r < rows; r++) {
+          memcpy(&tile[4 * T * r], &band[4 * (w * r + x0)], 4 * cols);
+        }
+        size_t slot = base.first_slot + ty * base.tiles_x + tx;
+        if (vt->write_slot(slot, tile.data())) {
+          delete vt;
+          return NULL;
+        }
+        vt->stored[slot] = true;
+      }
+    }
+  }
+
+  return vt;
+}
+
+int VirtualTexture::read_slot( size_t slot, unsigned char* texels ) {
+  uint64_t offset = (uint64_t) slot * kTileBytes;
+#ifdef _WIN32
+  if (_fseeki64(store, offset, SEEK_SET)) return -1;
+#else
+  if (fseeko(store, offset, SEEK_SET)) return -1;
+#endif
+  return fread(texels, 1, kTileBytes, store) == kTileBytes ? 0 : -1;
+}
+
+int VirtualTexture::write_slot( size_t slot, const unsigned char* texels ) {
+  uint64_t offset = (uint64_t) slot * kTileBytes;
+#ifdef _WIN32
+  if (_fseeki64(store, offset, SEEK_SET)) return -1;
+#else
+  if (fseeko(store, offset, SEEK_SET)) return -1;
+#endif
+  return fwrite(texels, 1, kTileBytes, store) == kTileBytes ? 0 : -1;
+}
+
+int VirtualTexture::filter_tile( size_t level, size_t tx, size_t ty,
+                                 unsigned char* texels ) {
+
+  // 2x2 box of the level above, so a texel never needs a neighbouring
+  // tile. The odd last row or column of a level is dropped where the mip
+  // chain spreads it over the level, a shift of at most half a texel.
+  const Level& fine = levels[level - 1];
+  const Level& dst  = levels[level];
+  const size_t T = kTileSize, H = T / 2;
+  for (size_t j = 0; j < 2; j++) {
+    for (size_t i = 0; i < 2; i++) {
+
+      size_t cx = 2 * tx + i, cy = 2 * ty + j;
+      if (cx >= fine.tiles_x || cy >= fine.tiles_y) continue;
+      size_t x0 = tx * T + i * H, y0 = ty * T + j * H;
+      if (x0 >= dst.width || y0 >= dst.height) continue;
+      size_t cols = min(H, dst.width - x0), rows = min(H, dst.height - y0);
+
+      // the texels of a child are only valid until the next lookup
+      const unsigned char* child = tile(level - 1, cx, cy);
+      size_t fw = min(T, fine.width  - cx * T);
+      size_t fh = min(T, fine.height - cy * T);
+      for (size_t y = 0; y < rows; y++) {
+        const unsigned char* r0 = child + 4 * T * min(2 * y,     fh - 1);
+        const unsigned char* r1 = child + 4 * T * min(2 * y + 1, fh - 1);
+        unsigned char* out = texels + 4 * (T * (j * H + y) + i * H);
+        for (size_t x = 0; x < cols; x++) {
+          size_t a = 4 * min(2 * x, fw - 1), b = 4 * min(2 * x + 1, fw - 1);
+          for (int c = 0; c < 4; c++) {
+            out[4 * x + c] = (r0[a + c] + r0[b + c] + r1[a + c] + r1[b + c] + 2) >> 2;
+          }
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+const unsigned char* VirtualTexture::tile( size_t level, size_t tx, size_t ty ) {
+
+  const Level& l = levels[level];
+  size_t slot = l.first_slot + ty * l.tiles_x + tx;
+  if (slot == last_slot) return last_texels;
+
+  TileCache& c = cache();
+  VirtualTile* t = resident[slot];
+  if (t) {
+    c.unlink(t);
+    c.push_front(t);
+  } else {
+
+    // tiles that can not be read or filtered stay transparent
+    t = new VirtualTile(this, slot);
+    if (stored[slot]) {
+      if (read_slot(slot, t->texels.data())) {
+        fill(t->texels.begin(), t->texels.end(), 0);
+      }
+    } else if (level > 0 && !filter_tile(level, tx, ty, t->texels.data())) {
+      if (!write_slot(slot, t->texels.data())) stored[slot] = true;
+    }
+
+    resident[slot] = t;
+    c.push_front(t);
+    c.bytes += kTileBytes;
+    c.trim(t);
+  }
+
+  last_slot = slot;
+  last_texels = t->texels.data();
+  return last_texels;
+}
+
+inline const unsigned char* VirtualTexture::texel( size_t level, int x, int y ) {
+  const Level& l = levels[level];
+  size_t sx = min((size_t) max(x, 0), l.width  - 1);
+  size_t sy = min((size_t) max(y, 0), l.height - 1);
+  const unsigned char* t = tile(level, sx / kTileSize, sy / kTileSize);
+  return t + 4 * (kTileSize * (sy % kTileSize) + sx % kTileSize);
+}
+
+static inline Color to_color( const unsigned char* texel ) {
+  float f = 1.f / 255;
+  return Color(texel[0] * f, texel[1] * f, texel[2] * f, texel[3] * f);
+}
+
+static inline Color lerp( const Color& a, const Color& b, float t ) {
+  return a + t * (b - a);
+}
+
+Color VirtualTexture::bilinear( size_t level, float u, float v ) {
+  const Level& l = levels[level];
+  float x = l.width * u - 0.5f, y = l.height * v - 0.5f;
+  int sx = floor(x), sy = floor(y);
+  float tx = x - sx, ty = y - sy;
+  Color c0 = lerp(to_color(texel(level, sx, sy)),
+                  to_color(texel(level, sx + 1, sy)), tx);
+  Color c1 = lerp(to_color(texel(level, sx, sy + 1)),
+                  to_color(texel(level, sx + 1, sy + 1)), tx);
+  return lerp(c0, c1, ty);
+}
+
+bool VirtualTexture::needs_tiles( SampleMethod method,
+                                  float u_scale, float v_scale ) const {
+  if (method == NEAREST || method == BILINEAR) return true;
+  float footprint = max(u_scale * width(), v_scale * height());
+  return footprint < (float) (1 << (levels.size() - 1));
+}
+
+void VirtualTexture::sample_span( SampleMethod method,
+                                  const float* uv, size_t n,
+                                  float u_scale, float v_scale,
+                                  Color* colors ) {
+
+  lock_guard<mutex> guard(cache().lock);
+
+  if (method == NEAREST) {
+    float w = width(), h = height();
+    for (size_t i = 0; i < n; i++) {
+      float x = w * uv[2 * i] - 0.5f, y = h * uv[2 * i + 1] - 0.5f;
+      int sx = floor(x), sy = floor(y);
+      if (x - sx >= 0.5f) ++sx;
+      if (y - sy >= 0.5f) ++sy;
+      colors[i] = to_color(texel(0, sx, sy));
+    }
+    return;
+  }
+
+  // level pair of the footprint, as Sampler2DImp::sample_span
+  int level = 0; float t = 0;
+  if (method == TRILINEAR || method == SUMMED_AREA) {
+    float d = log2f(max(u_scale * width(), v_scale * height()));
+    level = floor(d);
+    t = d - level;
+    if (level < 0) {
+      level = 0; t = 0;
+    } else if (level >= (int) levels.size() - 1) {
+      level = levels.size() - 1; t = 0;
+    }
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    float u = uv[2 * i], v = uv[2 * i + 1];
+    colors[i] = bilinear(level, u, v);
+    if (t > 0) colors[i] = lerp(colors[i], bilinear(level + 1, u, v), t);
+  }
+}
+
+} // namespace CMU462
@@ -0,0 +1,106 @@
+#ifndef CMU462_VIRTUAL_TEXTURE_H
+#define CMU462_VIRTUAL_TEXTURE_H
+
+#include <vector>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "CMU462.h"
+#include "texture.h"
+
+namespace CMU462 {
+
+struct VirtualTile;
+
+/**
+ * Texture of an image too large to be held decoded, split into square
+ * tiles per mip level. Level 0 is decoded once into a tile store on disk,
+ * coarser levels are filtered from their children the first time they
+ * are sampled, and tiles are paged in as spans sample them. Resident
+ * tiles of all virtual textures share one LRU cache with a memory cap.
+ * The first level at most kPreviewSize on a side is the preview, which
+ * the image keeps as an ordinary texture for all coarser sampling, for
+ * the hardware renderer and for the reference renderer.
+ */
+class VirtualTexture {
+ public:
+
+  static const size_t kTileSize = 256;
+  static const size_t kPreviewSize = 2048;
+
+  // images with more texels than this are streamed, 64M by default
+  static void   set_threshold( size_t texels );
+  static size_t get_threshold();
+
+  // memory of resident tiles of all virtual textures, 256MB by default
+  // and never less than 16 tiles
+  static void   set_cache_limit( size_t bytes );
+  static size_t get_cache_limit();
+
+  // Decodes a png into a new tile store and its preview level into
+  // preview. Returns NULL if the png can not be decoded a row at a time
+  // (see PNGRowReader) or the store can not be written.
+  static VirtualTexture* create( const unsigned char* png, size_t size,
+                                 Texture& preview );
+
+  ~VirtualTexture();
+
+  inline size_t width()  const { return levels[0].width;  }
+  inline size_t height() const { return levels[0].height; }
+
+  // true if a footprint of u_scale by v_scale samples finer levels than
+  // the preview, so the tiles have to be sampled
+  bool needs_tiles( SampleMethod method, float u_scale, float v_scale ) const;
+
+  // Same as Sampler2D::sample_span on the full resolution texture, paging
+  // in the tiles the samples fall in. SUMMED_AREA filters trilinearly.
+  void sample_span( SampleMethod method, const float* uv, size_t n,
+                    float u_scale, float v_scale, Color* colors );
+
+ private:
+
+  struct Level {
+    size_t width, height;
+    size_t tiles_x, tiles_y;
+
+    // slot of the first tile of the level in the store
+    size_t first_slot;
+  };
+
+  VirtualTexture();
+
+  // texels of a tile, paging it in or filtering it from its children
+  const unsigned char* tile( size_t level, size_t tx, size_t ty );
+  int filter_tile( size_t level, size_t tx, size_t ty, unsigned char* texels );
+
+  int read_slot ( size_t slot, unsigned char* texels );
+  int write_slot( size_t slot, const unsigned char* texels );
+
+  // texel (x, y) of a level, clamped to its edges
+  inline const unsigned char* texel( size_t level, int x, int y );
+
+  Color bilinear( size_t level, float u, float v );
+
+  FILE* store;
+
+  // levels with tiles, finer than the preview
+  std::vector<Level> levels;
+
+  // per slot, whether the store holds the tile and where it is resident
+  std::vector<bool> stored;
+  std::vector<VirtualTile*> resident;
+
+  // tile of the last lookup, spans sample the same tile in runs
+  size_t last_slot;
+  const unsigned char* last_texels;
+
+  friend struct VirtualTile;
+
+  VirtualTexture( const VirtualTexture& );
+  VirtualTexture& operator=( const VirtualTexture& );
+
+}; // class VirtualTexture
+
+} // namespace CMU462
+
+#endif // CMU462_VIRTUAL_TEXTURE_H